@@ -7,6 +7,9 @@
 
 namespace isx
 {
+    /// Version of Inscopix CNMF-E, reported in logs and by the Python module
+    const char * const s_cnmfeVersion = "1.0.2";
+
     ///  Applies the CNMFe algorithm to an input movie and saves the components identified to disk
     ///
     /// \param inputMoviePath               Path to the input movie (only tiff movie supported)
@@ -27,6 +30,7 @@ namespace isx
     /// \param traceOutputUnits             Output units for temporal components (0: DF, 1: noise scaled)
     /// \param verbose                      If true progress will be displayed in the console (0: false, 1: true)
     /// \param deconvolve                   If true deconvolved traces are returned (using OASIS AR(1)), otherwise raw traces are returned (0: raw traces, 1: deconvolved traces)
+    /// \param spatialSolver                Solver used to update the spatial footprints (0: LASSO-LARS on each pixel, 1: HALS warm started from the previous footprints)
     std::tuple<arma::Cube<float>,arma::Mat<float>> cnmfe(
         const std::string & inputMoviePath,
         const std::string & outputDirPath = "output",
@@ -45,6 +49,30 @@ namespace isx
         const int patchOverlap = 20,
         const int traceOutputUnits = 1,
         const int deconvolve = 0,
+        const int verbose = 0,
+        const int spatialSolver = 0);
+
+    /// Previews the seed pixels that CNMFe would search for neurons in an input movie, for tuning minCorr and minPnr
+    /// The images are computed over the whole field of view from a subset of the frames of the movie,
+    /// using the same filtering and statistics as the initialization of neurons in cnmfe(...)
+    ///
+    /// \param inputMoviePath               Path to the input movie (only tiff movie supported)
+    /// \param averageCellDiameter          Average diameter of a neuron in pixels
+    /// \param minCorr                      Minimum pixel correlation when searching for seed pixels
+    /// \param minPnr                       Minimum peak-to-noise ratio when searching for seed pixels
+    /// \param gaussianKernelSize           Width of Gaussian kernel used for spatial filtering (< 2 will be auto estimated)
+    /// \param maxNumFrames                 Maximum number of frames read from the movie (three evenly spaced segments of consecutive frames are used for longer movies, <= 0 to use all frames)
+    /// \param numThreads                   Number of threads to use for processing
+    /// \param verbose                      If true progress will be displayed in the console (0: false, 1: true)
+    /// \return                             Peak-to-noise ratio image, local correlation image, and search value at candidate seed pixels (zero elsewhere)
+    std::tuple<arma::Mat<float>,arma::Mat<float>,arma::Mat<float>> cnmfePreview(
+        const std::string & inputMoviePath,
+        const int averageCellDiameter = 7,
+        const float minCorr = 0.8,
+        const float minPnr = 10.0,
+        const int gaussianKernelSize = 0,
+        const int maxNumFrames = 1000,
+        const int numThreads = 4,
         const int verbose = 0);
 } // namespace isx
 
@@ -1,6 +1,7 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/numpy.h>
 #include "isx/cnmfe.h"
+#include "isxOasis.h"
 
 namespace py = pybind11;
 
@@ -74,6 +75,32 @@ inline py::array_t<T> armaCubeToPyarray(arma::Cube<T>& src)
     return construct_array<T>(data);
 }
 
+// Convert an Armadillo Column to a one-dimensional pybind py::array (copies the data)
+template <typename T>
+inline py::array_t<T> armaColToPyarray(const arma::Col<T>& src)
+{
+    return py::array_t<T>(static_cast<ssize_t>(src.n_elem), src.memptr());
+}
+
+std::tuple<py::array,py::array> isx_online_oasis_update(
+    isx::OnlineOasis & oasis,
+    py::array_t<float, py::array::c_style | py::array::forcecast> samples)
+{
+    py::buffer_info buffer = samples.request();
+    const arma::Col<float> y(static_cast<float*>(buffer.ptr), static_cast<arma::uword>(buffer.size));
+
+    arma::Col<float> c, s;
+    oasis.update(y, c, s);
+    return std::make_tuple(armaColToPyarray(c), armaColToPyarray(s));
+}
+
+std::tuple<py::array,py::array> isx_online_oasis_flush(isx::OnlineOasis & oasis)
+{
+    arma::Col<float> c, s;
+    oasis.flush(c, s);
+    return std::make_tuple(armaColToPyarray(c), armaColToPyarray(s));
+}
+
 std::tuple<py::array,py::array> isx_cnmfe_python(
     const std::string & inputMoviePath,
     const std::string & outputDirPath,
@@ -92,7 +119,8 @@ std::tuple<py::array,py::array> isx_cnmfe_python(
     const int patchOverlap,
     const int traceOutputUnits,
     const int deconvolve,
-    const int verbose)
+    const int verbose,
+    const int spatialSolver)
     {
     std::tuple<arma::Cube<float>,arma::Mat<float>> cnmfeOutput = isx::cnmfe(
         inputMoviePath,
@@ -112,7 +140,8 @@ std::tuple<py::array,py::array> isx_cnmfe_python(
         patchOverlap,
         traceOutputUnits,
         deconvolve,
-        verbose
+        verbose,
+        spatialSolver
     );
 
     py::array footprints = armaCubeToPyarray(std::get<0>(cnmfeOutput));
@@ -120,10 +149,37 @@ std::tuple<py::array,py::array> isx_cnmfe_python(
     return std::make_tuple(footprints, traces);
 }
 
+std::tuple<py::array,py::array,py::array> isx_cnmfe_preview_python(
+    const std::string & inputMoviePath,
+    const int averageCellDiameter,
+    const float minCorr,
+    const float minPnr,
+    const int gaussianKernelSize,
+    const int maxNumFrames,
+    const int numThreads,
+    const int verbose)
+{
+    std::tuple<arma::Mat<float>,arma::Mat<float>,arma::Mat<float>> previewOutput = isx::cnmfePreview(
+        inputMoviePath,
+        averageCellDiameter,
+        minCorr,
+        minPnr,
+        gaussianKernelSize,
+        maxNumFrames,
+        numThreads,
+        verbose
+    );
+
+    py::array pnr = armaMatToPyarray(std::get<0>(previewOutput));
+    py::array localCorr = armaMatToPyarray(std::get<1>(previewOutput));
+    py::array seeds = armaMatToPyarray(std::get<2>(previewOutput));
+    return std::make_tuple(pnr, localCorr, seeds);
+}
+
 PYBIND11_MODULE(inscopix_cnmfe, handle)
 {
     handle.doc() = "Inscopix CNMF-E for automated source extraction";
-    handle.attr("__version__") = "1.0.2";
+    handle.attr("__version__") = isx::s_cnmfeVersion;
     handle.def("run_cnmfe", &isx_cnmfe_python, R"mydelimiter(
     Run the CNMF-E cell identification algorithm on a movie
 
@@ -147,6 +203,7 @@ PYBIND11_MODULE(inscopix_cnmfe, handle)
     output_units (int): Output units for the temporal components (0: dF, 1: noise scaled)
     deconvolve (int): Specifies whether to deconvolve the final temporal traces (0: return raw traces, 1: return deconvolved traces)
     verbose (int): To enable and disable verbose mode. When enabled, progress is displayed in the console. (0: disabled, 1: enabled)
+    spatial_solver (int): Solver used to update the spatial footprints (0: LASSO-LARS on each pixel, 1: HALS warm started from the previous footprints)
     )mydelimiter",
     py::arg("input_movie_path"),
     py::arg("output_dir_path") = "",
@@ -165,6 +222,80 @@ PYBIND11_MODULE(inscopix_cnmfe, handle)
     py::arg("patch_overlap") = 20,
     py::arg("output_units") = 1,
     py::arg("deconvolve") = 0,
+    py::arg("verbose") = 0,
+    py::arg("spatial_solver") = 0
+    );
+
+    handle.def("preview_seed_pixels", &isx_cnmfe_preview_python, R"mydelimiter(
+    Preview the seed pixels searched by CNMF-E for tuning the minimum pixel correlation and peak-to-noise ratio
+
+    The images are computed over the whole field of view from a subset of the frames of the movie, with the
+    same spatial filtering and statistics as the initialization of neurons in run_cnmfe, so thresholds
+    chosen on the preview carry over to a full run.
+
+    Arguments
+    ---------
+    input_movie_path (str): Path to the input tiff movie file
+    average_cell_diameter (int): Average diameter of a neuron in pixels
+    min_pixel_correlation (float): Minimum pixel correlation when searching for seed pixels
+    min_peak_to_noise_ratio (float): Minimum peak-to-noise ratio when searching for seed pixels
+    gaussian_kernel_size (int): Width of Gaussian kernel used for spatial filtering (< 2 will be auto estimated)
+    max_num_frames (int): Maximum number of frames read from the movie, taken as three segments of consecutive frames at the start, middle and end of longer movies (<= 0 to read all frames)
+    num_threads (int): Number of threads to use for processing
+    verbose (int): To enable and disable verbose mode. When enabled, progress is displayed in the console. (0: disabled, 1: enabled)
+
+    Returns
+    -------
+    (numpy.ndarray, numpy.ndarray, numpy.ndarray): Peak-to-noise ratio image, local correlation image, and search value at candidate seed pixels (zero elsewhere)
+    )mydelimiter",
+    py::arg("input_movie_path"),
+    py::arg("average_cell_diameter") = 7,
+    py::arg("min_pixel_correlation") = 0.8,
+    py::arg("min_peak_to_noise_ratio") = 10.0,
+    py::arg("gaussian_kernel_size") = 0,
+    py::arg("max_num_frames") = 1000,
+    py::arg("num_threads") = 4,
     py::arg("verbose") = 0
     );
+
+    py::class_<isx::OnlineOasis>(handle, "OnlineOasis", R"mydelimiter(
+    Streaming OASIS deconvolution of a fluorescence trace using an AR(1) model
+
+    Samples are deconvolved as they arrive and a value is finalized once it is older than the lag.
+    Earlier values may still change when later samples arrive, so a longer lag trades latency for
+    agreement with the deconvolution of the complete trace. Memory does not grow with the trace length.
+
+    Arguments
+    ---------
+    gamma (float): Calcium dynamics decay constant
+    baseline (float): Baseline fluorescence subtracted from each sample
+    penalty (float): Sparsity penalty on the spikes
+    lag (int): Number of samples after which a value is finalized
+    )mydelimiter")
+    .def(py::init<const float, const float, const float, const size_t>(),
+        py::arg("gamma"),
+        py::arg("baseline") = 0.0,
+        py::arg("penalty") = 0.0,
+        py::arg("lag") = 10)
+    .def("update", &isx_online_oasis_update, R"mydelimiter(
+    Append samples to the trace
+
+    Arguments
+    ---------
+    samples (numpy.ndarray): New samples of the raw fluorescence trace
+
+    Returns
+    -------
+    (numpy.ndarray, numpy.ndarray): Denoised calcium values and deconvolved spikes finalized by the new samples
+    )mydelimiter",
+    py::arg("samples"))
+    .def("flush", &isx_online_oasis_flush, R"mydelimiter(
+    Finalize all remaining values, e.g. at the end of a recording
+
+    Returns
+    -------
+    (numpy.ndarray, numpy.ndarray): Denoised calcium values and deconvolved spikes not finalized before
+    )mydelimiter")
+    .def_property_readonly("num_samples", &isx::OnlineOasis::getNumSamples, "Number of samples received")
+    .def_property_readonly("num_finalized", &isx::OnlineOasis::getNumFinalized, "Number of values finalized, i.e. the time index of the next finalized value");
 }
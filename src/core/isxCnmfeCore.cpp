@@ -2,6 +2,8 @@
 #include "isxCnmfeGreedy.h"
 #include "isxLog.h"
 
+#include <stdexcept>
+#include <string>
 #include <thread>
 
 namespace isx
@@ -19,7 +21,8 @@ namespace isx
         const float mergeThresh,
         const size_t numIterations,
         const size_t numThreads,
-        const bool outputFinalTraces)
+        const bool outputFinalTraces,
+        TaskScheduler * scheduler)
         : m_deconvParams(inDeconvParams)
         , m_initParams(inInitParams)
         , m_spatialParams(inSpatialParams)
@@ -29,6 +32,7 @@ namespace isx
         , m_numIterations(numIterations)
         , m_numThreads(numThreads)
         , m_outputFinalTraces(outputFinalTraces)
+        , m_scheduler(scheduler)
     {
     }
 
@@ -36,9 +40,19 @@ namespace isx
     {
         ISX_LOG_INFO(m_numThreads, m_numThreads > 1 ? " threads" : " thread", " assigned for fitting CNMF-E model");
 
-        // estimate noise in each pixel
-        ISX_LOG_INFO("Estimating individual pixel noise");
-        isx::getNoiseFft(inY, m_noise, m_deconvParams.m_noiseRange, m_deconvParams.m_noiseMethod);
+        // estimate noise in each pixel unless it was computed from the whole movie beforehand
+        if (!m_noiseProvided)
+        {
+            ISX_LOG_INFO("Estimating individual pixel noise");
+            isx::getNoiseFft(inY, m_noise, m_deconvParams.m_noiseRange, m_deconvParams.m_noiseMethod, 4096, m_numThreads, m_scheduler);
+        }
+        else if (m_noise.n_rows != inY.n_rows || m_noise.n_cols != inY.n_cols)
+        {
+            const std::string errorMessage = "Size of provided noise image (" + std::to_string(m_noise.n_rows) + "x" + std::to_string(m_noise.n_cols)
+                + ") does not match size of movie frames (" + std::to_string(inY.n_rows) + "x" + std::to_string(inY.n_cols) + ")";
+            ISX_LOG_WARNING(errorMessage);
+            throw std::runtime_error(errorMessage);
+        }
 
         // estimate spatiotemporal components using the greedy correlation approach
         greedyCorr(
@@ -57,7 +71,8 @@ namespace isx
             m_mergeThresh,
             m_numIterations,
             m_numThreads,
-            m_outputFinalTraces
+            m_outputFinalTraces,
+            m_scheduler
         );
     }
 
@@ -111,6 +126,17 @@ namespace isx
         m_rawC = rawTemporalComponents;
     }
 
+    void Cnmfe::setNoise(const MatrixFloat_t & noise)
+    {
+        m_noise = noise;
+        m_noiseProvided = true;
+    }
+
+    const MatrixFloat_t & Cnmfe::getNoise() const
+    {
+        return m_noise;
+    }
+
     size_t Cnmfe::getNumNeurons()
     {
         return m_A.n_slices;
@@ -2,6 +2,7 @@
 #define ISX_CNMFE_H
 
 #include "isxCnmfeParams.h"
+#include "isxTaskScheduler.h"
 
 namespace isx
 {
@@ -13,6 +14,7 @@ namespace isx
             Cnmfe();
 
             /// Fully specified constructor
+            /// The scheduler (if any) is not owned and must outlive calls to fit(...)
             Cnmfe(
                 const DeconvolutionParams inDeconvParams,
                 const InitializationParams inInitParams,
@@ -22,7 +24,8 @@ namespace isx
                 const float mergeThresh,
                 const size_t numIterations,
                 const size_t numThreads,
-                const bool outputFinalTraces = false);
+                const bool outputFinalTraces = false,
+                TaskScheduler * scheduler = nullptr);
 
             /// Fits the CNMFe model to the data and extracts spatiotemporal components
             void fit(const CubeFloat_t & inY);
@@ -57,6 +60,13 @@ namespace isx
             /// Sets the background temporal components
             void setTemporalBackground(const MatrixFloat_t & temporalBackground);
 
+            /// Sets the noise level of each pixel of the movie passed to fit(...)
+            /// Fitting then skips estimating the noise from the movie, which must have the dimensions of the noise image
+            void setNoise(const MatrixFloat_t & noise);
+
+            /// Returns the noise level of each pixel
+            const MatrixFloat_t & getNoise() const;
+
             /// Returns the total number of neurons extracted from the source movie
             size_t getNumNeurons();
 
@@ -110,6 +120,9 @@ namespace isx
             /// Noise estimation per pixel (d1 x d2)
             MatrixFloat_t m_noise;
 
+            /// True if the noise was provided with setNoise(...) rather than estimated by fit(...)
+            bool m_noiseProvided = false;
+
             /// Deconvolution parameters
             DeconvolutionParams m_deconvParams;
 
@@ -137,6 +150,9 @@ namespace isx
             /// Indicates whether to output final deconvolved traces (used in patch mode for merging components)
             bool m_outputFinalTraces;
 
+            /// Scheduler shared with the other stages of the run (nullptr to create one with m_numThreads workers)
+            TaskScheduler * m_scheduler = nullptr;
+
     }; // class
 }  // namespace isx
 
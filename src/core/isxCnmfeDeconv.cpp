@@ -1,6 +1,9 @@
 #include "isxCnmfeDeconv.h"
 #include "isxCnmfeUtils.h"
 #include "isxOasis.h"
+#include "isxTaskScheduler.h"
+
+#include <algorithm>
 
 
 namespace isx
@@ -27,7 +30,9 @@ namespace isx
 
         // use oasis algorithm for deconvolution
         // size_t p = inOutARParams.size();  // order of the AR model, we currently only support p=1 with OASIS
-        Oasis oasis(inOutARParams[0], inOutNoise);
+        // the solver of each thread is reused across calls to avoid reallocating its buffers for every trace
+        static thread_local Oasis oasis(inOutARParams[0], inOutNoise);
+        oasis.setParameters(inOutARParams[0], inOutNoise);
         oasis.solveFoopsi(inTrace, outBaseline, outInitCaVal, outCaTrace, outSpikes);
     }
 
@@ -76,28 +81,39 @@ namespace isx
         }
     }
 
-    /// Helper function to convert a single raw trace into the corresponding deconvolved trace and inferred spikes
+    /// Helper function to deconvolve a batch of consecutive traces
+    /// Each batch writes to its own rows of the outputs and reuses the same buffers for all its traces
     ///
-    /// \param inRawC           Column vector containing the raw fluorescence trace
-    /// \param outC             Column vector containing the deconvolved fluorescence trace
+    /// \param inRange          Range of trace indices to process [start, end)
+    /// \param outC             Deconvolved traces, initialized with the raw traces
     /// \param outS             Discretized deconvolved neural activity (spikes)
-    /// \param outSn            Standard deviation of the noise distribution. Estimated if a negative value is provided
+    /// \param outSn            Standard deviation of the noise distribution of each trace
     /// \param inDeconvParams   Parameters for estimating noise and autoregressive model used for deconvolution
-    void deconvolveSingleTrace(
-        const ColumnFloat_t & inRawC,
-        ColumnFloat_t & outC,
-        ColumnFloat_t & outS,
-        float & outSn,
-        DeconvolutionParams inDeconvParams)
+    /// \param inNumIterations  Number of deconvolution iteration to perform
+    static void deconvolveTraceBatch(
+        const std::pair<size_t, size_t> & inRange,
+        MatrixFloat_t & outC,
+        MatrixFloat_t & outS,
+        ColumnFloat_t & outSn,
+        DeconvolutionParams inDeconvParams,
+        const size_t inNumIterations)
     {
-        outC = inRawC;
-        outS.clear();
-        outS.copy_size(inRawC);
-        outSn = -1;
-
-        float initCaVal, baseline;
+        ColumnFloat_t y, c, s;
         std::vector<float> arParams;
-        isx::constrainedFoopsi(inRawC, arParams, outSn, outC, baseline, initCaVal, outS, inDeconvParams);
+        for (size_t k = inRange.first; k < inRange.second; k++)
+        {
+            for (size_t i = 0; i < inNumIterations; i++)
+            {
+                float ca1, b;
+                float sn = -1;
+                arParams.clear();
+                y = outC.row(k).t();
+                isx::constrainedFoopsi(y, arParams, sn, c, b, ca1, s, inDeconvParams);
+                outC.row(k) = c.t();
+                outS.row(k) = s.t();
+                outSn(k) = sn;
+            }
+        }
     }
 
     void deconvolveTraces(
@@ -106,7 +122,9 @@ namespace isx
         MatrixFloat_t & outS,
         ColumnFloat_t & outSn,
         DeconvolutionParams inDeconvParams,
-        const size_t inNumIterations)
+        const size_t inNumIterations,
+        const size_t inNumThreads,
+        TaskScheduler * inScheduler)
     {
         const size_t K = inRawC.n_rows;
         outC = inRawC;
@@ -115,25 +133,36 @@ namespace isx
         outS.copy_size(inRawC);
         outSn.set_size(inRawC.n_rows);
 
-        for (size_t i = 0; i < inNumIterations; i++)
+        if (inNumThreads < 2 || K < 2)
         {
-            for (size_t k = 0; k < K; k++)
-            {
-                isx::ColumnFloat_t c, s;
-                float ca1, b;
-                float sn = -1;
-                std::vector<float> arParams;
-                isx::ColumnFloat_t y = outC.row(k).t();
-                isx::constrainedFoopsi(y, arParams, sn, c, b, ca1, s, inDeconvParams);
-                outC.row(k) = c.t();
-                outS.row(k) = s.t();
-                outSn(k) = sn;
+            deconvolveTraceBatch({0, K}, outC, outS, outSn, inDeconvParams, inNumIterations);
+            return;
+        }
 
-                ColumnFloat_t tmpC, tmpS;
-                float tmpSn = -1;
-                deconvolveSingleTrace(y, tmpC, tmpS, tmpSn, inDeconvParams);
-            }
+        // Traces are independent, a few batches per thread even out the differences in solve time
+        const size_t batchesPerThread = 4;
+        const size_t nBatches = std::min(K, inNumThreads * batchesPerThread);
+        std::vector<std::pair<size_t, size_t>> ranges(nBatches);
+
+        std::shared_ptr<TaskScheduler> scheduler = getTaskScheduler(inScheduler, inNumThreads);
+        std::vector<std::future<void>> results(nBatches);
+        for (size_t idx = 0; idx < nBatches; ++idx)
+        {
+            ranges[idx].first = idx * K / nBatches;
+            ranges[idx].second = (idx + 1) * K / nBatches;
+
+            results[idx] = scheduler->enqueueWithHint(
+                ranges[idx].second - ranges[idx].first,
+                deconvolveTraceBatch,
+                std::cref(ranges[idx]),
+                std::ref(outC),
+                std::ref(outS),
+                std::ref(outSn),
+                inDeconvParams,
+                inNumIterations);
         }
+
+        scheduler->waitAll(results);
     }
 
 } // namespace isx
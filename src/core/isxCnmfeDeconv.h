@@ -4,6 +4,7 @@
 #include "isxArmaUtils.h"
 #include "isxCnmfeNoise.h"
 #include "isxCnmfeParams.h"
+#include "isxTaskScheduler.h"
 
 namespace isx
 {
@@ -51,13 +52,17 @@ namespace isx
     /// \param outSn            Standard deviation of the noise distribution. Estimated if a negative value is provided
     /// \param inDeconvParams   Parameters for estimating noise and autoregressive model used for deconvolution
     /// \param inNumIterations  Number of deconvolution iteration to perform
+    /// \param inNumThreads     Number of threads used to deconvolve batches of traces in parallel
+    /// \param inScheduler      Scheduler shared by the stages of a run (nullptr to create one with inNumThreads workers)
     void deconvolveTraces(
         const MatrixFloat_t & inRawC,
         MatrixFloat_t & outC,
         MatrixFloat_t & outS,
         ColumnFloat_t & outSn,
         DeconvolutionParams inDeconvParams,
-        const size_t inNumIterations = 1);
+        const size_t inNumIterations = 1,
+        const size_t inNumThreads = 1,
+        TaskScheduler * inScheduler = nullptr);
 
 } // namespace isx
 
@@ -5,7 +5,7 @@
 #include "isxCnmfeMerging.h"
 #include "isxCnmfeUtils.h"
 #include "isxLog.h"
-#include "ThreadPool.h"
+#include "isxTaskScheduler.h"
 
 
 namespace isx 
@@ -88,7 +88,8 @@ namespace isx
         arma::SpMat<float> & outW, 
         ColumnFloat_t & outB0, 
         const size_t spatialSub,
-        const size_t inNumThreads)
+        const size_t inNumThreads,
+        TaskScheduler * inScheduler)
     {
         int32_t radius = static_cast<int32_t>(std::round(inRadius/static_cast<float>(spatialSub)));
         arma::Mat<uint8_t> ring = generateRing(radius);
@@ -137,14 +138,14 @@ namespace isx
         if (inNumThreads > 1)
         {
             // Process pixels in parallel
-            ThreadPool pool(inNumThreads);
+            std::shared_ptr<TaskScheduler> scheduler = getTaskScheduler(inScheduler, inNumThreads);
             std::vector<arma::uvec> indicesOnRingVec(numPixels);
             std::vector<ColumnFloat_t> dataVec(numPixels);
             std::vector<std::future<void>> results(indicesOnRingVec.size());
 
             for (int32_t idx = 0; idx < numPixels; ++idx)
             {
-                results[idx] = pool.enqueue(
+                results[idx] = scheduler->enqueue(
                     computeWParallel,
                     std::cref(ring),
                     std::cref(ringIndices),
@@ -157,9 +158,9 @@ namespace isx
                 );
             }
 
+            scheduler->waitAll(results);
             for (int32_t idx = 0; idx < numPixels; ++idx)
             {
-                results[idx].get();
                 rowIndices(arma::span(numElems, numElems + indicesOnRingVec[idx].size() - 1)) = idx * arma::ones<arma::uvec>(indicesOnRingVec[idx].size());
                 colIndices(arma::span(numElems, numElems + indicesOnRingVec[idx].size() - 1)) = indicesOnRingVec[idx];
                 values(arma::span(numElems, numElems + indicesOnRingVec[idx].size() - 1)) = dataVec[idx].head(indicesOnRingVec[idx].size());
@@ -348,7 +349,8 @@ namespace isx
         const float mergeThresh,
         const size_t numIterations,
         const size_t inNumThreads,
-        const bool outputFinalTraces)
+        const bool outputFinalTraces,
+        TaskScheduler * inScheduler)
     {
         /* Greedy corr consists of 15 steps listed below:
              1.  Noise estimation
@@ -379,27 +381,30 @@ namespace isx
         if (inOutNoise.empty())
         {
             ISX_LOG_INFO("Estimating individual pixel noise");
-            isx::getNoiseFft(inY, inOutNoise, inDeconvParams.m_noiseRange, inDeconvParams.m_noiseMethod);
+            isx::getNoiseFft(inY, inOutNoise, inDeconvParams.m_noiseRange, inDeconvParams.m_noiseMethod, 4096, inNumThreads, inScheduler);
         }
 
         // estimate appropriate morphological filter sizes based on cell diameter
         if (inInitParams.m_gaussianKernelSize < 2)
         {
-            inInitParams.m_gaussianKernelSize = static_cast<int32_t>((static_cast<float>(inInitParams.m_averageCellDiameter - 1)) / 4.0f);
+            inInitParams.m_gaussianKernelSize = estimateFilterSize(inInitParams.m_averageCellDiameter);
         }
         if (inSpatialParams.m_closingKSize < 2)
         {
-            inSpatialParams.m_closingKSize = static_cast<int32_t>((static_cast<float>(inInitParams.m_averageCellDiameter - 1)) / 4.0f);
+            inSpatialParams.m_closingKSize = estimateFilterSize(inInitParams.m_averageCellDiameter);
         }
 
         // Only use second order AR for final update temporal components call
         const bool isFirstOrderAr = inDeconvParams.m_firstOrderAR;        
         inDeconvParams.m_firstOrderAR = true;
 
+        // Deconvolution state of the temporal components, shared by the temporal updates
+        DeconvolutionStateCache deconvCache;
+
         ISX_LOG_INFO("Initializing neurons");
         {
             MatrixFloat_t outCRaw, tmpS;
-            initNeuronsCorrPNR(inY, outA, outC, outCRaw, tmpS, inDeconvParams, inInitParams, maxNumNeurons);
+            initNeuronsCorrPNR(inY, outA, outC, outCRaw, tmpS, inDeconvParams, inInitParams, maxNumNeurons, inNumThreads, inScheduler);
         }
 
         MatrixFloat_t matB = matY - cubeToMatrixBySlice(outA) * outC;
@@ -420,14 +425,14 @@ namespace isx
             std::pair<size_t, size_t> inDims(inY.n_rows, inY.n_cols);
 
             computeW(matY, cubeToMatrixBySlice(outA), outC, inDims, ringSizeFactor * inInitParams.m_averageCellDiameter,
-                     W, B0, inSpatialParams.m_bgSsub, inNumThreads);
+                     W, B0, inSpatialParams.m_bgSsub, inNumThreads, inScheduler);
 
             computeB(arma::reshape(B0, inY.n_rows, inY.n_cols), W, cubeB, inSpatialParams.m_bgSsub);
             cubeB += inY;
         }
 
         ISX_LOG_INFO("Updating spatial components");
-        updateSpatialComponents(cubeB, outA, outC, inOutNoise, inSpatialParams.m_closingKSize, inSpatialParams.m_pixelsPerProc, inNumThreads);
+        updateSpatialComponents(cubeB, outA, outC, inOutNoise, inSpatialParams.m_closingKSize, inSpatialParams.m_pixelsPerProc, inNumThreads, inSpatialParams.m_solver, inScheduler);
 
         ISX_LOG_INFO("Updating temporal components");
         {
@@ -437,7 +442,7 @@ namespace isx
 
             updateTemporalComponents(
                 matB, cubeToMatrixBySlice(outA), outC, tmpBl, tmpC1, tmpG, tmpSn, tmpS, tmpYrA,
-                inDeconvParams, 2, inNumThreads);
+                inDeconvParams, 2, inNumThreads, &deconvCache, inScheduler);
         }
 
         ISX_LOG_INFO("Searching for more neurons in the residuals");
@@ -448,10 +453,14 @@ namespace isx
             int32_t maxNumNewNeurons = std::max(maxNumNeurons - static_cast<int32_t>(outA.n_slices), 0);
             if (maxNumNewNeurons > 0 || maxNumNeurons == 0)
             {
-                CubeFloat_t input = matrixToCubeByCol(matB - cubeToMatrixBySlice(outA) * outC, inY.n_rows, inY.n_cols);
+                // residual is written straight into the cube handed over to initialization as its working copy
+                CubeFloat_t input(inY.n_rows, inY.n_cols, inY.n_slices);
+                MatrixFloat_t matInput(input.memptr(), matB.n_rows, matB.n_cols, false, true);
+                matInput = matB - cubeToMatrixBySlice(outA) * outC;
+
                 CubeFloat_t outAR;
                 MatrixFloat_t outCR, outCRRaw, tmpS;
-                initNeuronsCorrPNR(input, outAR, outCR, outCRRaw, tmpS, inDeconvParams, inInitParams, maxNumNewNeurons);
+                initNeuronsCorrPNR(std::move(input), outAR, outCR, outCRRaw, tmpS, inDeconvParams, inInitParams, maxNumNewNeurons, inNumThreads, inScheduler);
 
                 outA = arma::join_slices(outA, outAR);
                 outC = arma::join_cols(outC, outCR);
@@ -466,12 +475,14 @@ namespace isx
         {
             MatrixFloat_t tmpRawC;
             MatrixFloat_t matA = cubeToMatrixBySlice(outA);
-            mergeComponents(matA, outC, tmpRawC, mergeThresh, inDeconvParams, inNumThreads);
+            std::vector<size_t> sources;
+            mergeComponents(matA, outC, tmpRawC, inY.n_rows, inY.n_cols, mergeThresh, inDeconvParams, inNumThreads, &sources, inScheduler);
             outA = matrixToCubeByCol(matA, inY.n_rows, inY.n_cols);
+            deconvCache.remap(sources);
         }
 
         ISX_LOG_INFO("Updating spatial components");
-        updateSpatialComponents(cubeB, outA, outC, inOutNoise, inSpatialParams.m_closingKSize, inSpatialParams.m_pixelsPerProc, inNumThreads);
+        updateSpatialComponents(cubeB, outA, outC, inOutNoise, inSpatialParams.m_closingKSize, inSpatialParams.m_pixelsPerProc, inNumThreads, inSpatialParams.m_solver, inScheduler);
 
         ISX_LOG_INFO("Updating temporal components");
         {
@@ -481,7 +492,7 @@ namespace isx
 
             updateTemporalComponents(
                 matB, cubeToMatrixBySlice(outA), outC, tmpBl, tmpC1, tmpG, tmpSn, tmpS, tmpYrA,
-                inDeconvParams, 2, inNumThreads);
+                inDeconvParams, 2, inNumThreads, &deconvCache, inScheduler);
         }
 
         ISX_LOG_INFO("Updating background estimation");
@@ -490,7 +501,7 @@ namespace isx
             ColumnFloat_t B0;
             std::pair<size_t,size_t> inDims(inY.n_rows, inY.n_cols);
             computeW(matY, cubeToMatrixBySlice(outA), outC, inDims, ringSizeFactor * inInitParams.m_averageCellDiameter,
-                     W, B0, inSpatialParams.m_bgSsub, inNumThreads);
+                     W, B0, inSpatialParams.m_bgSsub, inNumThreads, inScheduler);
 
             matB = matY - cubeToMatrixBySlice(outA) * outC;
             computeB(arma::reshape(B0, inY.n_rows, inY.n_cols), W, cubeB, inSpatialParams.m_bgSsub);
@@ -503,12 +514,20 @@ namespace isx
         {
             MatrixFloat_t tmpRawC;
             MatrixFloat_t matA = cubeToMatrixBySlice(outA);
-            mergeComponents(matA, outC, tmpRawC, mergeThresh, inDeconvParams, inNumThreads);
+            std::vector<size_t> sources;
+            mergeComponents(matA, outC, tmpRawC, inY.n_rows, inY.n_cols, mergeThresh, inDeconvParams, inNumThreads, &sources, inScheduler);
             outA = matrixToCubeByCol(matA, inY.n_rows, inY.n_cols);
+            deconvCache.remap(sources);
+        }
+
+        // the state of AR(1) models is only used again by a final temporal update of the same order
+        if (!outputFinalTraces || !isFirstOrderAr)
+        {
+            deconvCache = DeconvolutionStateCache();
         }
 
         ISX_LOG_INFO("Updating spatial components");
-        updateSpatialComponents(cubeB, outA, outC, inOutNoise, 1, inSpatialParams.m_pixelsPerProc, inNumThreads);
+        updateSpatialComponents(cubeB, outA, outC, inOutNoise, 1, inSpatialParams.m_pixelsPerProc, inNumThreads, inSpatialParams.m_solver, inScheduler);
 
         ISX_LOG_INFO("Extracting raw temporal traces");
         {
@@ -535,7 +554,7 @@ namespace isx
             ISX_LOG_INFO("Updating temporal components");
             updateTemporalComponents(
                 matB, cubeToMatrixBySlice(outA), outC, tmpBl, tmpC1, tmpG, tmpSn, tmpS, tmpYrA,
-                inDeconvParams, 2, inNumThreads);
+                inDeconvParams, 2, inNumThreads, &deconvCache, inScheduler);
         }
 
         // remove empty components
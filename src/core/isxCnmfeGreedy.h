@@ -5,6 +5,7 @@
 #include "isxCnmfeParams.h"
 #include "isxCnmfeDeconv.h"
 #include "isxCnmfeInitialization.h"
+#include "isxTaskScheduler.h"
 
 namespace isx
 {
@@ -19,6 +20,7 @@ namespace isx
     /// \param outB0                Estimate of constant background baselines (d)
     /// \param spatialSub           Spatial subsampling factor
     /// \param inNumThreads         Threads to use when parallelization is possible
+    /// \param inScheduler          Scheduler shared by the stages of a run (nullptr to create one with inNumThreads workers)
     void computeW(
         const MatrixFloat_t & inY,
         const MatrixFloat_t & inA,
@@ -28,7 +30,8 @@ namespace isx
         arma::SpMat<float> & outW,
         ColumnFloat_t & outB0,
         const size_t spatialSub = 2,
-        const size_t inNumThreads = 1);
+        const size_t inNumThreads = 1,
+        TaskScheduler * inScheduler = nullptr);
 
     /// Average pooling, computing average for each block across the matrix
     ///
@@ -67,6 +70,7 @@ namespace isx
     /// \param numIterations        Number of iterations for initialization
     /// \param inNumThreads         Threads to use when parallelization is possible
     /// \param outputFinalTraces    Indicates whether to output final deconvolved traces (used in patch mode for merging components)
+    /// \param inScheduler          Scheduler shared by the stages of a run (nullptr to create one with inNumThreads workers)
     void greedyCorr(
         const CubeFloat_t & inY,
         CubeFloat_t & outA,
@@ -83,7 +87,8 @@ namespace isx
         const float mergeThresh = 0.85f,
         const size_t numIterations = 2,
         const size_t inNumThreads = 1,
-        const bool outputFinalTraces = false);
+        const bool outputFinalTraces = false,
+        TaskScheduler * inScheduler = nullptr);
 } // namespace isx
 
 #endif //ISX_CNMFE_GREEDY_H
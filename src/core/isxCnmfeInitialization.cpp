@@ -4,10 +4,12 @@
 #include "isxCnmfeUtils.h"
 #include "isxCnmfeDeconv.h"
 #include "isxLog.h"
+#include "isxTaskScheduler.h"
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
+#include <algorithm>
 #include <vector>
 #include <cmath>
 
@@ -23,40 +25,30 @@ namespace isx
         const float minCorrNeuron,
         const float maxCorrBg)
     {
+        // view each box as a (pixels x frames) matrix, pixels in column-major order
+        const size_t numPixels = inDataFiltered.n_rows * inDataFiltered.n_cols;
+        const MatrixFloat_t dataRaw(const_cast<float *>(inDataRaw.memptr()), numPixels, inDataRaw.n_slices, false, true);
+
         // normalize data
-        MatrixFloat_t tmp (arma::mean(inDataFiltered, 2));
-        CubeFloat_t inDataFilteredProcessed = inDataFiltered.each_slice() - tmp;
+        MatrixFloat_t dataFiltered(const_cast<float *>(inDataFiltered.memptr()), numPixels, inDataFiltered.n_slices);
+        dataFiltered.each_col() -= ColumnFloat_t(arma::mean(dataFiltered, 1));
 
-        tmp = arma::sqrt(arma::sum(arma::square(inDataFilteredProcessed), 2));
-        tmp.elem(arma::find(tmp==0.0f)).fill(1.0f);
-        inDataFilteredProcessed = inDataFilteredProcessed.each_slice() / tmp;
+        ColumnFloat_t norms = arma::sqrt(arma::sum(arma::square(dataFiltered), 1));
+        norms.elem(arma::find(norms == 0.0f)).fill(1.0f);
+        dataFiltered.each_col() /= norms;
 
         // get correlation between trace of each pixel and that at neuron center
-        ColumnFloat_t y0 = inDataFilteredProcessed(
-            arma::span(centerIndex.first), arma::span(centerIndex.second), arma::span::all
-        );
-        for (size_t colIndex = 0; colIndex < inDataFilteredProcessed.n_cols; ++colIndex)
-        {
-            for (size_t rowIndex = 0; rowIndex < inDataFilteredProcessed.n_rows; ++rowIndex)
-            {
-                ColumnFloat_t vec = inDataFilteredProcessed.subcube(
-                    arma::span(rowIndex), arma::span(colIndex), arma::span::all
-                );
-                tmp(rowIndex, colIndex) = arma::dot(y0, vec);
-            }
-        }
+        const size_t centerPixel = centerIndex.first + centerIndex.second * inDataFiltered.n_rows;
+        const ColumnFloat_t y0 = dataFiltered.row(centerPixel).t();
+        const ColumnFloat_t corr = dataFiltered * y0;
 
         // extract activity of neuron
-        outCi = arma::zeros<ColumnFloat_t>(inDataFilteredProcessed.n_slices);
-        arma::umat neuronIndices = arma::find(tmp > minCorrNeuron);
+        outCi = arma::zeros<ColumnFloat_t>(dataFiltered.n_cols);
+        const arma::uvec neuronIndices = arma::find(corr > minCorrNeuron);
 
         if (!neuronIndices.empty())
         {
-            for(arma::umat::iterator it = neuronIndices.begin(); it != neuronIndices.end(); ++it)
-            {
-                arma::uvec u = ind2sub(arma::size(inDataFilteredProcessed), *it);
-                outCi += inDataFilteredProcessed(arma::span(u(0)), arma::span(u(1)), arma::span::all);
-            }
+            outCi = arma::sum(dataFiltered.rows(neuronIndices), 0).t();
             outCi /= static_cast<float>(neuronIndices.size());
         }
 
@@ -70,19 +62,10 @@ namespace isx
 
         // extract background activity
         ColumnFloat_t y_bg (inDataRaw.n_slices);
-        arma::umat bgIndices = arma::find(tmp < maxCorrBg);
+        const arma::uvec bgIndices = arma::find(corr < maxCorrBg);
         if (!bgIndices.empty())
         {
-            MatrixFloat_t bgColumns(bgIndices.size(), inDataRaw.n_slices);
-
-            for(arma::umat::iterator it = bgIndices.begin(); it != bgIndices.end(); ++it)
-            {
-                arma::uvec u = arma::ind2sub(arma::size(inDataRaw), *it);
-                ColumnFloat_t tmpCol = inDataRaw(arma::span(u(0)), arma::span(u(1)), arma::span::all);
-                bgColumns(it - bgIndices.begin(), arma::span::all) = tmpCol.t();
-            }
-
-            y_bg = arma::median(bgColumns, 0).t();
+            y_bg = arma::median(dataRaw.rows(bgIndices), 0).t();
         }
         else
         {
@@ -93,20 +76,11 @@ namespace isx
         MatrixFloat_t X = arma::join_rows(outCi, y_bg);
         X = arma::join_rows(X, arma::ones<ColumnFloat_t>(y_bg.size()));
         MatrixFloat_t XX = X.t() * X;
-        MatrixFloat_t Xy (X.n_cols, inDataRaw.n_rows * inDataRaw.n_cols);
-        for (size_t colIndex = 0; colIndex < inDataRaw.n_cols; ++colIndex)
-        {
-            for (size_t rowIndex = 0; rowIndex < inDataRaw.n_rows; ++rowIndex)
-            {
-                ColumnFloat_t vec = inDataRaw.subcube(arma::span(rowIndex), arma::span(colIndex), arma::span::all);
-                Xy(arma::span::all, rowIndex * inDataRaw.n_cols + colIndex) = X.t() * vec;
-            }
-        }
+        MatrixFloat_t Xy = X.t() * dataRaw.t();
 
         outAi = arma::solve(XX, Xy, arma::solve_opts::fast);
         outAi = outAi.row(0);
-        outAi.reshape(inDataRaw.n_cols, inDataRaw.n_rows);
-        outAi = outAi.t();
+        outAi.reshape(inDataRaw.n_rows, inDataRaw.n_cols);
         outAi.transform( [](float val) { return (val < 0.0f) ? 0.0f : val; } );
 
         circularConstraint(outAi);
@@ -144,134 +118,665 @@ namespace isx
         return spatialFilter;
     }
 
-    static void apply2DFilter(MatrixFloat_t & inMatrix, MatrixFloat_t & outMatrix, cv::Mat & filter)
+    static void apply2DFilter(const MatrixFloat_t & inMatrix, MatrixFloat_t & outMatrix, const cv::Mat & filter)
     {
         cv::Mat tmpMat = armaToCvMat(inMatrix);
         cv::filter2D(tmpMat, tmpMat, -1, filter, cv::Point(-1,-1), 0, 1);
         outMatrix = cvToArmaMat<float>(tmpMat);
     }
 
-    void initNeuronsCorrPNR(
+    /// Minimum width or height of a kernel for which frames are filtered in the frequency domain
+    static const int s_minFftFilterSize = 11;
+
+    /// Spatial filter applied to every frame of a movie
+    /// Frames are filtered without copies: a column-major arma frame (h x w) is viewed as
+    /// a row-major OpenCV image (w x h), which is filtered with the transposed kernel.
+    struct FrameFilter
+    {
+        /// Transposed kernel of the filter, empty when frames are only copied
+        cv::Mat m_kernel;
+
+        /// Size of the frequency domain (empty when frames are filtered directly)
+        cv::Size m_fftSize;
+
+        /// Spectrum of the kernel zero-padded to the size of the frequency domain
+        cv::Mat m_kernelSpectrum;
+    };
+
+    /// Buffers reused across the frames filtered by one task
+    struct FrameFilterBuffers
+    {
+        /// Frame padded with its border, zero beyond the padding
+        cv::Mat m_padded;
+
+        /// Spectrum of the padded frame
+        cv::Mat m_spectrum;
+
+        /// Product of the spectra of the frame and the kernel
+        cv::Mat m_product;
+
+        /// Filtered frame before cropping
+        cv::Mat m_filtered;
+    };
+
+    static FrameFilter constructFrameFilter(const cv::Mat & inKernel, const size_t inNumRows, const size_t inNumCols)
+    {
+        FrameFilter filter;
+        if (inKernel.empty())
+        {
+            return filter;
+        }
+
+        filter.m_kernel = inKernel.t();
+        if (filter.m_kernel.rows >= s_minFftFilterSize || filter.m_kernel.cols >= s_minFftFilterSize)
+        {
+            // padding with the border of the frame avoids wrap-around of the circular correlation
+            filter.m_fftSize = cv::Size(
+                cv::getOptimalDFTSize(int(inNumRows) + filter.m_kernel.cols - 1),
+                cv::getOptimalDFTSize(int(inNumCols) + filter.m_kernel.rows - 1));
+
+            cv::Mat paddedKernel = cv::Mat::zeros(filter.m_fftSize, CV_32F);
+            filter.m_kernel.copyTo(paddedKernel(cv::Rect(0, 0, filter.m_kernel.cols, filter.m_kernel.rows)));
+            cv::dft(paddedKernel, filter.m_kernelSpectrum, 0, filter.m_kernel.rows);
+        }
+        return filter;
+    }
+
+    /// Filters a range of frames of a movie
+    ///
+    /// \param inData       Input movie
+    /// \param inFilter     Spatial filter
+    /// \param inFirstFrame Index of the first frame of the range
+    /// \param inEndFrame   Index one past the last frame of the range
+    /// \param outData      Filtered movie, allocated to the size of the input movie
+    static void filterFrames(
         const CubeFloat_t & inData,
-        CubeFloat_t & outA,
-        MatrixFloat_t & outC,
-        MatrixFloat_t & outCRaw,
-        MatrixFloat_t & outS,
-        DeconvolutionParams inDeconvParams,
-        InitializationParams inInitParams,
-        int32_t maxNumNeurons)
+        const FrameFilter & inFilter,
+        const size_t inFirstFrame,
+        const size_t inEndFrame,
+        CubeFloat_t & outData)
     {
-        CubeFloat_t inDataModifiable(inData);
-        CubeFloat_t inDataProcessed(inData);
+        const int width = int(inData.n_rows);
+        const int height = int(inData.n_cols);
+        const cv::Mat & kernel = inFilter.m_kernel;
+        const bool useFft = !inFilter.m_kernelSpectrum.empty();
 
-        // spatial filtering using disk background filter
-        cv::Mat spatialFilter;
-        if (inInitParams.m_gaussianKernelSize > 0)
+        FrameFilterBuffers buffers;
+        if (useFft)
+        {
+            buffers.m_padded = cv::Mat::zeros(inFilter.m_fftSize, CV_32F);
+        }
+
+        for (size_t frameIndex = inFirstFrame; frameIndex < inEndFrame; ++frameIndex)
+        {
+            const cv::Mat src(height, width, CV_32F, const_cast<float *>(inData.slice_memptr(frameIndex)));
+            cv::Mat dst(height, width, CV_32F, outData.slice_memptr(frameIndex));
+
+            if (kernel.empty())
+            {
+                src.copyTo(dst);
+            }
+            else if (useFft)
+            {
+                const int anchorRow = kernel.rows / 2;
+                const int anchorCol = kernel.cols / 2;
+                cv::Mat padded = buffers.m_padded(cv::Rect(0, 0, width + kernel.cols - 1, height + kernel.rows - 1));
+                cv::copyMakeBorder(src, padded, anchorRow, kernel.rows - 1 - anchorRow,
+                                   anchorCol, kernel.cols - 1 - anchorCol, cv::BORDER_REPLICATE);
+
+                cv::dft(buffers.m_padded, buffers.m_spectrum, 0, padded.rows);
+                cv::mulSpectrums(buffers.m_spectrum, inFilter.m_kernelSpectrum, buffers.m_product, 0, true);
+                cv::dft(buffers.m_product, buffers.m_filtered, cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT, height);
+                buffers.m_filtered(cv::Rect(0, 0, width, height)).copyTo(dst);
+            }
+            else
+            {
+                cv::filter2D(src, dst, -1, kernel, cv::Point(-1,-1), 0, cv::BORDER_REPLICATE);
+            }
+        }
+    }
+
+    /// Removes the mean over time of a range of pixels of a movie
+    /// Pixels are summed in order of frames so that the result does not depend on how pixels are split
+    ///
+    /// \param inFirstPixel Index of the first pixel of the range within a frame
+    /// \param inEndPixel   Index one past the last pixel of the range within a frame
+    /// \param outData      Movie with zero mean over time at each pixel of the range
+    static void removePixelMean(const size_t inFirstPixel, const size_t inEndPixel, CubeFloat_t & outData)
+    {
+        std::vector<double> sums(inEndPixel - inFirstPixel, 0.0);
+        for (size_t frameIndex = 0; frameIndex < outData.n_slices; ++frameIndex)
+        {
+            const float * frame = outData.slice_memptr(frameIndex);
+            for (size_t i = inFirstPixel; i < inEndPixel; ++i)
+            {
+                sums[i - inFirstPixel] += frame[i];
+            }
+        }
+
+        std::vector<float> means(sums.size());
+        for (size_t i = 0; i < sums.size(); ++i)
+        {
+            means[i] = static_cast<float>(sums[i] / double(outData.n_slices));
+        }
+
+        for (size_t frameIndex = 0; frameIndex < outData.n_slices; ++frameIndex)
+        {
+            float * frame = outData.slice_memptr(frameIndex);
+            for (size_t i = inFirstPixel; i < inEndPixel; ++i)
+            {
+                frame[i] -= means[i - inFirstPixel];
+            }
+        }
+    }
+
+    void filterMovie(
+        const CubeFloat_t & inData,
+        const cv::Mat & inKernel,
+        CubeFloat_t & outData,
+        const size_t inNumThreads,
+        TaskScheduler * inScheduler)
+    {
+        outData.set_size(arma::size(inData));
+        if (inData.n_elem == 0)
+        {
+            return;
+        }
+
+        const FrameFilter filter = constructFrameFilter(inKernel, inData.n_rows, inData.n_cols);
+
+        const size_t numPixels = inData.n_rows * inData.n_cols;
+        if (inNumThreads < 2)
         {
-            spatialFilter = constructDiskFilter(inInitParams.m_gaussianKernelSize);
+            filterFrames(inData, filter, 0, inData.n_slices, outData);
+            removePixelMean(0, numPixels, outData);
+            return;
+        }
+
+        const size_t numFrameTasks = std::min(inNumThreads, size_t(inData.n_slices));
+        const size_t numPixelTasks = std::min(inNumThreads, numPixels);
 
+        std::shared_ptr<TaskScheduler> scheduler = getTaskScheduler(inScheduler, inNumThreads);
+        std::vector<std::future<void>> results(numFrameTasks);
+        for (size_t idx = 0; idx < numFrameTasks; ++idx)
+        {
+            results[idx] = scheduler->enqueue(
+                filterFrames, std::cref(inData), std::cref(filter),
+                idx * inData.n_slices / numFrameTasks, (idx + 1) * inData.n_slices / numFrameTasks,
+                std::ref(outData));
+        }
+        scheduler->waitAll(results);
+
+        results.resize(numPixelTasks);
+        for (size_t idx = 0; idx < numPixelTasks; ++idx)
+        {
+            results[idx] = scheduler->enqueue(
+                removePixelMean, idx * numPixels / numPixelTasks, (idx + 1) * numPixels / numPixelTasks,
+                std::ref(outData));
+        }
+        scheduler->waitAll(results);
+    }
+
+    /// Images read and updated while processing seed pixels
+    /// A seed only touches the pixels within twice the cell diameter of its center
+    struct SeedSearchImages
+    {
+        /// Raw movie from which initialized neurons are removed
+        CubeFloat_t & m_dataRaw;
+
+        /// Spatially filtered movie from which initialized neurons are removed
+        CubeFloat_t & m_dataFiltered;
+
+        /// Noise of each pixel of the filtered movie
+        const MatrixFloat_t & m_pixelNoise;
+
+        /// Values of the filtered movie below this threshold are ignored in local correlations
+        const MatrixFloat_t & m_minPixelNoise;
+
+        /// Peak-to-noise ratio image
+        MatrixFloat_t & m_pnr;
+
+        /// Local correlation image
+        MatrixFloat_t & m_localCorr;
+
+        /// Search image (product of the local correlation and PNR images)
+        MatrixFloat_t & m_vSearch;
+
+        /// Pixels excluded from the search (1 if excluded)
+        MatrixFloat_t & m_indSearch;
+
+        /// Spatial footprints of the neurons committed so far
+        const CubeFloat_t & m_outA;
+    };
+
+    /// Outcome of processing a seed pixel
+    struct SeedResult
+    {
+        /// A neuron was initialized from the seed
+        bool m_accepted = false;
+
+        /// The footprint and raw trace are written to the slot of the next neuron
+        /// (also true for seeds rejected because their denoised trace is empty)
+        bool m_footprintWritten = false;
+
+        /// Box around the seed in which the footprint is defined [min, max)
+        int m_rMin = 0;
+        int m_rMax = 0;
+        int m_cMin = 0;
+        int m_cMax = 0;
+
+        /// Spatial footprint, raw trace, denoised trace and spikes of the neuron
+        MatrixFloat_t m_ai;
+        ColumnFloat_t m_ciRaw;
+        ColumnFloat_t m_ci;
+        ColumnFloat_t m_si;
+    };
+
+    /// Processes a candidate seed pixel: extracts a neuron around the seed and removes it from the images
+    /// Only pixels within twice the cell diameter of the seed are read or written, so seeds further apart can be
+    /// processed concurrently. The footprint and traces are returned to be committed in the order of the seeds.
+    ///
+    /// \param inSeed             Seed pixel (x is the column and y the row)
+    /// \param inSlot             Slice of outA that receives the footprint if no other seed of the batch is accepted before
+    /// \param inOutImages        Images updated in the neighbourhood of the seed
+    /// \param inSpatialFilter    Spatial filter applied to the movie (empty if not filtered)
+    /// \param inDeconvParams     Deconvolution parameters
+    /// \param inInitParams       Initialization parameters
+    /// \param inMinvSearch       Minimum search value of a seed
+    /// \param outResult          Outcome of processing the seed
+    static void processSeedPixel(
+        const cv::Point inSeed,
+        const size_t inSlot,
+        SeedSearchImages & inOutImages,
+        const cv::Mat & inSpatialFilter,
+        const DeconvolutionParams & inDeconvParams,
+        const InitializationParams & inInitParams,
+        const float inMinvSearch,
+        SeedResult & outResult)
+    {
+        const int r = inSeed.y;
+        const int c = inSeed.x;
+        const int numRows = static_cast<int>(inOutImages.m_dataRaw.n_rows);
+        const int numCols = static_cast<int>(inOutImages.m_dataRaw.n_cols);
+        CubeFloat_t & inDataModifiable = inOutImages.m_dataRaw;
+        CubeFloat_t & inDataProcessed = inOutImages.m_dataFiltered;
+        MatrixFloat_t & vSearch = inOutImages.m_vSearch;
+        MatrixFloat_t & indSearch = inOutImages.m_indSearch;
+
+        // mark pixel as visited
+        indSearch.at(r, c) = 1;
+
+        // skip pixel if it doesn't qualify as a good seed pixel
+        if (vSearch.at(r, c) < inMinvSearch)
+        {
+            return;
+        }
+
+        ColumnFloat_t y0 (inDataProcessed(arma::span(r), arma::span(c), arma::span::all));
+        y0 = arma::diff(y0);
+        if (arma::max(y0) < 3 * arma::stddev(y0, 1))
+        {
+            vSearch.at(r, c) = 0;
+            return;
+        }
+
+        // crop small region around seed pixel for estimating spatiotemporal activity of the neuron
+        int rMin = std::max(0, r - inInitParams.m_averageCellDiameter);
+        int rMax = std::min(numRows, r + inInitParams.m_averageCellDiameter + 1);
+        int cMin = std::max(0, c - inInitParams.m_averageCellDiameter);
+        int cMax = std::min(numCols, c + inInitParams.m_averageCellDiameter + 1);
+
+        CubeFloat_t dataRawBox(
+            inDataModifiable(arma::span(rMin, rMax - 1), arma::span(cMin, cMax - 1), arma::span::all));
+        CubeFloat_t dataFilteredBox(
+            inDataProcessed(arma::span(rMin, rMax - 1), arma::span(cMin, cMax - 1), arma::span::all));
+
+        // extract spatiotemporal activity
+        std::pair<int32_t, int32_t> centerIndex(r - rMin, c - cMin);
+        MatrixFloat_t & ai = outResult.m_ai;
+        ColumnFloat_t & ciRaw = outResult.m_ciRaw;
+        extractAC(dataFilteredBox, dataRawBox, centerIndex, ai, ciRaw);
+
+        arma::uvec nonZeroElems = arma::find(ai > 0);
+        if (static_cast<int>(nonZeroElems.size()) < inInitParams.m_minNumPixels)
+        {
+            return;
+        }
+
+        outResult.m_footprintWritten = true;
+        outResult.m_rMin = rMin;
+        outResult.m_rMax = rMax;
+        outResult.m_cMin = cMin;
+        outResult.m_cMax = cMax;
+
+        ColumnFloat_t & ci = outResult.m_ci;
+        if (inInitParams.m_deconvolve)
+        {
+            // with deconvolution
+            float c1, baseline;
+            float noise = -1;
+            std::vector<float> ARParams;
+            constrainedFoopsi(ciRaw, ARParams, noise, ci, baseline, c1, outResult.m_si, inDeconvParams);
+
+            if (arma::sum(ci) == 0)
+            {
+                return;
+            }
+        }
+        else
+        {
+            // no deconvolution
+            ci = ciRaw;
+            ci.elem(arma::find(ci < 0)).fill(0);
+
+            if (arma::sum(ci) == 0)
+            {
+                return;
+            }
+        }
+        outResult.m_accepted = true;
+
+        // update search space to exclude nearby pixels
+        MatrixFloat_t tmpmat(indSearch(arma::span(rMin, rMax - 1), arma::span(cMin, cMax - 1)));
+        tmpmat.elem(find(ai > ai.max() / 2.0f)).fill(1.0f);
+        indSearch(arma::span(rMin, rMax - 1), arma::span(cMin, cMax - 1)) = tmpmat;
+
+        // remove spatiotemporal activity of initialized neuron from raw data
+        for (size_t i = 0; i < inDataModifiable.n_slices; ++i)
+        {
+            inDataModifiable(arma::span(rMin, rMax - 1),
+                             arma::span(cMin, cMax - 1),
+                             arma::span(i)) -= ai * ci.at(i);
+        }
+
+        // define neighborhood of pixels to update after initializing a neuron
+        int r2Min = std::max(0, r - 2 * inInitParams.m_averageCellDiameter);
+        int r2Max = std::min(numRows, r + 2 * inInitParams.m_averageCellDiameter + 1);
+        int c2Min = std::max(0, c - 2 * inInitParams.m_averageCellDiameter);
+        int c2Max = std::min(numCols, c + 2 * inInitParams.m_averageCellDiameter + 1);
+
+        if (inInitParams.m_gaussianKernelSize > 0) {
+            // spatially filter neuron shape
+            // the slot may hold footprints of earlier seeds that were rejected after extraction
+            MatrixFloat_t tmpImg(
+                inOutImages.m_outA(arma::span(r2Min, r2Max - 1), arma::span(c2Min, c2Max - 1), arma::span(inSlot))
+            );
+            tmpImg(arma::span(rMin - r2Min, rMax - r2Min - 1), arma::span(cMin - c2Min, cMax - c2Min - 1)) = ai;
+            MatrixFloat_t aiFiltered;
+            apply2DFilter(tmpImg, aiFiltered, inSpatialFilter);
+
+            // update processed data
             for (size_t i = 0; i < inDataProcessed.n_slices; ++i)
             {
-                MatrixFloat_t inDataSlice (inData.slice(i));
-                apply2DFilter(inDataSlice, inDataProcessed.slice(i), spatialFilter);
+                inDataProcessed(arma::span(r2Min, r2Max - 1), arma::span(c2Min, c2Max - 1),
+                                arma::span(i)) -= aiFiltered * ci.at(i);
             }
+            dataFilteredBox = inDataProcessed(arma::span(r2Min, r2Max - 1),
+                                              arma::span(c2Min, c2Max - 1), arma::span::all);
         }
 
-        // compute PNR image
-        MatrixFloat_t tmp (arma::mean(inDataProcessed, 2));
-        inDataProcessed.each_slice() -= tmp;
+        // update PNR image
+        MatrixFloat_t maxBox = arma::max(dataFilteredBox, 2);
+        MatrixFloat_t noiseBox(
+            inOutImages.m_pixelNoise(arma::span(r2Min, r2Max - 1), arma::span(c2Min, c2Max - 1)));
+        MatrixFloat_t pnrBox(maxBox / noiseBox);
+        pnrBox.elem(arma::find(pnrBox < inInitParams.m_minPNR)).fill(0.0f);
+        inOutImages.m_pnr(arma::span(r2Min, r2Max - 1), arma::span(c2Min, c2Max - 1)) = pnrBox;
+
+        // update local correlation image
+        // compute local correlation of candidate pixel for size of neuron + 1 pixel border of neighbouring neurons
+        int r3Min = std::max(0, r - inInitParams.m_averageCellDiameter - 1);
+        int r3Max = std::min(numRows, r + inInitParams.m_averageCellDiameter + 2);
+        int c3Min = std::max(0, c - inInitParams.m_averageCellDiameter - 1);
+        int c3Max = std::min(numCols, c + inInitParams.m_averageCellDiameter + 2);
+        MatrixFloat_t cnBox;
+        computeLocalCorr(
+            inDataProcessed,
+            std::make_tuple(size_t(r3Min), size_t(r3Max - 1), size_t(c3Min), size_t(c3Max - 1)),
+            inOutImages.m_minPixelNoise,
+            cnBox);
+        cnBox.elem(arma::find(cnBox < 0)).fill(0);
+
+        MatrixFloat_t & localCorr = inOutImages.m_localCorr;
+        localCorr(arma::span(rMin, rMax - 1), arma::span(cMin, cMax - 1)) = cnBox(
+            arma::span(rMin - r3Min, rMax - r3Min - 1), arma::span(cMin - c3Min, cMax - c3Min - 1));
+        cnBox = localCorr(arma::span(r2Min, r2Max - 1), arma::span(c2Min, c2Max - 1));
+
+        // update search space, excluded pixels outside of the neighbourhood are cleared when the seed is committed
+        MatrixFloat_t vSearchBox = cnBox % pnrBox;
+        const MatrixFloat_t indSearchBox(indSearch(arma::span(r2Min, r2Max - 1), arma::span(c2Min, c2Max - 1)));
+        vSearchBox.elem(arma::find(indSearchBox == 1)).fill(0);
+        vSearch(arma::span(r2Min, r2Max - 1), arma::span(c2Min, c2Max - 1)) = vSearchBox;
+    }
 
-        MatrixFloat_t pixelNoise;
-        getNoiseFft(inDataProcessed, pixelNoise, std::pair<float,float>(0.25f, 0.5f), AveragingMethod_t::MEAN);
+    /// Returns the number of consecutive candidate seeds, starting at inFirst, that can be processed concurrently
+    /// The neighbourhoods of the seeds of a batch are disjoint. Seeds after the first one must also avoid footprints
+    /// left in the slot of the next neuron, which they would only see if no earlier seed of the batch is accepted.
+    ///
+    /// \param inSeeds            Candidate seeds sorted by decreasing search value
+    /// \param inFirst            Index of the first seed of the batch
+    /// \param inLeftoverBoxes    Boxes of footprints left in the slot of the next neuron
+    /// \param inRadius           Radius of the neighbourhood touched by a seed
+    /// \param inMaxBatch         Maximum number of seeds in a batch
+    /// \return                   Number of seeds in the batch
+    static size_t getSeedBatchSize(
+        const std::vector<cv::Point> & inSeeds,
+        const size_t inFirst,
+        const std::vector<cv::Rect> & inLeftoverBoxes,
+        const int inRadius,
+        const size_t inMaxBatch)
+    {
+        size_t numBatch = 1;
+        while (numBatch < inMaxBatch && inFirst + numBatch < inSeeds.size())
+        {
+            const cv::Point & seed = inSeeds[inFirst + numBatch];
+            bool independent = true;
+            for (size_t idx = inFirst; idx < inFirst + numBatch && independent; ++idx)
+            {
+                independent = std::abs(seed.x - inSeeds[idx].x) > 2 * inRadius
+                    || std::abs(seed.y - inSeeds[idx].y) > 2 * inRadius;
+            }
 
-        tmp = arma::max(inDataProcessed, 2);
-        MatrixFloat_t pnr = tmp / pixelNoise;
+            const cv::Rect neighbourhood(seed.x - inRadius, seed.y - inRadius, 2 * inRadius + 1, 2 * inRadius + 1);
+            for (size_t idx = 0; idx < inLeftoverBoxes.size() && independent; ++idx)
+            {
+                independent = (neighbourhood & inLeftoverBoxes[idx]).area() == 0;
+            }
 
-        // compute local correlation image
-        CubeFloat_t tmpCube(inDataProcessed);
-        MatrixFloat_t minPixelNoise = static_cast<float>(inInitParams.m_noiseThreshold) * pixelNoise;
-        for (size_t i = 0; i < tmpCube.n_slices; ++i)
+            if (!independent)
+            {
+                break;
+            }
+            ++numBatch;
+        }
+        return numBatch;
+    }
+
+    /// Computes the images screened for seed pixels
+    ///
+    /// \param inData           Input movie
+    /// \param inInitParams     Initialization parameters
+    /// \param outSpatialFilter Kernel of the background filter (empty for no filtering)
+    /// \param outDataFiltered  Filtered movie with zero mean over time at each pixel
+    /// \param outPixelNoise    Noise of each pixel of the filtered movie
+    /// \param outMinPixelNoise Values of the filtered movie below this threshold are ignored in local correlations
+    /// \param outPnr           Peak-to-noise ratio image
+    /// \param outLocalCorr     Local correlation image
+    /// \param inNumThreads     Number of threads
+    /// \param inScheduler      Scheduler shared by the stages of a run (nullptr to create one with inNumThreads workers)
+    static void computeSearchImages(
+        const CubeFloat_t & inData,
+        const InitializationParams & inInitParams,
+        cv::Mat & outSpatialFilter,
+        CubeFloat_t & outDataFiltered,
+        MatrixFloat_t & outPixelNoise,
+        MatrixFloat_t & outMinPixelNoise,
+        MatrixFloat_t & outPnr,
+        MatrixFloat_t & outLocalCorr,
+        const size_t inNumThreads,
+        TaskScheduler * inScheduler)
+    {
+        // spatial filtering using disk background filter, followed by removal of the mean of each pixel
+        outSpatialFilter = cv::Mat();
+        if (inInitParams.m_gaussianKernelSize > 0)
         {
-            arma::umat ind = arma::find(tmpCube.slice(i) < minPixelNoise);
-            tmpCube.slice(i).elem(ind).fill(0);
+            outSpatialFilter = constructDiskFilter(inInitParams.m_gaussianKernelSize);
         }
+        filterMovie(inData, outSpatialFilter, outDataFiltered, inNumThreads, inScheduler);
 
-        MatrixFloat_t localCorr;
-        computeLocalCorr(tmpCube, localCorr);
+        // compute PNR image
+        getNoiseFft(outDataFiltered, outPixelNoise, std::pair<float,float>(0.25f, 0.5f), AveragingMethod_t::MEAN, 4096, inNumThreads, inScheduler);
+        outPnr = MatrixFloat_t(arma::max(outDataFiltered, 2)) / outPixelNoise;
+
+        // compute local correlation image, values below the noise threshold are zeroed within the kernel
+        outMinPixelNoise = static_cast<float>(inInitParams.m_noiseThreshold) * outPixelNoise;
+        computeLocalCorr(
+            outDataFiltered,
+            std::make_tuple(size_t(0), size_t(inData.n_rows - 1), size_t(0), size_t(inData.n_cols - 1)),
+            outMinPixelNoise,
+            outLocalCorr,
+            inNumThreads,
+            inScheduler);
+    }
 
-        // screen for seed pixels as neuron centers
-        MatrixFloat_t vSearch = localCorr % pnr;
-        arma::uvec ind = arma::find((localCorr < inInitParams.m_minCorr) || (pnr < inInitParams.m_minPNR));
-        vSearch.elem(ind).fill(0);
+    /// Screens pixels for seed pixels as neuron centers
+    ///
+    /// \param inPnr            Peak-to-noise ratio image
+    /// \param inLocalCorr      Local correlation image
+    /// \param inInitParams     Initialization parameters
+    /// \param outSearch        Search image, product of local correlation and PNR at pixels passing both thresholds
+    /// \param outExcluded      Pixels excluded from the search space are set to 1
+    static void initSearchSpace(
+        const MatrixFloat_t & inPnr,
+        const MatrixFloat_t & inLocalCorr,
+        const InitializationParams & inInitParams,
+        MatrixFloat_t & outSearch,
+        MatrixFloat_t & outExcluded)
+    {
+        outSearch = inLocalCorr % inPnr;
+        outSearch.elem(arma::find((inLocalCorr < inInitParams.m_minCorr) || (inPnr < inInitParams.m_minPNR))).fill(0);
 
         // define search space
-        arma::umat tmpInd = arma::find(vSearch <= 0);
-        MatrixFloat_t indSearch = arma::zeros<MatrixFloat_t>(vSearch.n_rows, vSearch.n_cols);
-        indSearch.elem(tmpInd).fill(1);
+        outExcluded = arma::zeros<MatrixFloat_t>(outSearch.n_rows, outSearch.n_cols);
+        outExcluded.elem(arma::find(outSearch <= 0)).fill(1);
 
         // exclude pixels close to boundary from search space
         if (inInitParams.m_boundaryDist > 0)
         {
             for (int i = 0; i < inInitParams.m_boundaryDist; ++i)
             {
-                indSearch.row(i).fill(1);
-                indSearch.row(vSearch.n_rows - 1 - i).fill(1);
-                indSearch.col(i).fill(1);
-                indSearch.col(vSearch.n_cols - 1 - i).fill(1);
+                outExcluded.row(i).fill(1);
+                outExcluded.row(outSearch.n_rows - 1 - i).fill(1);
+                outExcluded.col(i).fill(1);
+                outExcluded.col(outSearch.n_cols - 1 - i).fill(1);
             }
         }
+    }
 
-        // params for neuron initialization loop
-        if (maxNumNeurons <= 0)
-        {
-            maxNumNeurons = static_cast<int32_t>((indSearch.size() - arma::accu(indSearch)) / 5);
-        }
+    /// Selects candidate seed pixels as local maxima of the median filtered search image
+    ///
+    /// \param inOutSearch      Search image, median filtered in place
+    /// \param inExcluded       Pixels excluded from the search space are set to 1
+    /// \param inPnr            Peak-to-noise ratio image
+    /// \param inLocalCorr      Local correlation image
+    /// \param inInitParams     Initialization parameters
+    /// \return                 Search value at candidate seed pixels, zero elsewhere (w x h OpenCV image)
+    static cv::Mat selectSeedCandidates(
+        MatrixFloat_t & inOutSearch,
+        const MatrixFloat_t & inExcluded,
+        const MatrixFloat_t & inPnr,
+        const MatrixFloat_t & inLocalCorr,
+        const InitializationParams & inInitParams)
+    {
+        inOutSearch.elem(arma::find((inLocalCorr < inInitParams.m_minCorr) || (inPnr < inInitParams.m_minPNR))).fill(0);
 
+        // small increasing offset breaks ties between equal search values
         MatrixFloat_t xmesh = arma::repmat(
-            arma::linspace<RowFloat_t>(0.0f, static_cast<float>(inData.n_cols - 1), inData.n_cols), inData.n_rows, 1
+            arma::linspace<RowFloat_t>(0.0f, static_cast<float>(inOutSearch.n_cols - 1), inOutSearch.n_cols), inOutSearch.n_rows, 1
         );
         MatrixFloat_t ymesh = arma::repmat(
-            arma::linspace<ColumnFloat_t>(0.0f, static_cast<float>(inData.n_rows - 1), inData.n_rows), 1, inData.n_cols
+            arma::linspace<ColumnFloat_t>(0.0f, static_cast<float>(inOutSearch.n_rows - 1), inOutSearch.n_rows), 1, inOutSearch.n_cols
         );
         MatrixFloat_t pixel_v = (xmesh*10.0f + ymesh) * 1e-5f;
 
+        // convert data to OpenCV format
+        cv::Mat vSearchMat = armaToCvMat<float, float>(inOutSearch);
+        cv::Mat pixelvMat = armaToCvMat<float, float>(pixel_v);
+        cv::Mat indSearchMat = armaToCvMat<float, uint8_t>(inExcluded);
+
+        // apply median blur (only supports CV_8U, CV_16U, CV_32F)
+        cv::medianBlur(vSearchMat, vSearchMat, 3);
+        vSearchMat += pixelvMat;
+        vSearchMat.setTo(0, indSearchMat);
+
+        // select seed pixels as local maximums
+        cv::Mat vMax;
+        cv::Mat tmpKernel = cv::Mat::ones(static_cast<int32_t>(round(inInitParams.m_averageCellDiameter / 4.0f)),
+                                          static_cast<int32_t>(round(inInitParams.m_averageCellDiameter / 4.0f)), CV_32FC1);
+        cv::dilate(vSearchMat, vMax, tmpKernel);
+
+        const float minvSearch = inInitParams.m_minCorr * inInitParams.m_minPNR;
+        cv::Mat mask;
+        cv::bitwise_or(vSearchMat != vMax, vSearchMat < minvSearch, mask);
+        vMax.setTo(0, mask);
+
+        // propagate search space updates from opencv matrix to arma matrix
+        inOutSearch = cvToArmaMat<float, float>(vSearchMat);
+        return vMax;
+    }
+
+    void initNeuronsCorrPNR(
+        CubeFloat_t inData,
+        CubeFloat_t & outA,
+        MatrixFloat_t & outC,
+        MatrixFloat_t & outCRaw,
+        MatrixFloat_t & outS,
+        DeconvolutionParams inDeconvParams,
+        InitializationParams inInitParams,
+        int32_t maxNumNeurons,
+        const size_t inNumThreads,
+        TaskScheduler * inScheduler)
+    {
+        // the movie taken by value is the working copy of the raw data, neurons are removed from it in place
+        CubeFloat_t & inDataModifiable = inData;
+
+        // images screened for seed pixels
+        cv::Mat spatialFilter;
+        CubeFloat_t inDataProcessed;
+        MatrixFloat_t pixelNoise, minPixelNoise, pnr, localCorr;
+        computeSearchImages(inData, inInitParams, spatialFilter, inDataProcessed, pixelNoise, minPixelNoise, pnr, localCorr, inNumThreads, inScheduler);
+
+        MatrixFloat_t vSearch, indSearch;
+        initSearchSpace(pnr, localCorr, inInitParams, vSearch, indSearch);
+
+        // params for neuron initialization loop
+        if (maxNumNeurons <= 0)
+        {
+            maxNumNeurons = static_cast<int32_t>((indSearch.size() - arma::accu(indSearch)) / 5);
+        }
+
         int32_t numNeurons = 0;
         bool lookForNeurons = maxNumNeurons > 0;
-        float minvSearch = inInitParams.m_minCorr * inInitParams.m_minPNR;
+        const float minvSearch = inInitParams.m_minCorr * inInitParams.m_minPNR;
 
         outA = arma::zeros<CubeFloat_t>(inData.n_rows, inData.n_cols, maxNumNeurons);
         outC = arma::zeros<MatrixFloat_t>(maxNumNeurons, inData.n_slices);
         outCRaw = arma::zeros<MatrixFloat_t>(maxNumNeurons, inData.n_slices);
         outS = arma::zeros<MatrixFloat_t>(maxNumNeurons, inData.n_slices);
 
+        SeedSearchImages images{
+            inDataModifiable, inDataProcessed, pixelNoise, minPixelNoise, pnr, localCorr, vSearch, indSearch, outA};
+
+        // seeds further apart than the extent of their neighbourhoods are independent
+        const int seedRadius = std::max(2 * inInitParams.m_averageCellDiameter, inInitParams.m_averageCellDiameter + 1);
+        const size_t maxSeedBatch = (inNumThreads > 1) ? 2 * inNumThreads : 1;
+        std::vector<cv::Point> visitedSeeds;
+        std::vector<cv::Rect> leftoverBoxes;
+
         // neuron initialization loop
         while (lookForNeurons)
         {
-            tmpInd = arma::find((localCorr < inInitParams.m_minCorr) || (pnr < inInitParams.m_minPNR));
-            vSearch.elem(tmpInd).fill(0);
-
-            // convert data to OpenCV format
-            cv::Mat vSearchMat = armaToCvMat<float, float>(vSearch);
-            cv::Mat pixelvMat = armaToCvMat<float, float>(pixel_v);
-            cv::Mat indSearchMat = armaToCvMat<float, uint8_t>(indSearch);
-
-            // apply median blur (only supports CV_8U, CV_16U, CV_32F)
-            cv::medianBlur(vSearchMat, vSearchMat, 3);
-            vSearchMat += pixelvMat;
-            vSearchMat.setTo(0, indSearchMat);
-
-            // select seed pixels as local maximums
-            cv::Mat vMax;
-            cv::Mat tmpKernel = cv::Mat::ones(static_cast<int32_t>(round(inInitParams.m_averageCellDiameter / 4.0f)),
-                                              static_cast<int32_t>(round(inInitParams.m_averageCellDiameter / 4.0f)), CV_32FC1);
-            cv::dilate(vSearchMat, vMax, tmpKernel);
-
-            cv::Mat mask;
-            cv::bitwise_or(vSearchMat != vMax, vSearchMat < minvSearch, mask);
-            vMax.setTo(0, mask);
-
-            // propagate search space updates from opencv matrix to arma matrix
-            vSearch = cvToArmaMat<float, float>(vSearchMat);
+            const cv::Mat vMax = selectSeedCandidates(vSearch, indSearch, pnr, localCorr, inInitParams);
 
             // find locations of non-zero pixels
             cv::Mat nonZeroCoordinates;
@@ -290,164 +795,92 @@ namespace isx
                       return vMax.at<float>(a) > vMax.at<float>(b);
                   });
 
-            // loop over candidate seed pixels
-            for (auto &it : ptsVec)
+            // loop over batches of candidate seed pixels, in order of decreasing search value
+            // seeds of a batch have disjoint neighbourhoods and are processed concurrently, results are committed in order
+            size_t nextSeed = 0;
+            while (nextSeed < ptsVec.size())
             {
-                int r = it.y;
-                int c = it.x;
-
-                // mark pixel as visited
-                indSearch.at(r, c) = 1;
+                const size_t numBatch = getSeedBatchSize(ptsVec, nextSeed, leftoverBoxes, seedRadius, maxSeedBatch);
 
-                // skip pixel if it doesn't qualify as a good seed pixel
-                if (vSearch.at(r, c) < minvSearch)
+                std::vector<SeedResult> results(numBatch);
+                if (numBatch > 1)
                 {
-                    continue;
-                }
+                    std::shared_ptr<TaskScheduler> scheduler = getTaskScheduler(inScheduler, inNumThreads);
+                    std::vector<std::future<void>> futures(numBatch);
+                    for (size_t idx = 0; idx < numBatch; ++idx)
+                    {
+                        futures[idx] = scheduler->enqueue(
+                            processSeedPixel,
+                            ptsVec[nextSeed + idx],
+                            static_cast<size_t>(numNeurons),
+                            std::ref(images),
+                            std::cref(spatialFilter),
+                            std::cref(inDeconvParams),
+                            std::cref(inInitParams),
+                            minvSearch,
+                            std::ref(results[idx]));
+                    }
 
-                ColumnFloat_t y0 (inDataProcessed(arma::span(r), arma::span(c), arma::span::all));
-                y0 = arma::diff(y0);
-                if (arma::max(y0) < 3 * arma::stddev(y0, 1))
-                {
-                    vSearch.at(r, c) = 0;
-                    continue;
+                    scheduler->waitAll(futures);
                 }
-
-                // crop small region around seed pixel for estimating spatiotemporal activity of the neuron
-                int rMin = std::max(0, r - inInitParams.m_averageCellDiameter);
-                int rMax = std::min(static_cast<int>(inData.n_rows), r + inInitParams.m_averageCellDiameter + 1);
-                int cMin = std::max(0, c - inInitParams.m_averageCellDiameter);
-                int cMax = std::min(static_cast<int>(inData.n_cols), c + inInitParams.m_averageCellDiameter + 1);
-
-                CubeFloat_t dataRawBox(
-                    inDataModifiable(arma::span(rMin, rMax - 1), arma::span(cMin, cMax - 1), arma::span::all));
-                CubeFloat_t dataFilteredBox(
-                    inDataProcessed(arma::span(rMin, rMax - 1), arma::span(cMin, cMax - 1), arma::span::all));
-
-                // extract spatiotemporal activity
-                std::pair<int32_t, int32_t> centerIndex(r - rMin, c - cMin);
-                MatrixFloat_t ai;
-                ColumnFloat_t ciRaw;
-                extractAC(dataFilteredBox, dataRawBox, centerIndex, ai, ciRaw);
-
-                arma::uvec nonZeroElems = arma::find(ai > 0);
-                if (static_cast<int>(nonZeroElems.size()) < inInitParams.m_minNumPixels)
+                else
                 {
-                    continue;
+                    processSeedPixel(ptsVec[nextSeed], static_cast<size_t>(numNeurons), images, spatialFilter,
+                                     inDeconvParams, inInitParams, minvSearch, results[0]);
                 }
 
-                outA(arma::span(rMin, rMax - 1), arma::span(cMin, cMax - 1), arma::span(numNeurons)) = ai;
-                outCRaw.row(numNeurons) = ciRaw.t();
-
-                ColumnFloat_t ci, si;
-                if (inInitParams.m_deconvolve)
+                for (size_t idx = 0; idx < numBatch && lookForNeurons; ++idx)
                 {
-                    // with deconvolution
-                    float c1, baseline;
-                    float noise = -1;
-                    std::vector<float> ARParams;
-                    constrainedFoopsi(ciRaw, ARParams, noise, ci, baseline, c1, si, inDeconvParams);
+                    const SeedResult & result = results[idx];
+                    const cv::Point & seed = ptsVec[nextSeed + idx];
+                    if (result.m_footprintWritten)
+                    {
+                        outA(arma::span(result.m_rMin, result.m_rMax - 1), arma::span(result.m_cMin, result.m_cMax - 1),
+                             arma::span(numNeurons)) = result.m_ai;
+                        outCRaw.row(numNeurons) = result.m_ciRaw.t();
+                    }
 
-                    if (arma::sum(ci) == 0)
+                    if (!result.m_accepted)
                     {
+                        // visited pixels are cleared from the search image once another neuron is initialized
+                        visitedSeeds.push_back(seed);
+                        if (result.m_footprintWritten)
+                        {
+                            // footprint stays in the next slice, where it is seen by the next neuron of its neighbourhood
+                            leftoverBoxes.push_back(cv::Rect(result.m_cMin, result.m_rMin,
+                                                             result.m_cMax - result.m_cMin, result.m_rMax - result.m_rMin));
+                        }
                         continue;
                     }
-                    outC.row(numNeurons) = ci.t();
-                    outS.row(numNeurons) = si.t();
-                }
-                else
-                {
-                    // no deconvolution
-                    ci = ciRaw;
-                    ci.elem(arma::find(ci < 0)).fill(0);
 
-                    if (arma::sum(ci) == 0)
+                    outC.row(numNeurons) = result.m_ci.t();
+                    if (inInitParams.m_deconvolve)
                     {
-                        continue;
+                        outS.row(numNeurons) = result.m_si.t();
                     }
-                    outC.row(numNeurons) = ci.t();
-                }
 
-                // update search space to exclude nearby pixels
-                MatrixFloat_t tmpmat(indSearch(arma::span(rMin, rMax - 1), arma::span(cMin, cMax - 1)));
-                tmpmat.elem(find(ai > ai.max() / 2.0f)).fill(1.0f);
-                indSearch(arma::span(rMin, rMax - 1), arma::span(cMin, cMax - 1)) = tmpmat;
+                    for (const cv::Point & visited : visitedSeeds)
+                    {
+                        vSearch.at(visited.y, visited.x) = 0;
+                    }
+                    visitedSeeds.clear();
+                    leftoverBoxes.clear();
 
-                // remove spatiotemporal activity of initialized neuron from raw data
-                for (size_t i = 0; i < inDataModifiable.n_slices; ++i)
-                {
-                    inDataModifiable(arma::span(rMin, rMax - 1),
-                                     arma::span(cMin, cMax - 1),
-                                     arma::span(i)) -= ai * ci.at(i);
-                }
+                    // increment number of neurons initialized
+                    ++numNeurons;
 
-                // define neighborhood of pixels to update after initializing a neuron
-                int r2Min = std::max(0, r - 2 * inInitParams.m_averageCellDiameter);
-                int r2Max = std::min(static_cast<int>(inData.n_rows), r + 2 * inInitParams.m_averageCellDiameter + 1);
-                int c2Min = std::max(0, c - 2 * inInitParams.m_averageCellDiameter);
-                int c2Max = std::min(static_cast<int>(inData.n_cols), c + 2 * inInitParams.m_averageCellDiameter + 1);
-
-                if (inInitParams.m_gaussianKernelSize > 0) {
-                    // spatially filter neuron shape
-                    MatrixFloat_t tmpImg(
-                        outA(arma::span(r2Min, r2Max - 1), arma::span(c2Min, c2Max - 1), arma::span(numNeurons))
-                    );
-                    MatrixFloat_t aiFiltered;
-                    apply2DFilter(tmpImg, aiFiltered, spatialFilter);
-
-                    // update processed data
-                    for (size_t i = 0; i < inDataProcessed.n_slices; ++i)
+                    if (numNeurons == maxNumNeurons)
                     {
-                        inDataProcessed(arma::span(r2Min, r2Max - 1), arma::span(c2Min, c2Max - 1),
-                                        arma::span(i)) -= aiFiltered * ci.at(i);
+                        lookForNeurons = false;
                     }
-                    dataFilteredBox = inDataProcessed(arma::span(r2Min, r2Max - 1),
-                                                      arma::span(c2Min, c2Max - 1), arma::span::all);
                 }
 
-                // update PNR image
-                MatrixFloat_t maxBox = arma::max(dataFilteredBox, 2);
-                MatrixFloat_t noiseBox(
-                    pixelNoise(arma::span(r2Min, r2Max - 1), arma::span(c2Min, c2Max - 1)));
-                MatrixFloat_t pnrBox(maxBox / noiseBox);
-                pnrBox.elem(arma::find(pnrBox < inInitParams.m_minPNR)).fill(0.0f);
-                pnr(arma::span(r2Min, r2Max - 1), arma::span(c2Min, c2Max - 1)) = pnrBox;
-
-                // update local correlation image
-                // compute local correlation of candidate pixel for size of neuron + 1 pixel border of neighbouring neurons
-                int r3Min = std::max(0, r - inInitParams.m_averageCellDiameter - 1);
-                int r3Max = std::min(static_cast<int>(inData.n_rows), r + inInitParams.m_averageCellDiameter + 2);
-                int c3Min = std::max(0, c - inInitParams.m_averageCellDiameter - 1);
-                int c3Max = std::min(static_cast<int>(inData.n_cols), c + inInitParams.m_averageCellDiameter + 2);
-                dataFilteredBox = inDataProcessed(arma::span(r3Min, r3Max - 1), arma::span(c3Min, c3Max - 1), arma::span::all);
-                noiseBox = minPixelNoise(arma::span(r3Min, r3Max - 1), arma::span(c3Min, c3Max - 1));
-                for (size_t i = 0; i < dataFilteredBox.n_slices; ++i)
+                if (!lookForNeurons)
                 {
-                    arma::umat tmpind = arma::find(dataFilteredBox.slice(i) < noiseBox);
-                    dataFilteredBox.slice(i).elem(tmpind).fill(0);
-                }
-
-                MatrixFloat_t cnBox;
-                computeLocalCorr(dataFilteredBox, cnBox);
-                cnBox.elem(arma::find(cnBox < 0)).fill(0);
-
-                localCorr(arma::span(rMin, rMax - 1), arma::span(cMin, cMax - 1)) = cnBox(
-                    arma::span(rMin - r3Min, rMax - r3Min - 1), arma::span(cMin - c3Min, cMax - c3Min - 1));
-                cnBox = localCorr(arma::span(r2Min, r2Max - 1), arma::span(c2Min, c2Max - 1));
-
-                // update search space
-                vSearch(arma::span(r2Min, r2Max - 1), arma::span(c2Min, c2Max - 1)) = cnBox % pnrBox;
-                vSearch.elem(arma::find(indSearch == 1)).fill(0);
-
-                // increment number of neurons initialized
-                ++numNeurons;
-
-                if (numNeurons == maxNumNeurons)
-                {
-                    lookForNeurons = false;
                     break;
                 }
-            } // for loop for candidate seed pixels
+                nextSeed += numBatch;
+            } // loop over batches of candidate seed pixels
         } // while loop for neurons
 
         outA = outA.head_slices(numNeurons);
@@ -458,4 +891,28 @@ namespace isx
         ISX_LOG_INFO(numNeurons, " neurons were initialized");
     }
 
+    void computeSeedSearchImages(
+        const CubeFloat_t & inData,
+        const InitializationParams & inInitParams,
+        MatrixFloat_t & outPnr,
+        MatrixFloat_t & outLocalCorr,
+        MatrixFloat_t & outSeeds,
+        const size_t inNumThreads,
+        TaskScheduler * inScheduler)
+    {
+        cv::Mat spatialFilter;
+        CubeFloat_t dataFiltered;
+        MatrixFloat_t pixelNoise, minPixelNoise;
+        computeSearchImages(inData, inInitParams, spatialFilter, dataFiltered, pixelNoise, minPixelNoise, outPnr, outLocalCorr, inNumThreads, inScheduler);
+
+        MatrixFloat_t vSearch, indSearch;
+        initSearchSpace(outPnr, outLocalCorr, inInitParams, vSearch, indSearch);
+        outSeeds = cvToArmaMat<float, float>(selectSeedCandidates(vSearch, indSearch, outPnr, outLocalCorr, inInitParams));
+    }
+
+    int32_t estimateFilterSize(const int32_t inAverageCellDiameter)
+    {
+        return static_cast<int32_t>((static_cast<float>(inAverageCellDiameter - 1)) / 4.0f);
+    }
+
 } // namespace isx
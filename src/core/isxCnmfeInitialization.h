@@ -3,6 +3,7 @@
 
 #include "isxArmaUtils.h"
 #include "isxCnmfeParams.h"
+#include "isxTaskScheduler.h"
 
 namespace isx
 {
@@ -26,7 +27,7 @@ namespace isx
 
     /// Initializes neurons from pixels with high local correlation and high peak-to-noise ratio
     ///
-    /// \param inData               Input movie
+    /// \param inData               Input movie, taken by value as the working copy (move a temporary movie in to avoid a copy)
     /// \param outA                 Spatial footprints of neurons
     /// \param outC                 Deconvolved and denoised temporal activity of neurons
     /// \param outCRaw              Denoised temporal activity of neurons
@@ -35,15 +36,64 @@ namespace isx
     /// \param inDeconvParams       Deconvolution parameters
     /// \param inInitParams         Initialization parameters
     /// \param maxNumNeurons        Maximum number of neurons to detect (0 is used for 'auto' which stops when all pixels are below initialization thresholds)
+    /// \param inNumThreads         Number of threads used to compute the summary images of the movie and to process
+    ///                             candidate seed pixels, which are tried in batches of up to 2 * inNumThreads seeds
+    ///                             with disjoint neighbourhoods (a single thread tries one seed at a time)
+    /// \param inScheduler          Scheduler shared by the stages of a run (nullptr to create one with inNumThreads workers)
     void initNeuronsCorrPNR(
-        const CubeFloat_t & inData,
+        CubeFloat_t inData,
         CubeFloat_t & outA,
         MatrixFloat_t & outC,
         MatrixFloat_t & outCRaw,
         MatrixFloat_t & outS,
         DeconvolutionParams inDeconvParams,
         InitializationParams inInitParams,
-        int32_t maxNumNeurons = 0);
+        int32_t maxNumNeurons = 0,
+        const size_t inNumThreads = 1,
+        TaskScheduler * inScheduler = nullptr);
+
+    /// Computes the images screened for seed pixels by initNeuronsCorrPNR(...) without initializing neurons
+    /// Meant for previewing the effect of the minCorr and minPNR thresholds on a movie
+    ///
+    /// \param inData               Input movie
+    /// \param inInitParams         Initialization parameters
+    /// \param outPnr               Peak-to-noise ratio image of the filtered movie
+    /// \param outLocalCorr         Local correlation image of the filtered movie
+    /// \param outSeeds             Search value at the candidate seed pixels of the first initialization round, zero elsewhere
+    /// \param inNumThreads         Number of threads
+    /// \param inScheduler          Scheduler shared by the stages of a run (nullptr to create one with inNumThreads workers)
+    void computeSeedSearchImages(
+        const CubeFloat_t & inData,
+        const InitializationParams & inInitParams,
+        MatrixFloat_t & outPnr,
+        MatrixFloat_t & outLocalCorr,
+        MatrixFloat_t & outSeeds,
+        const size_t inNumThreads = 1,
+        TaskScheduler * inScheduler = nullptr);
+
+    /// Estimates the size of the morphological filters from the average diameter of a neuron
+    /// Used when the gaussian or closing kernel size is left to be auto estimated (< 2)
+    ///
+    /// \param inAverageCellDiameter    Average diameter of neuron in pixels
+    /// \return                         Width of the filter kernel
+    int32_t estimateFilterSize(const int32_t inAverageCellDiameter);
+
+    /// Spatially filters every frame of a movie and removes the mean of the filtered movie
+    /// Frames are correlated with the kernel as cv::filter2D does with a replicated border.
+    /// Contiguous ranges of frames are filtered concurrently, then the mean is removed from ranges of pixels.
+    /// Large kernels are applied in the frequency domain with the spectrum of the kernel computed once.
+    ///
+    /// \param inData       Input movie
+    /// \param inKernel     Kernel of the spatial filter (empty to only remove the mean)
+    /// \param outData      Filtered movie with zero mean over time at each pixel
+    /// \param inNumThreads Number of threads used to filter frames
+    /// \param inScheduler  Scheduler shared by the stages of a run (nullptr to create one with inNumThreads workers)
+    void filterMovie(
+        const CubeFloat_t & inData,
+        const cv::Mat & inKernel,
+        CubeFloat_t & outData,
+        const size_t inNumThreads = 1,
+        TaskScheduler * inScheduler = nullptr);
 } // namespace isx
 
 #endif //ISX_CNMFE_INITIALIZATION_H
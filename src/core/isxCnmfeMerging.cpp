@@ -1,70 +1,360 @@
 #include "isxCnmfeMerging.h"
 #include "isxCnmfeDeconv.h"
 #include "isxLog.h"
-#include "ThreadPool.h"
-#include <stack>
+#include "isxTaskScheduler.h"
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <string>
 
 
 namespace isx
 {
+    // Root of the set holding a vertex, halving the path on the way
+    static arma::uword findRoot(std::vector<arma::uword> & inOutParents, arma::uword inVertex)
+    {
+        while (inOutParents[inVertex] != inVertex)
+        {
+            inOutParents[inVertex] = inOutParents[inOutParents[inVertex]];
+            inVertex = inOutParents[inVertex];
+        }
+        return inVertex;
+    }
+
+    // Joins the sets of two vertices, the smallest vertex of a set is its root
+    static void uniteSets(std::vector<arma::uword> & inOutParents, const arma::uword inVertex1, const arma::uword inVertex2)
+    {
+        const arma::uword root1 = findRoot(inOutParents, inVertex1);
+        const arma::uword root2 = findRoot(inOutParents, inVertex2);
+        if (root1 < root2)
+        {
+            inOutParents[root2] = root1;
+        }
+        else if (root2 < root1)
+        {
+            inOutParents[root1] = root2;
+        }
+    }
+
     void connectedComponents(
         const arma::umat & graph,
         uint32_t & numComponents,
         arma::uvec & connectedComponents)
     {
-        int voidVal = -1;
-        int endVal = -2;
+        std::vector<arma::uword> parents(graph.n_rows);
+        for (arma::uword vertex = 0; vertex < graph.n_rows; ++vertex)
+        {
+            parents[vertex] = vertex;
+        }
 
-        arma::SpMat<arma::uword> X(graph.t());
-        arma::SpMat<arma::uword> XT(graph);
-        X.sync();
-        XT.sync();
+        for (arma::uword col = 0; col < graph.n_cols; ++col)
+        {
+            for (arma::uword row = 0; row < graph.n_rows; ++row)
+            {
+                if (graph(row, col) != 0)
+                {
+                    uniteSets(parents, row, col);
+                }
+            }
+        }
 
+        // components are numbered in order of their smallest vertex
         numComponents = 0;
-        arma::ivec labels = arma::ivec(X.n_rows, arma::fill::ones) * voidVal;
+        connectedComponents.set_size(graph.n_rows);
+        for (arma::uword vertex = 0; vertex < graph.n_rows; ++vertex)
+        {
+            const arma::uword root = findRoot(parents, vertex);
+            connectedComponents(vertex) = (root == vertex) ? numComponents++ : connectedComponents(root);
+        }
+    }
 
-        arma::ivec stack(labels);
-        size_t stackHead;
+    // Inner product of two sparse columns
+    static float sparseColumnDot(const arma::SpMat<float> & inA, const arma::uword inCol1, const arma::uword inCol2)
+    {
+        arma::uword i1 = inA.col_ptrs[inCol1];
+        arma::uword i2 = inA.col_ptrs[inCol2];
+        const arma::uword end1 = inA.col_ptrs[inCol1 + 1];
+        const arma::uword end2 = inA.col_ptrs[inCol2 + 1];
 
-        for(size_t vertex = 0; vertex < X.n_rows; ++vertex)
+        float dot = 0.0f;
+        while (i1 < end1 && i2 < end2)
         {
-            if (labels(vertex) == voidVal)
+            if (inA.row_indices[i1] < inA.row_indices[i2])
+            {
+                ++i1;
+            }
+            else if (inA.row_indices[i2] < inA.row_indices[i1])
+            {
+                ++i2;
+            }
+            else
             {
-                stackHead = vertex;
-                stack[vertex] = endVal;
+                dot += inA.values[i1++] * inA.values[i2++];
+            }
+        }
+        return dot;
+    }
 
-                while (static_cast<int>(stackHead) != endVal)
-                {
-                    size_t vertexIdx = stackHead;
-                    stackHead = stack[vertexIdx];
+    namespace
+    {
+        // Bounding box of the non-zero pixels of a footprint, bounds are inclusive
+        struct FootprintBox
+        {
+            arma::uword m_rowMin;
+            arma::uword m_rowMax;
+            arma::uword m_colMin;
+            arma::uword m_colMax;
+        };
+    } // namespace
+
+    void findOverlappingComponents(
+        const MatrixFloat_t & inA,
+        const size_t inNumRows,
+        const size_t inNumCols,
+        std::vector<ComponentOverlap> & outOverlaps)
+    {
+        outOverlaps.clear();
+        if (inA.n_rows != inNumRows * inNumCols)
+        {
+            const std::string msg = "Spatial components do not match the dimensions of the field of view";
+            ISX_LOG_WARNING(msg);
+            throw std::runtime_error(msg);
+        }
+
+        // non-zero pixels of each footprint, in increasing order of pixel index
+        arma::SpMat<float> sparseA(inA);
+        sparseA.sync();
+
+        // bounding boxes of the non-empty footprints, pixels are stored column by column
+        std::vector<arma::uword> components;
+        std::vector<FootprintBox> boxes;
+        components.reserve(inA.n_cols);
+        boxes.reserve(inA.n_cols);
+        for (arma::uword k = 0; k < inA.n_cols; ++k)
+        {
+            const arma::uword begin = sparseA.col_ptrs[k];
+            const arma::uword end = sparseA.col_ptrs[k + 1];
+            if (end == begin)
+            {
+                continue;
+            }
+
+            FootprintBox box{arma::uword(inNumRows), 0, sparseA.row_indices[begin] / inNumRows, sparseA.row_indices[end - 1] / inNumRows};
+            for (arma::uword i = begin; i < end; ++i)
+            {
+                const arma::uword row = sparseA.row_indices[i] % inNumRows;
+                box.m_rowMin = std::min(box.m_rowMin, row);
+                box.m_rowMax = std::max(box.m_rowMax, row);
+            }
+            components.push_back(k);
+            boxes.push_back(box);
+        }
+        if (components.empty())
+        {
+            return;
+        }
 
-                    labels[vertexIdx] = numComponents;
+        // bucket the boxes on a grid of cells about the size of a typical footprint, so that
+        // each component is only compared with the components sharing one of its cells
+        std::vector<arma::uword> extents;
+        extents.reserve(boxes.size());
+        for (const FootprintBox & box : boxes)
+        {
+            extents.push_back(std::max(box.m_rowMax - box.m_rowMin, box.m_colMax - box.m_colMin) + 1);
+        }
+        std::nth_element(extents.begin(), extents.begin() + extents.size() / 2, extents.end());
+        const arma::uword cellSize = extents[extents.size() / 2];
+        const arma::uword numCellRows = (inNumRows + cellSize - 1) / cellSize;
+        const arma::uword numCellCols = (inNumCols + cellSize - 1) / cellSize;
+
+        // members of each cell stored as flat lists, in increasing order of component
+        std::vector<size_t> cellOffsets(numCellRows * numCellCols + 1, 0);
+        for (const FootprintBox & box : boxes)
+        {
+            for (arma::uword c = box.m_colMin / cellSize; c <= box.m_colMax / cellSize; ++c)
+            {
+                for (arma::uword r = box.m_rowMin / cellSize; r <= box.m_rowMax / cellSize; ++r)
+                {
+                    ++cellOffsets[c * numCellRows + r + 1];
+                }
+            }
+        }
+        std::partial_sum(cellOffsets.begin(), cellOffsets.end(), cellOffsets.begin());
+        std::vector<size_t> cellMembers(cellOffsets.back());
+        std::vector<size_t> cellFill(cellOffsets.begin(), cellOffsets.end() - 1);
+        for (size_t idx = 0; idx < boxes.size(); ++idx)
+        {
+            const FootprintBox & box = boxes[idx];
+            for (arma::uword c = box.m_colMin / cellSize; c <= box.m_colMax / cellSize; ++c)
+            {
+                for (arma::uword r = box.m_rowMin / cellSize; r <= box.m_rowMax / cellSize; ++r)
+                {
+                    cellMembers[cellFill[c * numCellRows + r]++] = idx;
+                }
+            }
+        }
 
-                    for (size_t j = X.col_ptrs[vertexIdx]; j < X.col_ptrs[vertexIdx + 1]; j++)
+        // a pair of intersecting boxes is only compared in the cell holding the corner of their intersection,
+        // so that pairs sharing several cells are compared once
+        for (arma::uword cell = 0; cell < numCellRows * numCellCols; ++cell)
+        {
+            const arma::uword cellRow = cell % numCellRows;
+            const arma::uword cellCol = cell / numCellRows;
+            for (size_t m1 = cellOffsets[cell]; m1 < cellOffsets[cell + 1]; ++m1)
+            {
+                const FootprintBox & box1 = boxes[cellMembers[m1]];
+                for (size_t m2 = m1 + 1; m2 < cellOffsets[cell + 1]; ++m2)
+                {
+                    const FootprintBox & box2 = boxes[cellMembers[m2]];
+                    const arma::uword rowMin = std::max(box1.m_rowMin, box2.m_rowMin);
+                    const arma::uword colMin = std::max(box1.m_colMin, box2.m_colMin);
+                    if (rowMin > std::min(box1.m_rowMax, box2.m_rowMax) ||
+                        colMin > std::min(box1.m_colMax, box2.m_colMax) ||
+                        rowMin / cellSize != cellRow || colMin / cellSize != cellCol)
                     {
-                        size_t tmpIdx = X.row_indices[j];
-                        if (stack[tmpIdx] == voidVal)
-                        {
-                            stack[tmpIdx] = stackHead;
-                            stackHead = tmpIdx;
-                        }
+                        continue;
                     }
 
-                    for (size_t j = XT.col_ptrs[vertexIdx]; j < XT.col_ptrs[vertexIdx + 1]; j++)
+                    const arma::uword j = components[cellMembers[m1]];
+                    const arma::uword k = components[cellMembers[m2]];
+                    const float dot = sparseColumnDot(sparseA, j, k);
+                    if (dot != 0.0f)
                     {
-                        size_t tmpIdx = XT.row_indices[j];
-                        if (stack[tmpIdx] == voidVal)
-                        {
-                            stack[tmpIdx] = stackHead;
-                            stackHead = tmpIdx;
-                        }
+                        outOverlaps.push_back(ComponentOverlap{j, k, dot > 0.0f, 0.0f});
                     }
                 }
+            }
+        }
 
-                numComponents++;
+        std::sort(outOverlaps.begin(), outOverlaps.end(),
+            [](const ComponentOverlap & a, const ComponentOverlap & b)
+            {
+                return (a.m_first < b.m_first) || (a.m_first == b.m_first && a.m_second < b.m_second);
+            });
+    }
+
+    // Correlates the traces of a range of pairs of components
+    static void correlateOverlapRange(
+        const MatrixFloat_t & inNormalizedTraces,
+        const size_t inFirst,
+        const size_t inEnd,
+        std::vector<ComponentOverlap> & inOutOverlaps)
+    {
+        for (size_t idx = inFirst; idx < inEnd; ++idx)
+        {
+            ComponentOverlap & overlap = inOutOverlaps[idx];
+            const float corr = arma::dot(inNormalizedTraces.col(overlap.m_first), inNormalizedTraces.col(overlap.m_second));
+            overlap.m_corr = std::max(std::min(corr, 1.0f), -1.0f);
+        }
+    }
+
+    void correlateOverlappingComponents(
+        const MatrixFloat_t & inC,
+        std::vector<ComponentOverlap> & inOutOverlaps,
+        const size_t inNumThreads,
+        TaskScheduler * inScheduler)
+    {
+        if (inOutOverlaps.empty())
+        {
+            return;
+        }
+
+        // centered traces of unit norm, one per column, normalized as in pearsonr(...)
+        MatrixFloat_t traces(inC.n_cols, inC.n_rows);
+        for (size_t k = 0; k < inC.n_rows; ++k)
+        {
+            const ColumnFloat_t x = inC.row(k).t();
+            const float xmean = arma::mean(x);
+            const float normxm = arma::norm(x - xmean, 2);
+            traces.col(k) = (x - xmean) / normxm;
+        }
+
+        const size_t numTasks = std::min(std::max(inNumThreads, size_t(1)), inOutOverlaps.size());
+        if (numTasks < 2)
+        {
+            correlateOverlapRange(traces, 0, inOutOverlaps.size(), inOutOverlaps);
+            return;
+        }
+
+        std::shared_ptr<TaskScheduler> scheduler = getTaskScheduler(inScheduler, inNumThreads);
+        std::vector<std::future<void>> results(numTasks);
+        for (size_t idx = 0; idx < numTasks; ++idx)
+        {
+            results[idx] = scheduler->enqueue(
+                correlateOverlapRange,
+                std::cref(traces),
+                idx * inOutOverlaps.size() / numTasks,
+                (idx + 1) * inOutOverlaps.size() / numTasks,
+                std::ref(inOutOverlaps));
+        }
+        scheduler->waitAll(results);
+    }
+
+    void groupComponentsToMerge(
+        const std::vector<ComponentOverlap> & inOverlaps,
+        const size_t inNumComponents,
+        const float inCorrThresh,
+        MergeGroups & outGroups)
+    {
+        // components are joined along overlapping pairs with correlated activity
+        std::vector<arma::uword> parents(inNumComponents);
+        for (arma::uword k = 0; k < inNumComponents; ++k)
+        {
+            parents[k] = k;
+        }
+        for (const ComponentOverlap & overlap : inOverlaps)
+        {
+            if (overlap.m_positive && overlap.m_corr > inCorrThresh)
+            {
+                uniteSets(parents, overlap.m_first, overlap.m_second);
+            }
+        }
+
+        // number of members of each set, stored at its root
+        std::vector<arma::uword> roots(inNumComponents);
+        std::vector<size_t> sizes(inNumComponents, 0);
+        for (arma::uword k = 0; k < inNumComponents; ++k)
+        {
+            roots[k] = findRoot(parents, k);
+            ++sizes[roots[k]];
+        }
+
+        // sets of several components become groups, in order of their smallest member
+        const size_t noGroup = std::numeric_limits<size_t>::max();
+        std::vector<size_t> groupOfRoot(inNumComponents, noGroup);
+        outGroups.m_offsets.assign(1, 0);
+        for (arma::uword k = 0; k < inNumComponents; ++k)
+        {
+            if (roots[k] == k && sizes[k] > 1)
+            {
+                groupOfRoot[k] = outGroups.m_offsets.size() - 1;
+                outGroups.m_offsets.push_back(outGroups.m_offsets.back() + sizes[k]);
+            }
+        }
+
+        const size_t numGroups = outGroups.m_offsets.size() - 1;
+        outGroups.m_members.resize(outGroups.m_offsets.back());
+        std::vector<size_t> next(outGroups.m_offsets.begin(), outGroups.m_offsets.end() - 1);
+        for (arma::uword k = 0; k < inNumComponents; ++k)
+        {
+            const size_t group = groupOfRoot[roots[k]];
+            if (group != noGroup)
+            {
+                outGroups.m_members[next[group]++] = k;
+            }
+        }
+
+        // pairs are visited in order of first then second component, i.e. in order of members within a group
+        outGroups.m_scores.assign(numGroups, 0.0f);
+        for (const ComponentOverlap & overlap : inOverlaps)
+        {
+            const arma::uword root = roots[overlap.m_first];
+            if (root == roots[overlap.m_second] && groupOfRoot[root] != noGroup)
+            {
+                outGroups.m_scores[groupOfRoot[root]] += overlap.m_corr;
             }
         }
-        connectedComponents = arma::conv_to<arma::uvec>::from(labels);
     }
 
     // Helper function to merge set of correlated components
@@ -117,65 +407,39 @@ namespace isx
         MatrixFloat_t & inOutA,
         MatrixFloat_t & inOutC,
         MatrixFloat_t & inOutRawC,
+        const size_t inNumRows,
+        const size_t inNumCols,
         const float inCorrThresh,
         DeconvolutionParams inDeconvParams,
-        const size_t inNumThreads)
+        const size_t inNumThreads,
+        std::vector<size_t> * outSources,
+        TaskScheduler * inScheduler)
     {
         const size_t K = inOutA.n_cols;  // number of cells
         const size_t d = inOutA.n_rows;  // number of pixels
         const size_t T = inOutC.n_cols;  // number of time points
 
-        MatrixFloat_t Acorr = arma::trimatu(inOutA.t() * inOutA);
-        Acorr.diag(0) = arma::zeros<ColumnFloat_t>(K);
-
-        arma::umat ff2 = Acorr > 0.0f;
-        MatrixFloat_t Ccorr = arma::zeros<MatrixFloat_t>(arma::size(Acorr));
-
         // Check correlation of calcium traces for all overlapping components
-        for (size_t i = 0; i < K; ++i)
-        {
-            arma::uvec indices = arma::find(Acorr(arma::span(i), arma::span::all));
-            for (size_t j = 0; j < indices.n_elem; ++j)
-            {
-                Ccorr(i, indices(j)) = pearsonr(inOutC.row(i).t(), inOutC.row(indices(j)).t());
-            }
-        }
-
-        arma::umat ff1 = (Ccorr + Ccorr.t()) > inCorrThresh;
-        arma::umat ff3 = ff1 % ff2;
+        std::vector<ComponentOverlap> overlaps;
+        findOverlappingComponents(inOutA, inNumRows, inNumCols, overlaps);
+        correlateOverlappingComponents(inOutC, overlaps, inNumThreads, inScheduler);
 
-        // Extract connected components
-        uint32_t numComponents;
-        arma::uvec connComponents;
-        connectedComponents(ff3, numComponents, connComponents);
+        // Groups of overlapping components with correlated activity
+        MergeGroups groups;
+        groupComponentsToMerge(overlaps, K, inCorrThresh, groups);
 
-        arma::umat listConxcomp(K, 0);
-        for (uint32_t idx = 0; idx < numComponents; ++idx)
+        if (groups.m_scores.empty())
         {
-            if (arma::accu(connComponents == idx) > 1)
+            ISX_LOG_INFO("No more components to merge");
+            if (outSources != nullptr)
             {
-                listConxcomp.insert_cols(listConxcomp.n_cols, (connComponents == idx));
+                outSources->resize(K);
+                std::iota(outSources->begin(), outSources->end(), size_t(0));
             }
-        }
-
-        if (listConxcomp.n_elem == 0)
-        {
-            ISX_LOG_INFO("No more components to merge");
             return false;
         }
 
-        ColumnFloat_t cor = arma::zeros<ColumnFloat_t>(listConxcomp.n_cols);
-        for (size_t idx = 0; idx < cor.n_elem; ++idx)
-        {
-            arma::uvec fm = arma::find(listConxcomp.col(idx));
-            for (size_t jdx1 = 0; jdx1 < fm.n_elem; ++jdx1)
-            {
-                for (size_t jdx2 = jdx1 + 1; jdx2 < fm.n_elem; ++jdx2)
-                {
-                    cor(idx) = cor(idx) + Ccorr(fm(jdx1), fm(jdx2));
-                }
-            }
-        }
+        const ColumnFloat_t cor(groups.m_scores);
 
         // Order to perform merges, based on correlation values
         const arma::uvec ind = cor.n_elem > 1 ? arma::reverse(arma::sort_index(cor)) : arma::uvec({0});
@@ -195,7 +459,7 @@ namespace isx
             // Merge components sequentially
             for (size_t idx = 0; idx < nbmrg; ++idx)
             {
-                arma::uvec mergedRoi = arma::find(listConxcomp.col(ind(idx)));
+                const arma::uvec mergedRoi = groups.getMembers(ind(idx));
                 mergedComponents = arma::join_cols(mergedComponents, mergedRoi);
 
                 ColumnFloat_t outCaTrace, outSpikes, outA, outYrA;
@@ -214,7 +478,7 @@ namespace isx
         else
         {
             // Merge components in parallel
-            ThreadPool pool(inNumThreads);
+            std::shared_ptr<TaskScheduler> scheduler = getTaskScheduler(inScheduler, inNumThreads);
 
             std::vector<ColumnFloat_t> outCaTrace(nbmrg);
             std::vector<ColumnFloat_t> outSpikes(nbmrg);
@@ -231,10 +495,11 @@ namespace isx
             std::vector<std::future<void>> results(nbmrg);
             for (size_t idx = 0; idx < nbmrg; ++idx)
             {
-                mergedRoi[idx] = arma::find(listConxcomp.col(ind(idx)));
+                mergedRoi[idx] = groups.getMembers(ind(idx));
                 mergedComponents = arma::join_cols(mergedComponents, mergedRoi[idx]);
 
-                results[idx] = pool.enqueue(
+                results[idx] = scheduler->enqueueWithHint(
+                    mergedRoi[idx].n_elem,
                     mergeIteration,
                     std::cref(inOutA),
                     std::cref(inOutC),
@@ -251,9 +516,9 @@ namespace isx
                 );
             }
 
+            scheduler->waitAll(results);
             for (size_t idx = 0; idx < nbmrg; ++idx)
             {
-                results[idx].get();
                 mergedA.col(idx) = outA[idx];
                 mergedC.col(idx) = outCaTrace[idx];
                 mergedRawC.col(idx) = outYrA[idx] + outCaTrace[idx];
@@ -273,6 +538,25 @@ namespace isx
             inOutRawC = arma::join_cols(inOutRawC, mergedRawC.t());
         }
 
+        if (outSources != nullptr)
+        {
+            std::vector<bool> merged(K, false);
+            for (const arma::uword k : mergedComponents)
+            {
+                merged[k] = true;
+            }
+
+            outSources->clear();
+            for (size_t k = 0; k < K; ++k)
+            {
+                if (!merged[k])
+                {
+                    outSources->push_back(k);
+                }
+            }
+            outSources->resize(outSources->size() + nbmrg, std::numeric_limits<size_t>::max());
+        }
+
         return true;
     }
 } // namespace isx
@@ -3,6 +3,9 @@
 
 #include "isxArmaUtils.h"
 #include "isxCnmfeDeconv.h"
+#include "isxTaskScheduler.h"
+
+#include <vector>
 
 namespace isx
 {
@@ -22,7 +25,8 @@ namespace isx
         return std::max(std::min(arma::dot((X - xmean) / normxm, (Y - ymean) / normym ), 1.0f), -1.0f);
     }
 
-    /// Depth-First-Search traversal to find connected components in undirected graph
+    /// Finds connected components in undirected graph by joining the vertices of each edge (union-find)
+    /// Components are numbered in order of their smallest vertex
     ///
     /// \param graph                    Adjacency matrix (input)
     /// \param numComponents            Number of connected components (output)
@@ -32,22 +36,108 @@ namespace isx
         uint32_t & numComponents,
         arma::uvec & connectedComponents);
 
+    /// Pair of components whose spatial footprints share at least one pixel
+    struct ComponentOverlap
+    {
+        /// Index of the first component of the pair
+        arma::uword m_first;
+
+        /// Index of the second component of the pair (greater than the first)
+        arma::uword m_second;
+
+        /// True if the inner product of the footprints is positive
+        bool m_positive;
+
+        /// Pearson correlation coefficient of the temporal components
+        float m_corr;
+    };
+
+    /// Finds the pairs of components with a non-zero inner product of their spatial footprints
+    /// Footprints are bucketed on a grid by their bounding boxes and only components with intersecting
+    /// boxes are compared, so no K x K matrix is formed.
+    ///
+    /// \param inA          Matrix of spatial components (d x K), footprints vectorised column by column
+    /// \param inNumRows    Number of rows of the field of view
+    /// \param inNumCols    Number of columns of the field of view
+    /// \param outOverlaps  Overlapping pairs sorted by first then second component, correlations are left at 0
+    void findOverlappingComponents(
+        const MatrixFloat_t & inA,
+        const size_t inNumRows,
+        const size_t inNumCols,
+        std::vector<ComponentOverlap> & outOverlaps);
+
+    /// Computes the correlation of the temporal components of pairs of components
+    /// Traces are centered and normalized once, the correlation of a pair is then the inner product of its traces.
+    ///
+    /// \param inC              Matrix of temporal components (K x T)
+    /// \param inOutOverlaps    Pairs of components, the correlation of each pair is set
+    /// \param inNumThreads     Number of threads
+    /// \param inScheduler      Scheduler shared by the stages of a run (nullptr to create one with inNumThreads workers)
+    void correlateOverlappingComponents(
+        const MatrixFloat_t & inC,
+        std::vector<ComponentOverlap> & inOutOverlaps,
+        const size_t inNumThreads = 1,
+        TaskScheduler * inScheduler = nullptr);
+
+    /// Groups of components to merge, stored as flat lists of member indices
+    struct MergeGroups
+    {
+        /// Indices of the members of all groups, group after group, in increasing order within a group
+        std::vector<arma::uword> m_members;
+
+        /// Members of group g are m_members[m_offsets[g]] to m_members[m_offsets[g + 1] - 1]
+        std::vector<size_t> m_offsets;
+
+        /// Sum of the correlations of the overlapping pairs of components within each group
+        std::vector<float> m_scores;
+
+        /// \param inGroup  Index of a group
+        /// \return         Indices of the members of the group
+        arma::uvec getMembers(const size_t inGroup) const
+        {
+            return arma::uvec(std::vector<arma::uword>(
+                m_members.begin() + m_offsets[inGroup], m_members.begin() + m_offsets[inGroup + 1]));
+        }
+    };
+
+    /// Groups the components connected by overlapping pairs with correlated activity
+    /// Groups are sets of at least two components, numbered in order of their smallest member.
+    ///
+    /// \param inOverlaps       Overlapping pairs with their correlations, sorted by first then second component
+    /// \param inNumComponents  Number of components
+    /// \param inCorrThresh     Correlation threshold for merging
+    /// \param outGroups        Groups of components to merge
+    void groupComponentsToMerge(
+        const std::vector<ComponentOverlap> & inOverlaps,
+        const size_t inNumComponents,
+        const float inCorrThresh,
+        MergeGroups & outGroups);
+
     /// Merges spatially overlapping components that have highly correlated temporal activity
     /// Returns true if some components were merged, false otherwise
     ///
     /// \param inOutA           Matrix of spatial components (d x K)
     /// \param inOutC           Matrix of temporal components (K x T)
     /// \param inOutRawC        Matrix of raw temporal components (K x T)
+    /// \param inNumRows        Number of rows of the field of view
+    /// \param inNumCols        Number of columns of the field of view
     /// \param inCorrThresh     Correlation threshold for merging
     /// \param inDeconvParams   Parameters for constrained foopsi parameter estimation
     /// \param inNumThreads     Number of worker threads to run merging with
+    /// \param outSources       If not null, previous index of each output component, std::numeric_limits<size_t>::max()
+    ///                         for merged components (remaining components keep their order, merged ones are appended)
+    /// \param inScheduler      Scheduler shared by the stages of a run (nullptr to create one with inNumThreads workers)
     bool mergeComponents(
         MatrixFloat_t & inOutA,
         MatrixFloat_t & inOutC,
         MatrixFloat_t & inOutRawC,
+        const size_t inNumRows,
+        const size_t inNumCols,
         const float inCorrThresh = 0.85f,
         DeconvolutionParams inDeconvParams = DeconvolutionParams(),
-        const size_t inNumThreads = 1
+        const size_t inNumThreads = 1,
+        std::vector<size_t> * outSources = nullptr,
+        TaskScheduler * inScheduler = nullptr
     );
 } // namespace isx
 
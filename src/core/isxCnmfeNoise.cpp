@@ -1,4 +1,9 @@
 #include "isxCnmfeNoise.h"
+#include "isxTaskScheduler.h"
+
+#include <opencv2/core/core.hpp>
+
+#include <algorithm>
 #include <cmath>
 
 namespace isx
@@ -58,19 +63,105 @@ namespace isx
         }
     }
 
-    void subsample(
-        const CubeFloat_t & inData,
-        CubeFloat_t & outData,
+    /// Indices of the frames kept when subsampling a movie along time
+    /// (beginning, middle and end of the movie)
+    static arma::uvec subsampleFrames(
+        const arma::uword inNumFrames,
         const uint32_t maxSamples)
     {
-        outData = arma::join_slices(
-            inData.subcube(arma::span::all, arma::span::all,arma::span(1,maxSamples/3)),
-            inData.subcube(arma::span::all, arma::span::all,arma::span(
-                (uint32_t)(inData.n_slices/2 - maxSamples/6.0f),
-                (uint32_t)(inData.n_slices/2 + maxSamples/6.0f - 1))));
-
-        outData = arma::join_slices(outData,inData.subcube(arma::span::all, arma::span::all,
-                arma::span(inData.n_slices - maxSamples/3 - 1, inData.n_slices - 1)));
+        arma::uvec frames = arma::join_cols(
+            arma::regspace<arma::uvec>(1, maxSamples/3),
+            arma::regspace<arma::uvec>(
+                (uint32_t)(inNumFrames/2 - maxSamples/6.0f),
+                (uint32_t)(inNumFrames/2 + maxSamples/6.0f - 1)));
+
+        return arma::join_cols(frames, arma::regspace<arma::uvec>(inNumFrames - maxSamples/3 - 1, inNumFrames - 1));
+    }
+
+    /// Computes the power spectral density of each signal at the given frequencies
+    /// Signals are transformed with batched real-to-complex FFTs, so only half of the spectrum is computed
+    ///
+    /// \param inSignals        Signals, one per row (CV_32F)
+    /// \param inInd            Indices of the frequencies, at most half the signal length
+    /// \param outPSD           PSD of each signal, one per column (number of frequencies x number of signals)
+    static void inBandPSD(
+        const cv::Mat & inSignals,
+        const arma::uvec & inInd,
+        MatrixFloat_t & outPSD)
+    {
+        cv::Mat spectrum;
+        cv::dft(inSignals, spectrum, cv::DFT_ROWS);
+
+        // spectrum of each row is packed as Re(0), Re(1), Im(1), Re(2), Im(2), ..., and ends with Re(N/2) for even lengths
+        const size_t N = static_cast<size_t>(inSignals.cols);
+        const float scale = 2 * 1.0f/N;
+        outPSD.set_size(inInd.n_elem, static_cast<size_t>(inSignals.rows));
+        for (int row = 0; row < inSignals.rows; ++row)
+        {
+            const float * packed = spectrum.ptr<float>(row);
+            float * psd = outPSD.colptr(row);
+            for (size_t i = 0; i < inInd.n_elem; ++i)
+            {
+                const size_t k = inInd(i);
+                float re, im;
+                if (k == 0)
+                {
+                    re = packed[0];
+                    im = 0.0f;
+                }
+                else if (2 * k == N)
+                {
+                    re = packed[N - 1];
+                    im = 0.0f;
+                }
+                else
+                {
+                    re = packed[2 * k - 1];
+                    im = packed[2 * k];
+                }
+                psd[i] = scale * (re * re + im * im);
+            }
+        }
+    }
+
+    /// Estimates the noise level of a block of pixels
+    ///
+    /// \param inData          Cube of movie data (h x w x t)
+    /// \param inFrames        Frames used for the FFT
+    /// \param inInd           Indices of the frequencies within the noise range
+    /// \param inRange         Range of pixel indices to process [start, end)
+    /// \param inNoiseMethod   Method for averaging the noise
+    /// \param outNoise        Noise level for each pixel
+    static void getNoiseFftBlock(
+        const CubeFloat_t & inData,
+        const arma::uvec & inFrames,
+        const arma::uvec & inInd,
+        const std::pair<size_t, size_t> & inRange,
+        const AveragingMethod_t inNoiseMethod,
+        MatrixFloat_t & outNoise)
+    {
+        const size_t numPixels = inRange.second - inRange.first;
+        const size_t frameSize = inData.n_rows * inData.n_cols;
+
+        // gather the time series of the block of pixels, one per row
+        cv::Mat signals(static_cast<int>(numPixels), static_cast<int>(inFrames.n_elem), CV_32F);
+        for (size_t j = 0; j < inFrames.n_elem; ++j)
+        {
+            const float * frame = inData.memptr() + inFrames(j) * frameSize + inRange.first;
+            for (size_t px = 0; px < numPixels; ++px)
+            {
+                signals.at<float>(static_cast<int>(px), static_cast<int>(j)) = frame[px];
+            }
+        }
+
+        MatrixFloat_t psd;
+        inBandPSD(signals, inInd, psd);
+
+        for (size_t px = 0; px < numPixels; ++px)
+        {
+            const ColumnFloat_t psdx(psd.colptr(px), psd.n_rows, false, true);
+            outNoise(inRange.first + px) = averagePSD(psdx, inNoiseMethod);
+        }
     }
 
     void subsample(
@@ -86,55 +177,111 @@ namespace isx
             inData.size() -1)));
     }
 
-    void getNoiseFft(
-        const CubeFloat_t & inData,
-        MatrixFloat_t & outNoise,
-        const std::pair<float,float> noiseRange,
-        const AveragingMethod_t noiseMethod,
+    /// Indices of the frequencies within the noise range for signals of a given length
+    static arma::uvec noiseBandIndices(
+        const size_t inNumSamples,
+        const std::pair<float,float> & inNoiseRange)
+    {
+        ColumnFloat_t ff = arma::regspace<ColumnFloat_t>(0, 1.0f/inNumSamples, 0.5f);
+        return arma::find((ff > inNoiseRange.first) && (ff <= inNoiseRange.second));
+    }
+
+    arma::uvec getNoiseFftFrames(
+        const size_t inNumFrames,
         const uint32_t maxSamplesFft)
     {
-        CubeFloat_t data;
-        if (inData.n_slices > maxSamplesFft)
+        if (inNumFrames > maxSamplesFft)
         {
-            subsample(inData, data, maxSamplesFft);
+            return subsampleFrames(inNumFrames, maxSamplesFft);
         }
-        else if (inData.n_slices > 2048)
+        else if (inNumFrames > 2048)
         {
-            subsample(inData, data, 2048);
+            return subsampleFrames(inNumFrames, 2048);
         }
-        else if (inData.n_slices > 1024)
+        else if (inNumFrames > 1024)
         {
-            subsample(inData, data, 1024);
+            return subsampleFrames(inNumFrames, 1024);
         }
-        else
+        return arma::regspace<arma::uvec>(0, inNumFrames - 1);
+    }
+
+    void getNoiseFftFromSamples(
+        const MatrixFloat_t & inSamples,
+        RowFloat_t & outNoise,
+        const std::pair<float,float> noiseRange,
+        const AveragingMethod_t noiseMethod)
+    {
+        const arma::uvec ind = noiseBandIndices(inSamples.n_rows, noiseRange);
+
+        // each column of the samples is contiguous and becomes a row of the OpenCV matrix
+        const cv::Mat signals(
+            static_cast<int>(inSamples.n_cols),
+            static_cast<int>(inSamples.n_rows),
+            CV_32F,
+            const_cast<float *>(inSamples.memptr()));
+
+        MatrixFloat_t psd;
+        inBandPSD(signals, ind, psd);
+
+        outNoise.set_size(inSamples.n_cols);
+        for (size_t px = 0; px < inSamples.n_cols; ++px)
         {
-            data = inData;
+            const ColumnFloat_t psdx(psd.colptr(px), psd.n_rows, false, true);
+            outNoise(px) = averagePSD(psdx, noiseMethod);
         }
+    }
+
+    void getNoiseFft(
+        const CubeFloat_t & inData,
+        MatrixFloat_t & outNoise,
+        const std::pair<float,float> noiseRange,
+        const AveragingMethod_t noiseMethod,
+        const uint32_t maxSamplesFft,
+        const size_t inNumThreads,
+        TaskScheduler * inScheduler)
+    {
+        // frames are selected in place rather than copying a subsampled movie
+        const arma::uvec frames = getNoiseFftFrames(inData.n_slices, maxSamplesFft);
+        const arma::uvec ind = noiseBandIndices(frames.n_elem, noiseRange);
 
-        // list of indices within desired frequency range
-        ColumnFloat_t ff = arma::regspace<ColumnFloat_t>(0, 1.0f/data.n_slices, 0.5f);
-        arma::uvec ind = arma::find((ff > noiseRange.first) && (ff <= noiseRange.second));
+        // Pixels are processed in blocks whose time series fit in cache, only the in-band PSD of a block is kept
+        const size_t numPixels = inData.n_rows * inData.n_cols;
+        const size_t blockBytes = 256 * 1024;
+        const size_t pixelsPerBlock = std::max<size_t>(1, blockBytes / (sizeof(float) * frames.n_elem));
+        const size_t nBlocks = (numPixels + pixelsPerBlock - 1) / pixelsPerBlock;
 
-        // compute fft on input cube
-        arma::cx_fcube xdft(data.n_rows, data.n_cols, data.n_slices);
-        for (size_t colIndex = 0; colIndex < data.n_cols; ++colIndex)
+        outNoise.set_size(inData.n_rows, inData.n_cols);
+        std::vector<std::pair<size_t, size_t>> ranges(nBlocks);
+        for (size_t idx = 0; idx < nBlocks; ++idx)
         {
-            for (size_t rowIndex = 0; rowIndex < data.n_rows; ++rowIndex)
+            ranges[idx].first = idx * pixelsPerBlock;
+            ranges[idx].second = std::min(numPixels, (idx + 1) * pixelsPerBlock);
+        }
+
+        if (inNumThreads < 2 || nBlocks < 2)
+        {
+            for (size_t idx = 0; idx < nBlocks; ++idx)
             {
-                ColumnFloat_t vec = data.subcube(arma::span(rowIndex), arma::span(colIndex), arma::span::all);
-                xdft(arma::span(rowIndex), arma::span(colIndex), arma::span::all) = arma::fft(vec);
+                getNoiseFftBlock(inData, frames, ind, ranges[idx], noiseMethod, outNoise);
             }
+            return;
         }
 
-        arma::cx_fcube psdx_cx(data.n_rows, data.n_cols, ind.size());
-        for (size_t i = 0; i < ind.size(); ++i)
+        std::shared_ptr<TaskScheduler> scheduler = getTaskScheduler(inScheduler, inNumThreads);
+        std::vector<std::future<void>> results(nBlocks);
+        for (size_t idx = 0; idx < nBlocks; ++idx)
         {
-            psdx_cx.slice(i) = xdft.subcube(arma::span::all, arma::span::all, arma::span(ind.at(i)));
+            results[idx] = scheduler->enqueue(
+                getNoiseFftBlock,
+                std::cref(inData),
+                std::cref(frames),
+                std::cref(ind),
+                std::cref(ranges[idx]),
+                noiseMethod,
+                std::ref(outNoise));
         }
 
-        // compute pixel noise by averaging psd
-        CubeFloat_t psdx(2 * 1.0f/data.n_slices * arma::square(arma::abs(psdx_cx)));
-        averagePSD(psdx, outNoise, noiseMethod);
+        scheduler->waitAll(results);
     }
 
     float getNoiseFft(
@@ -161,14 +308,12 @@ namespace isx
             data = inData;
         }
 
-        ColumnFloat_t ff = arma::regspace<ColumnFloat_t>(0, 1.0f/data.size(), 0.5f);
-        arma::uvec ind = arma::find((ff > noiseRange.first) && (ff <= noiseRange.second));
-
-        arma::cx_fvec fftVec = arma::fft(data);
-        fftVec = fftVec.elem(ind);
+        const arma::uvec ind = noiseBandIndices(data.n_elem, noiseRange);
 
-        ColumnFloat_t psdx(2 * 1.0f/data.size() * arma::square(arma::abs(fftVec)));
+        const cv::Mat signal(1, static_cast<int>(data.n_elem), CV_32F, data.memptr());
+        MatrixFloat_t psdx;
+        inBandPSD(signal, ind, psdx);
 
-        return averagePSD(psdx, noiseMethod);
+        return averagePSD(ColumnFloat_t(psdx.memptr(), psdx.n_elem, false, true), noiseMethod);
     }
 }
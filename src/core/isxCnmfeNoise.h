@@ -2,6 +2,7 @@
 #define ISX_CNMFE_NOISE_H
 
 #include "isxArmaUtils.h"
+#include "isxTaskScheduler.h"
 
 namespace isx
 {
@@ -39,13 +40,40 @@ namespace isx
     /// \param noiseRange      Range of frequencies over which power spectrum is averaged
     /// \param noiseMethod     Method for averaging the noise
     /// \param maxSamplesFft   Maximum number of samples to use in FFT
+    /// \param inNumThreads    Number of threads used to process blocks of pixels in parallel
+    /// \param inScheduler     Scheduler shared by the stages of a run (nullptr to create one with inNumThreads workers)
     void getNoiseFft(
         const CubeFloat_t & inData,
         MatrixFloat_t & outNoise,
         const std::pair<float,float> noiseRange = {0.25f, 0.5f},
         const AveragingMethod_t noiseMethod = AveragingMethod_t::LOGMEXP,
+        const uint32_t maxSamplesFft = 4096,
+        const size_t inNumThreads = 1,
+        TaskScheduler * inScheduler = nullptr);
+
+    /// Returns the frames used by getNoiseFft(...) to estimate the noise of a movie
+    /// Long movies are subsampled at their beginning, middle and end
+    ///
+    /// \param inNumFrames     Number of frames in the movie
+    /// \param maxSamplesFft   Maximum number of samples to use in FFT
+    /// \return                Indices of the frames used in the FFT
+    arma::uvec getNoiseFftFrames(
+        const size_t inNumFrames,
         const uint32_t maxSamplesFft = 4096);
 
+    /// Estimates noise level of pixels from their values at the frames returned by getNoiseFftFrames(...)
+    /// Allows the noise to be estimated from samples gathered while streaming a movie
+    ///
+    /// \param inSamples       Pixel values, one pixel per column (number of samples x number of pixels)
+    /// \param outNoise        Noise level for each pixel
+    /// \param noiseRange      Range of frequencies over which power spectrum is averaged
+    /// \param noiseMethod     Method for averaging the noise
+    void getNoiseFftFromSamples(
+        const MatrixFloat_t & inSamples,
+        RowFloat_t & outNoise,
+        const std::pair<float,float> noiseRange = {0.25f, 0.5f},
+        const AveragingMethod_t noiseMethod = AveragingMethod_t::LOGMEXP);
+
     /// Estimates noise level for given pixel by averaging the power spectral density using FFT
     ///
     /// \param inData          Column of pixel values over time
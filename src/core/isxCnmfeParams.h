@@ -34,6 +34,13 @@ namespace isx
         OASIS = 0 // Online active set optimization problem solver
     };
 
+    /// Nonnegative Lasso problem solver for spatial components
+    enum SpatialSolver_t
+    {
+        LASSO_LARS = 0, // Least angle regression solved independently for each pixel
+        HALS            // Hierarchical alternating least squares (block coordinate descent) warm started from the previous footprints
+    };
+
     struct DeconvolutionParams
     {
         DeconvolutionParams()
@@ -109,16 +116,19 @@ namespace isx
         SpatialParams(
             const size_t bgSsub,
             const size_t pixelsPerProc,
-            const int32_t closingKSize)
+            const int32_t closingKSize,
+            const SpatialSolver_t solver = SpatialSolver_t::LASSO_LARS)
             : m_bgSsub(bgSsub)
             , m_pixelsPerProc(pixelsPerProc)
             , m_closingKSize(closingKSize)
+            , m_solver(solver)
         {
         }
 
         size_t  m_bgSsub = 2;           ///< Background spatial downsampling factor
         size_t  m_pixelsPerProc = 1000; ///< Number of pixels to process in parallel at once
         int32_t m_closingKSize = 0;     ///< Morphological closing kernel size (< 2 will be auto estimated)
+        SpatialSolver_t m_solver = SpatialSolver_t::LASSO_LARS; ///< Solver used for the spatial footprint regression
     };
 
     struct PatchParams
@@ -2,13 +2,14 @@
 #include "isxCnmfeCore.h"
 #include "isxCnmfeMerging.h"
 #include "isxCnmfeNoise.h"
+#include "isxCnmfeSummaryImages.h"
 #include "isxMemoryMappedFileUtils.h"
 #include "isxCnmfeUtils.h"
 #include "isxCnmfeParams.h"
 #include "isxUtilities.h"
 #include "isxLog.h"
 
-#include "ThreadPool.h"
+#include "isxTaskScheduler.h"
 
 namespace isx
 {
@@ -173,7 +174,8 @@ namespace isx
         const DeconvolutionParams inDeconvParams,
         const float mergeThresh,
         const size_t numThreadsOverride,
-        size_t numComponents)
+        size_t numComponents,
+        TaskScheduler * scheduler)
     {
         // merge results from all regions of interest
         outA = arma::zeros<CubeFloat_t>(numRows, numCols, numComponents);
@@ -202,7 +204,7 @@ namespace isx
             int mergingOperations = 5; // empirically chosen to prevent infinite merging loop
             bool compsMerged = true;
             while (compsMerged && mergingOperations > 0){
-                compsMerged = mergeComponents(matA, outC, outRawC, mergeThresh, inDeconvParams, numThreadsOverride);
+                compsMerged = mergeComponents(matA, outC, outRawC, numRows, numCols, mergeThresh, inDeconvParams, numThreadsOverride, nullptr, scheduler);
                 mergingOperations--;
             }
             outA = matrixToCubeByCol(matA, numRows, numCols);
@@ -224,7 +226,8 @@ namespace isx
         const size_t numIterations,
         const size_t numThreads,
         const CnmfeOutputType_t outputType,
-        const bool deconvolve)
+        const bool deconvolve,
+        TaskScheduler * scheduler)
     {
         ISX_LOG_INFO("Using ", cnmfeModeNameMap.at(inPatchParams.m_mode), " processing mode");
 
@@ -251,6 +254,13 @@ namespace isx
             inMovie,
             inMemoryMapPath);
 
+        // noise is estimated for the whole FOV in a single pass over the file and sliced for each patch
+        ISX_LOG_INFO("Estimating individual pixel noise");
+        MatrixFloat_t noise;
+        computeNoiseImage(
+            inMemoryMapPath, numRows, numCols, numFrames, dataType, noise,
+            inDeconvParams.m_noiseRange, inDeconvParams.m_noiseMethod, numThreads, size_t(1) << 30, scheduler);
+
         // border applied to whole FOV, therefore set to 0 for patches
         if (inPatchParams.m_mode == CnmfeMode_t::PATCH_PARALLEL || inPatchParams.m_mode == CnmfeMode_t::PATCH_SEQUENTIAL)
         {
@@ -268,17 +278,24 @@ namespace isx
         for (size_t patchId=0; patchId < numPatches; patchId++)
         {
             cnmfes[patchId] = Cnmfe(inDeconvParams, inInitParams, inSpatialParams, maxNumNeurons, ringSizeFactor,
-                                    mergeThresh, numIterations, numThreadsOverride, outputFinalTraces);
+                                    mergeThresh, numIterations, numThreadsOverride, outputFinalTraces, scheduler);
+            cnmfes[patchId].setNoise(noise(
+                arma::span(std::get<0>(patchCoordinates[patchId]), std::get<1>(patchCoordinates[patchId])),
+                arma::span(std::get<2>(patchCoordinates[patchId]), std::get<3>(patchCoordinates[patchId]))));
         }
 
         if (inPatchParams.m_mode == CnmfeMode_t::PATCH_PARALLEL)
         {
             // process regions of interest in parallel
-            ThreadPool pool(numThreads);
+            std::shared_ptr<TaskScheduler> patchScheduler = getTaskScheduler(scheduler, numThreads);
             std::vector<std::future<void>> results(numPatches);
             for (size_t patchId = 0; patchId < numPatches; ++patchId)
             {
-                results[patchId] = pool.enqueue(
+                // patches cut at the edges of the field of view are smaller, the cost hint spreads them across workers
+                const size_t patchPixels = (std::get<1>(patchCoordinates[patchId]) - std::get<0>(patchCoordinates[patchId]) + 1)
+                    * (std::get<3>(patchCoordinates[patchId]) - std::get<2>(patchCoordinates[patchId]) + 1);
+                results[patchId] = patchScheduler->enqueueWithHint(
+                    patchPixels,
                     patchCnmfeParallel,
                     std::ref(cnmfes[patchId]),
                     std::cref(patchCoordinates),
@@ -291,10 +308,7 @@ namespace isx
                     dataType);
             }
 
-            for (size_t patchId = 0; patchId < numPatches; ++patchId)
-            {
-                results[patchId].get();
-            }
+            patchScheduler->waitAll(results);
         }
         else
         {
@@ -322,7 +336,7 @@ namespace isx
         ISX_LOG_INFO("Merging patch results");
         mergePatchResults(
             outA, outTraces, numRows, numCols, numFrames, patchCoordinates, cnmfes,
-            inDeconvParams, mergeThresh, numThreads, numComponents);
+            inDeconvParams, mergeThresh, numThreads, numComponents, scheduler);
 
         MatrixFloat_t tmpC;
         removeEmptyComponents(outA, outTraces, tmpC);
@@ -338,7 +352,7 @@ namespace isx
             MatrixFloat_t outDeconvolvedTraces;
             MatrixFloat_t outS;
             ColumnFloat_t outSn;
-            deconvolveTraces(outTraces, outDeconvolvedTraces, outS, outSn, inDeconvParams);
+            deconvolveTraces(outTraces, outDeconvolvedTraces, outS, outSn, inDeconvParams, 1, numThreads, scheduler);
             outTraces = outDeconvolvedTraces;
         }
 
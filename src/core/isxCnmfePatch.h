@@ -2,6 +2,7 @@
 #define ISX_CNMFE_PATCH_H
 
 #include "isxCnmfeParams.h"
+#include "isxTaskScheduler.h"
 #include "isxTiffMovie.h"
 
 namespace isx
@@ -23,6 +24,7 @@ namespace isx
     /// \param numThreads           Number of threads to use when parallelization is possible
     /// \param outputType           Output type for spatial and temporal components
     /// \param deconvolve           If true final traces are deconvolved, otherwise raw traces are returned
+    /// \param scheduler            Scheduler shared by the stages of the run (nullptr to create one with numThreads workers when needed)
     void patchCnmfe(
         const SpTiffMovie_t & inMovie,
         const std::string inMemoryMapPath,
@@ -38,7 +40,8 @@ namespace isx
         const size_t numIterations,
         const size_t numThreads,
         const CnmfeOutputType_t traceOutputType = CnmfeOutputType_t::NON_NORMALIZED,
-        const bool deconvolve=false);
+        const bool deconvolve=false,
+        TaskScheduler * scheduler = nullptr);
 }
 
 #endif //ISX_CNMFE_PATCH_H
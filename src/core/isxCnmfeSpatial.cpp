@@ -4,7 +4,10 @@
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
-#include "ThreadPool.h"
+#include "isxTaskScheduler.h"
+
+#include <algorithm>
+#include <numeric>
 
 
 namespace isx
@@ -147,7 +150,31 @@ namespace isx
         img = arma::Mat<float>(reinterpret_cast<float*>(cvMat.data), cvMat.cols, cvMat.rows);
     }
 
-    void thresholdComponentsParallel(MatrixFloat_t & inOutA, const int32_t inCloseKSize)
+    static bool paddedBoundingBox(
+        const arma::uvec & inIndices,
+        const MatrixFloat_t & inA,
+        const arma::uword inPad,
+        arma::uword & outRowMin,
+        arma::uword & outColMin,
+        arma::uword & outRowMax,
+        arma::uword & outColMax)
+    {
+        if (inIndices.is_empty())
+        {
+            return false;
+        }
+
+        arma::umat indices = arma::ind2sub(arma::size(inA), inIndices);
+        const arma::uword rmin = indices.row(0).min();
+        const arma::uword cmin = indices.row(1).min();
+        outRowMin = rmin > inPad ? rmin - inPad : 0;
+        outColMin = cmin > inPad ? cmin - inPad : 0;
+        outRowMax = std::min(indices.row(0).max() + inPad, inA.n_rows - 1);
+        outColMax = std::min(indices.row(1).max() + inPad, inA.n_cols - 1);
+        return true;
+    }
+
+    static void thresholdComponentRoi(MatrixFloat_t & inOutA, const int32_t inCloseKSize)
     {
         // 1. Apply median filter with 3x3 kernel
         cv::Mat cvMat = armaToCvMat<float, float>(inOutA, false);
@@ -206,12 +233,48 @@ namespace isx
         inOutA.elem(arma::find(labeledArray != indm + 1)).zeros();
     }
 
-    void thresholdComponents(CubeFloat_t & inOutA, const int32_t inCloseKSize)
+    void thresholdComponentsParallel(MatrixFloat_t & inOutA, const int32_t inCloseKSize)
     {
+        // All steps only depend on a neighborhood of the footprint support, so they are applied
+        // to its bounding box padded by the median filter and closing kernel radius. Pixels
+        // beyond the padding are zero before and after each step, so the border handling of
+        // the filters gives the same result as on the full image for nonnegative footprints.
+        arma::uword rmin, cmin, rmax, cmax;
+        const arma::uword pad = static_cast<arma::uword>(std::max(inCloseKSize, 0) / 2 + 2);
+        if (!paddedBoundingBox(arma::find(inOutA), inOutA, pad, rmin, cmin, rmax, cmax))
+        {
+            return;
+        }
+
+        MatrixFloat_t roi = inOutA.submat(rmin, cmin, rmax, cmax);
+        thresholdComponentRoi(roi, inCloseKSize);
+        inOutA.submat(rmin, cmin, rmax, cmax) = roi;
+    }
+
+    void thresholdComponents(CubeFloat_t & inOutA, const int32_t inCloseKSize, const size_t inNumThreads, TaskScheduler * inScheduler)
+    {
+        if (inNumThreads < 2 || inOutA.n_slices < 2)
+        {
+            for (size_t idx = 0; idx < inOutA.n_slices; ++idx)
+            {
+                thresholdComponentsParallel(inOutA.slice(idx), inCloseKSize);
+            }
+            return;
+        }
+
+        // Components are independent and each task writes to its own slice
+        std::shared_ptr<TaskScheduler> scheduler = getTaskScheduler(inScheduler, inNumThreads);
+        std::vector<std::future<void>> results(inOutA.n_slices);
         for (size_t idx = 0; idx < inOutA.n_slices; ++idx)
         {
-            thresholdComponentsParallel(inOutA.slice(idx), inCloseKSize);
+            results[idx] = scheduler->enqueue(
+                thresholdComponentsParallel,
+                std::ref(inOutA.slice(idx)),
+                inCloseKSize
+            );
         }
+
+        scheduler->waitAll(results);
     }
 
     static void constructDilateParallel(const MatrixFloat_t & inA, arma::umat & outDistInd)
@@ -230,64 +293,403 @@ namespace isx
         outDistInd = cvToArmaMat<float, float>(cvMat) > 0;
     }
 
-    void determineSearchLocation(const CubeFloat_t & inA, arma::ucube & outDistInd)
+    static void constructDilateBox(const MatrixFloat_t & inA, arma::uvec & outOrigin, arma::umat & outRoiDistInd)
+    {
+        // The dilation kernel has radius 2, so pixels more than 2 pixels away from the positive
+        // pixels of the footprint are never searched. The padding of the bounding box is made of
+        // non-positive pixels, which makes the reflected border equivalent to the full image.
+        arma::uword rmin, cmin, rmax, cmax;
+        if (!paddedBoundingBox(arma::find(inA > 0), inA, 2, rmin, cmin, rmax, cmax))
+        {
+            outOrigin.zeros(2);
+            outRoiDistInd.reset();
+            return;
+        }
+
+        outOrigin = {rmin, cmin};
+        constructDilateParallel(inA.submat(rmin, cmin, rmax, cmax), outRoiDistInd);
+    }
+
+    static void constructDilateRoi(const MatrixFloat_t & inA, arma::umat & outDistInd)
+    {
+        outDistInd.zeros(arma::size(inA));
+
+        arma::uvec origin;
+        arma::umat roiDistInd;
+        constructDilateBox(inA, origin, roiDistInd);
+        if (!roiDistInd.is_empty())
+        {
+            outDistInd.submat(origin(0), origin(1), origin(0) + roiDistInd.n_rows - 1, origin(1) + roiDistInd.n_cols - 1) = roiDistInd;
+        }
+    }
+
+    void determineSearchLocation(const CubeFloat_t & inA, arma::ucube & outDistInd, const size_t inNumThreads, TaskScheduler * inScheduler)
     {
         outDistInd = arma::ucube(arma::size(inA));
+        if (inNumThreads < 2 || inA.n_slices < 2)
+        {
+            for (size_t idx = 0; idx < inA.n_slices; ++idx)
+            {
+                constructDilateRoi(inA.slice(idx), outDistInd.slice(idx));
+            }
+            return;
+        }
+
+        std::shared_ptr<TaskScheduler> scheduler = getTaskScheduler(inScheduler, inNumThreads);
+        std::vector<std::future<void>> results(inA.n_slices);
         for (size_t idx = 0; idx < inA.n_slices; ++idx)
         {
-            constructDilateParallel(inA.slice(idx), outDistInd.slice(idx));
+            results[idx] = scheduler->enqueue(
+                constructDilateRoi,
+                std::cref(inA.slice(idx)),
+                std::ref(outDistInd.slice(idx))
+            );
         }
+
+        scheduler->waitAll(results);
     }
 
-    void computeIndicator(const CubeFloat_t & inA, std::vector<arma::uvec> & outInd)
+    void computeIndicator(const CubeFloat_t & inA, PixelComponentIndex & outInd, const size_t inNumThreads, TaskScheduler * inScheduler)
     {
-        arma::ucube distIndicator;
-        determineSearchLocation(inA, distIndicator);
-        distIndicator.reshape(distIndicator.n_rows * distIndicator.n_cols, distIndicator.n_slices, 1);
-        arma::umat distIndicatorMat = distIndicator.slice(0);   // d x K
+        const size_t numComponents = inA.n_slices;
+        const size_t numPixels = inA.n_rows * inA.n_cols;
 
-        // Get indices of dilated components that show up at each pixel
-        for (size_t rowIdx = 0; rowIdx < distIndicatorMat.n_rows; ++rowIdx)
+        // Dilated support of each component within its bounding box
+        std::vector<arma::uvec> origins(numComponents);
+        std::vector<arma::umat> roiDistInds(numComponents);
+        if (inNumThreads < 2 || numComponents < 2)
         {
-            outInd.emplace_back(arma::find(distIndicator.row(rowIdx)));
+            for (size_t idx = 0; idx < numComponents; ++idx)
+            {
+                constructDilateBox(inA.slice(idx), origins[idx], roiDistInds[idx]);
+            }
         }
+        else
+        {
+            std::shared_ptr<TaskScheduler> scheduler = getTaskScheduler(inScheduler, inNumThreads);
+            std::vector<std::future<void>> results(numComponents);
+            for (size_t idx = 0; idx < numComponents; ++idx)
+            {
+                results[idx] = scheduler->enqueue(
+                    constructDilateBox,
+                    std::cref(inA.slice(idx)),
+                    std::ref(origins[idx]),
+                    std::ref(roiDistInds[idx])
+                );
+            }
+
+            scheduler->waitAll(results);
+        }
+
+        // Count the components searched at each pixel, then fill in the component indices.
+        // Components are visited in increasing order so indices are sorted within each pixel.
+        outInd.m_rowPtr.assign(numPixels + 1, 0);
+        for (size_t idx = 0; idx < numComponents; ++idx)
+        {
+            const arma::umat & roi = roiDistInds[idx];
+            for (size_t colIdx = 0; colIdx < roi.n_cols; ++colIdx)
+            {
+                for (size_t rowIdx = 0; rowIdx < roi.n_rows; ++rowIdx)
+                {
+                    if (roi(rowIdx, colIdx))
+                    {
+                        outInd.m_rowPtr[origins[idx](0) + rowIdx + (origins[idx](1) + colIdx) * inA.n_rows + 1]++;
+                    }
+                }
+            }
+        }
+
+        for (size_t pxIdx = 0; pxIdx < numPixels; ++pxIdx)
+        {
+            outInd.m_rowPtr[pxIdx + 1] += outInd.m_rowPtr[pxIdx];
+        }
+
+        outInd.m_compIds.set_size(outInd.m_rowPtr.back());
+        std::vector<size_t> cursor(outInd.m_rowPtr.begin(), outInd.m_rowPtr.end() - 1);
+        for (size_t idx = 0; idx < numComponents; ++idx)
+        {
+            const arma::umat & roi = roiDistInds[idx];
+            for (size_t colIdx = 0; colIdx < roi.n_cols; ++colIdx)
+            {
+                for (size_t rowIdx = 0; rowIdx < roi.n_rows; ++rowIdx)
+                {
+                    if (roi(rowIdx, colIdx))
+                    {
+                        const size_t pxIdx = origins[idx](0) + rowIdx + (origins[idx](1) + colIdx) * inA.n_rows;
+                        outInd.m_compIds(cursor[pxIdx]++) = idx;
+                    }
+                }
+            }
+        }
+    }
+
+    static bool isSameComponentSet(const PixelComponentIndex & inIndC, const size_t inPixelA, const size_t inPixelB)
+    {
+        const size_t numComponents = inIndC.getNumComponents(inPixelA);
+        return numComponents == inIndC.getNumComponents(inPixelB)
+            && std::equal(inIndC.getComponents(inPixelA), inIndC.getComponents(inPixelA) + numComponents, inIndC.getComponents(inPixelB));
+    }
+
+    static float maxCct(const PixelComponentIndex & inIndC, const size_t inPixel, const ColumnFloat_t & inCct)
+    {
+        float cctMax = 0.0f;
+        const arma::uword * components = inIndC.getComponents(inPixel);
+        for (size_t i = 0; i < inIndC.getNumComponents(inPixel); i++)
+        {
+            if (components[i] < inCct.n_elem)
+            {
+                cctMax = std::max(cctMax, inCct(components[i]));
+            }
+        }
+        return cctMax;
     }
 
     void regressionParallel(
             const CubeFloat_t & inY,
-            const MatrixFloat_t & inC,
+            const LassoLarsDesign & inDesign,
             const MatrixFloat_t & inNoise,
-            const std::vector<arma::uvec> & inIndC,
+            const PixelComponentIndex & inIndC,
             const std::pair<size_t, size_t> inPixelRange,
             const ColumnFloat_t & inCct,
             MatrixFloat_t & outA)
     {
-        outA = arma::zeros<MatrixFloat_t>(inPixelRange.second - inPixelRange.first, inC.n_rows);
-
+        const size_t numFrames = inDesign.m_x.n_rows;
+        outA = arma::zeros<MatrixFloat_t>(inPixelRange.second - inPixelRange.first, inDesign.m_x.n_cols);
+
+        // Pixels inside a footprint mostly share the same set of candidate components,
+        // so pixels are grouped by component set and the Gram matrix of the set is
+        // extracted once per group rather than once per pixel
+        std::vector<size_t> pixels;
+        pixels.reserve(inPixelRange.second - inPixelRange.first);
         for (size_t pxIdx = inPixelRange.first; pxIdx < inPixelRange.second; pxIdx++)
         {
-            arma::uvec pxCoord = {pxIdx % inY.n_rows, pxIdx / inY.n_rows};
-            RowFloat_t y = inY.subcube(arma::span(pxCoord(0)), arma::span(pxCoord(1)), arma::span::all);
-            MatrixFloat_t c = inC.rows(inIndC[pxIdx]).t();
+            if (inIndC.getNumComponents(pxIdx) > 0 && inNoise(pxIdx % inY.n_rows, pxIdx / inY.n_rows) > 0)
+            {
+                pixels.push_back(pxIdx);
+            }
+        }
 
-            ColumnFloat_t cctTmp;
-            if (inIndC[pxIdx].size() > 0)
+        std::stable_sort(pixels.begin(), pixels.end(), [&inIndC](const size_t inA, const size_t inB)
+        {
+            return std::lexicographical_compare(
+                inIndC.getComponents(inA), inIndC.getComponents(inA) + inIndC.getNumComponents(inA),
+                inIndC.getComponents(inB), inIndC.getComponents(inB) + inIndC.getNumComponents(inB));
+        });
+
+        size_t groupStart = 0;
+        while (groupStart < pixels.size())
+        {
+            size_t groupEnd = groupStart + 1;
+            while (groupEnd < pixels.size() && isSameComponentSet(inIndC, pixels[groupStart], pixels[groupEnd]))
             {
-                arma::uvec tmpInd = arma::find(inIndC[pxIdx] < inCct.size());
-                cctTmp = inCct.elem(inIndC[pxIdx].elem(tmpInd));
+                groupEnd++;
             }
 
-            if (c.n_cols > 0 && inNoise(pxCoord(0),pxCoord(1)) > 0)
+            const size_t firstPixel = pixels[groupStart];
+            const arma::uvec ind = inIndC.m_compIds.subvec(
+                inIndC.m_rowPtr[firstPixel], inIndC.m_rowPtr[firstPixel + 1] - 1);
+            const MatrixFloat_t gram = inDesign.m_gram.submat(ind, ind);
+            const float cctMax = maxCct(inIndC, firstPixel, inCct);
+
+            for (size_t groupIdx = groupStart; groupIdx < groupEnd; groupIdx++)
             {
-                float lambda = cctTmp.size() > 0 ? 0.5f * inNoise(pxCoord(0),pxCoord(1)) * sqrt(arma::max(cctTmp)) / inC.n_cols : 0.0f;
+                const size_t pxIdx = pixels[groupIdx];
+                arma::uvec pxCoord = {pxIdx % inY.n_rows, pxIdx / inY.n_rows};
+                RowFloat_t y = inY.subcube(arma::span(pxCoord(0)), arma::span(pxCoord(1)), arma::span::all);
+
+                float lambda = 0.5f * inNoise(pxCoord(0),pxCoord(1)) * sqrt(cctMax) / numFrames;
                 ColumnFloat_t beta;
-                isx::lassoLars(c, y, beta, lambda, true);
+                isx::lassoLars(inDesign, ind, gram, y, beta, lambda, true);
+
+                for (size_t i = 0; i < ind.size(); i++)
+                {
+                    outA(pxIdx-inPixelRange.first, ind(i)) = beta(i);
+                }
+            }
+
+            groupStart = groupEnd;
+        }
+    }
 
-                for (size_t i = 0; i < inIndC[pxIdx].size(); i++)
+    static void hierarchicalAlsParallel(
+        const MatrixFloat_t & inY,
+        const MatrixFloat_t & inCCentered,
+        const MatrixFloat_t & inGram,
+        const ColumnFloat_t & inCNorms,
+        const MatrixFloat_t & inNoise,
+        const PixelComponentIndex & inIndC,
+        const ColumnFloat_t & inCct,
+        const std::pair<size_t, size_t> inPixelRange,
+        const size_t inMaxIterations,
+        const float inTolerance,
+        MatrixFloat_t & inOutA)
+    {
+        // Pixels are independent problems over their own candidate components, so each batch keeps
+        // the coefficients of its candidates contiguously (in the order of inIndC) and never touches the rest
+        const size_t numRows = inNoise.n_rows;
+        std::vector<size_t> pixels;
+        std::vector<size_t> offsets(1, 0);
+        for (size_t pxIdx = inPixelRange.first; pxIdx < inPixelRange.second; pxIdx++)
+        {
+            if (inIndC.getNumComponents(pxIdx) > 0 && inNoise(pxIdx % numRows, pxIdx / numRows) > 0)
+            {
+                pixels.push_back(pxIdx);
+                offsets.push_back(offsets.back() + inIndC.getNumComponents(pxIdx));
+            }
+        }
+
+        const arma::span rows(inPixelRange.first, inPixelRange.second - 1);
+        if (pixels.empty())
+        {
+            inOutA.rows(rows).zeros();
+            return;
+        }
+
+        // Correlation of the pixels with the components is only needed at the candidates,
+        // the product is computed for the batch and only those entries are kept
+        const MatrixFloat_t yCt = inY.rows(rows) * inCCentered.t();
+
+        // a: coefficients, b: correlation with the component minus the penalty of the coefficient
+        std::vector<arma::uword> components(offsets.back());
+        std::vector<float> a(offsets.back());
+        std::vector<float> b(offsets.back());
+        for (size_t i = 0; i < pixels.size(); ++i)
+        {
+            const size_t pxIdx = pixels[i];
+            const float scale = 0.5f * inNoise(pxIdx % numRows, pxIdx / numRows) * sqrt(maxCct(inIndC, pxIdx, inCct));
+            std::copy(inIndC.getComponents(pxIdx), inIndC.getComponents(pxIdx) + inIndC.getNumComponents(pxIdx), components.begin() + offsets[i]);
+            for (size_t e = offsets[i]; e < offsets[i + 1]; ++e)
+            {
+                const size_t k = components[e];
+                a[e] = std::max(inOutA(pxIdx, k), 0.0f);
+                b[e] = yCt(pxIdx - inPixelRange.first, k) - scale * inCNorms(k);
+            }
+        }
+
+        for (size_t iter = 0; iter < inMaxIterations; ++iter)
+        {
+            float sqDelta = 0.0f;
+            float sqNorm = 0.0f;
+            for (size_t i = 0; i < pixels.size(); ++i)
+            {
+                for (size_t e = offsets[i]; e < offsets[i + 1]; ++e)
                 {
-                    outA(pxIdx-inPixelRange.first, inIndC[pxIdx](i)) = beta(i);
+                    const size_t k = components[e];
+                    const float gramKK = inGram(k, k);
+                    float aK = 0.0f;
+                    if (gramKK > 0.0f)
+                    {
+                        // Exact minimization over coefficient k with all other coefficients fixed, projected onto the nonnegative orthant
+                        float residual = b[e];
+                        for (size_t f = offsets[i]; f < offsets[i + 1]; ++f)
+                        {
+                            residual -= a[f] * inGram(components[f], k);
+                        }
+                        aK = std::max(a[e] + residual / gramKK, 0.0f);
+                    }
+
+                    sqDelta += (aK - a[e]) * (aK - a[e]);
+                    sqNorm += aK * aK;
+                    a[e] = aK;
                 }
             }
+
+            if (sqDelta <= inTolerance * inTolerance * sqNorm)
+            {
+                break;
+            }
+        }
+
+        inOutA.rows(rows).zeros();
+        for (size_t i = 0; i < pixels.size(); ++i)
+        {
+            for (size_t e = offsets[i]; e < offsets[i + 1]; ++e)
+            {
+                inOutA(pixels[i], components[e]) = a[e];
+            }
+        }
+    }
+
+    void hierarchicalAlsRegression(
+        const CubeFloat_t & inY,
+        const MatrixFloat_t & inC,
+        const MatrixFloat_t & inNoise,
+        const PixelComponentIndex & inIndC,
+        const ColumnFloat_t & inCct,
+        MatrixFloat_t & inOutA,
+        const size_t inPixelsPerProcess,
+        const size_t inNumThreads,
+        const size_t inMaxIterations,
+        const float inTolerance,
+        TaskScheduler * inScheduler)
+    {
+        const size_t numPixels = inY.n_rows * inY.n_cols;
+        const size_t numComponents = inC.n_rows;
+
+        // lassoLars centers the response and predictors of every pixel and rescales each predictor to unit norm.
+        // Solving for the original coefficients, this is a Lasso problem on the centered temporal components
+        // where the penalty of each component is scaled by its norm. Centering the response is not needed
+        // since it is orthogonal to the centered components.
+        MatrixFloat_t cCentered = inC;
+        cCentered.each_col() -= arma::mean(inC, 1);
+        const ColumnFloat_t cNorms = arma::sqrt(arma::sum(arma::square(cCentered), 1));
+        const MatrixFloat_t gram = cCentered * cCentered.t();
+
+        // matY points to the same memory as inY
+        const MatrixFloat_t matY(
+            const_cast<float*>(inY.memptr()),
+            numPixels,
+            inY.n_slices,
+            false,
+            true);
+
+        // The warm start is only read at the candidates of each pixel
+        if (inOutA.n_rows != numPixels || inOutA.n_cols != numComponents || !inOutA.is_finite())
+        {
+            inOutA.zeros(numPixels, numComponents);
+        }
+
+        // Batches write to disjoint rows of inOutA and bound the size of their correlation products
+        const size_t pixelsPerProcess = std::max<size_t>(1, inPixelsPerProcess);
+        size_t nBatches =  (numPixels / pixelsPerProcess) +  (numPixels % pixelsPerProcess != 0);
+        std::vector<std::pair<size_t, size_t>> ranges(nBatches);
+        for (size_t idx = 0; idx < nBatches; ++idx)
+        {
+            ranges[idx].first = idx * pixelsPerProcess;
+            ranges[idx].second = (idx == nBatches - 1) ? numPixels : idx * pixelsPerProcess + pixelsPerProcess;
+        }
+
+        if (inNumThreads < 2 || nBatches < 2)
+        {
+            for (size_t idx = 0; idx < nBatches; ++idx)
+            {
+                hierarchicalAlsParallel(matY, cCentered, gram, cNorms, inNoise, inIndC, inCct, ranges[idx], inMaxIterations, inTolerance, inOutA);
+            }
+        }
+        else
+        {
+            std::shared_ptr<TaskScheduler> scheduler = getTaskScheduler(inScheduler, inNumThreads);
+
+            std::vector<std::future<void>> results(nBatches);
+            for (size_t idx = 0; idx < nBatches; ++idx)
+            {
+                results[idx] = scheduler->enqueue(
+                    hierarchicalAlsParallel,
+                    std::cref(matY),
+                    std::cref(cCentered),
+                    std::cref(gram),
+                    std::cref(cNorms),
+                    std::cref(inNoise),
+                    std::cref(inIndC),
+                    std::cref(inCct),
+                    std::cref(ranges[idx]),
+                    inMaxIterations,
+                    inTolerance,
+                    std::ref(inOutA)
+                );
+            }
+
+            scheduler->waitAll(results);
         }
     }
 
@@ -298,10 +700,12 @@ namespace isx
         const MatrixFloat_t & inNoise,
         const int32_t inCloseKSize,
         const size_t inPixelsPerProcess,
-        const size_t inNumThreads)
+        const size_t inNumThreads,
+        const SpatialSolver_t inSolver,
+        TaskScheduler * inScheduler)
     {
-        std::vector<arma::uvec> ind2;
-        computeIndicator(inOutA, ind2);
+        PixelComponentIndex ind2;
+        computeIndicator(inOutA, ind2, inNumThreads, inScheduler);
 
         // Normalize C
         ColumnFloat_t quotient = (arma::sqrt(arma::sum(arma::square(inOutC), 1)) + std::numeric_limits<float>::epsilon());
@@ -310,49 +714,102 @@ namespace isx
             inOutC.col(colIdx) = inOutC.col(colIdx) / quotient;
         }
 
-        MatrixFloat_t cDot = (inOutC * inOutC.t());
-        ColumnFloat_t cct = cDot.diag();
+        ColumnFloat_t cct = arma::sum(arma::square(inOutC), 1);
 
-        MatrixFloat_t matA(inOutA.n_rows * inOutA.n_cols, inOutA.n_slices);
+        MatrixFloat_t matA(inOutA.n_rows * inOutA.n_cols, inOutA.n_slices, arma::fill::zeros);
         size_t numPixels = inY.n_rows * inY.n_cols;
-        if (inNumThreads < 2 || numPixels <= inPixelsPerProcess)
+        if (inSolver == SpatialSolver_t::HALS)
         {
-            // Run regression for each pixel sequentially when specified, or when there are fewer pixels than inPixelsPerProcess
-            regressionParallel(inY, inOutC, inNoise, ind2, {0, numPixels}, cct, matA);
+            // Warm start from the current footprints, rescaled to match the normalized temporal components
+            matA = cubeToMatrixBySlice(inOutA);
+            matA.each_row() %= quotient.t();
+            hierarchicalAlsRegression(inY, inOutC, inNoise, ind2, cct, matA, inPixelsPerProcess, inNumThreads, 100, 1e-5f, inScheduler);
         }
         else
         {
-            // Run regression on pixel batches in parallel
-            ThreadPool pool(inNumThreads);
-
-            size_t nBatches =  (numPixels / inPixelsPerProcess) +  (numPixels % inPixelsPerProcess != 0);
-            std::vector<MatrixFloat_t> outputAs(nBatches);
-            std::vector<std::pair<size_t, size_t>> ranges(nBatches);
+            // Centering, normalization and the Gram matrix only depend on C, so they are computed once for all pixels
+            LassoLarsDesign design;
+            prepareLassoLarsDesign(inOutC.t(), design);
+
+            // Batches are built by estimated work, the number of candidate components summed over pixels,
+            // rather than by pixel count since background pixels cost nothing and pixels in dense clusters
+            // cost the most. A batch holds at most inPixelsPerProcess pixels with candidates, and pixels
+            // without candidates in between batches are never dispatched.
+            size_t totalWork = 0;
+            for (size_t pxIdx = 0; pxIdx < numPixels; ++pxIdx)
+            {
+                totalWork += ind2.getNumComponents(pxIdx);
+            }
+            const size_t batchesPerThread = 8;
+            const size_t targetWork = std::max<size_t>(1, totalWork / (std::max<size_t>(1, inNumThreads) * batchesPerThread));
 
-            std::vector<std::future<void>> results(nBatches);
-            for (size_t idx = 0; idx < nBatches; ++idx)
+            std::vector<std::pair<size_t, size_t>> ranges;
+            std::vector<size_t> works;
+            size_t numBatchPixels = 0;
+            for (size_t pxIdx = 0; pxIdx < numPixels; ++pxIdx)
             {
-                ranges[idx].first = idx * inPixelsPerProcess;
-                ranges[idx].second = (idx == nBatches - 1) ? numPixels : idx * inPixelsPerProcess + inPixelsPerProcess;
+                const size_t work = ind2.getNumComponents(pxIdx);
+                if (work == 0)
+                {
+                    continue;
+                }
 
-                results[idx] = pool.enqueue(
-                    regressionParallel,
-                    std::cref(inY),
-                    std::cref(inOutC),
-                    std::cref(inNoise),
-                    std::cref(ind2),
-                    std::cref(ranges[idx]),
-                    std::cref(cct),
-                    std::ref(outputAs[idx])
-                );
+                if (numBatchPixels == 0)
+                {
+                    ranges.emplace_back(pxIdx, pxIdx + 1);
+                    works.push_back(0);
+                }
+                ranges.back().second = pxIdx + 1;
+                works.back() += work;
+
+                if (++numBatchPixels == inPixelsPerProcess || works.back() >= targetWork)
+                {
+                    numBatchPixels = 0;
+                }
             }
 
-            size_t cumNumRows = 0;
-            for (size_t idx = 0; idx < results.size(); ++idx)
+            if (inNumThreads < 2 || ranges.size() < 2)
             {
-                results[idx].get();
-                matA.rows(arma::span(cumNumRows, cumNumRows + outputAs[idx].n_rows - 1)) = outputAs[idx];
-                cumNumRows += outputAs[idx].n_rows;
+                // Run regression for each pixel sequentially when specified, or when all the work fits in a single batch
+                regressionParallel(inY, design, inNoise, ind2, {0, numPixels}, cct, matA);
+            }
+            else
+            {
+                // Run regression on pixel batches in parallel
+                std::shared_ptr<TaskScheduler> scheduler = getTaskScheduler(inScheduler, inNumThreads);
+
+                size_t nBatches = ranges.size();
+                std::vector<MatrixFloat_t> outputAs(nBatches);
+
+                // Heaviest batches are queued first so that threads finish on light batches
+                std::vector<size_t> order(nBatches);
+                std::iota(order.begin(), order.end(), 0);
+                std::stable_sort(order.begin(), order.end(), [&works](const size_t inA, const size_t inB)
+                {
+                    return works[inA] > works[inB];
+                });
+
+                std::vector<std::future<void>> results(nBatches);
+                for (size_t idx : order)
+                {
+                    results[idx] = scheduler->enqueueWithHint(
+                        works[idx],
+                        regressionParallel,
+                        std::cref(inY),
+                        std::cref(design),
+                        std::cref(inNoise),
+                        std::cref(ind2),
+                        std::cref(ranges[idx]),
+                        std::cref(cct),
+                        std::ref(outputAs[idx])
+                    );
+                }
+
+                scheduler->waitAll(results);
+                for (size_t idx = 0; idx < results.size(); ++idx)
+                {
+                    matA.rows(arma::span(ranges[idx].first, ranges[idx].second - 1)) = outputAs[idx];
+                }
             }
         }
 
@@ -362,6 +819,6 @@ namespace isx
             inOutA.slice(sliceIdx) = arma::reshape(matA.col(sliceIdx), inOutA.n_rows, inOutA.n_cols);
         }
 
-        thresholdComponents(inOutA, inCloseKSize);
+        thresholdComponents(inOutA, inCloseKSize, inNumThreads, inScheduler);
     }
 } // namespace isx
@@ -2,9 +2,35 @@
 #define ISX_CNMFE_SPATIAL_H
 
 #include "isxArmaUtils.h"
+#include "isxCnmfeParams.h"
+#include "isxCnmfeUtils.h"
+#include "isxTaskScheduler.h"
+
+#include <vector>
 
 namespace isx
 {
+    /// Compressed sparse row index of the components to be searched at each pixel
+    struct PixelComponentIndex
+    {
+        /// \param inPixel  Linear index of the pixel (column major)
+        /// \return         Number of components to be searched at the pixel
+        size_t getNumComponents(const size_t inPixel) const
+        {
+            return m_rowPtr[inPixel + 1] - m_rowPtr[inPixel];
+        }
+
+        /// \param inPixel  Linear index of the pixel (column major)
+        /// \return         Pointer to the first of the getNumComponents(inPixel) component indices of the pixel
+        const arma::uword * getComponents(const size_t inPixel) const
+        {
+            return m_compIds.memptr() + m_rowPtr[inPixel];
+        }
+
+        std::vector<size_t> m_rowPtr;   ///< Offset of the components of each pixel in m_compIds (number of pixels + 1 entries)
+        arma::uvec m_compIds;           ///< Components to be searched at all pixels, in increasing order within each pixel
+    };
+
     /// Applies circular constraints to input image
     ///
     /// \param img    Input image
@@ -27,6 +53,9 @@ namespace isx
     /// (iii) Morphological closing of spatial support
     /// (iv)  Extraction of largest connected component (to remove small unconnected pixels)
     ///
+    /// The steps are applied to the bounding box of the footprint padded by the filter sizes,
+    /// which is equivalent to applying them to the full image for nonnegative footprints.
+    ///
     /// \param inOutA           Matrix representing footprint of one component (d1 x d2)
     /// \param inCloseKSize     Filter size for morphological opening
     void thresholdComponentsParallel(
@@ -37,40 +66,79 @@ namespace isx
     ///
     /// \param inOutA           Cube containing all spatial components (d1 x d2 x K)
     /// \param inCloseKSize     Filter size for morphological opening
+    /// \param inNumThreads     Number of worker threads to process components with
+    /// \param inScheduler      Scheduler shared by the stages of a run (nullptr to create one with inNumThreads workers)
     void thresholdComponents(
         CubeFloat_t & inOutA,
-        int32_t inCloseKSize = 3);
+        int32_t inCloseKSize = 3,
+        const size_t inNumThreads = 1,
+        TaskScheduler * inScheduler = nullptr);
 
     /// Dilates each spatial component and returns boolean array showing where components should be searched
     ///
     /// \param inA          Input cube containing all spatial components (d1 x d2 x K)
     /// \param outDistInd   Output cube of binary values showing where components should be searched
-    void determineSearchLocation(const CubeFloat_t & inA, arma::ucube & outDistInd);
+    /// \param inNumThreads Number of worker threads to process components with
+    /// \param inScheduler  Scheduler shared by the stages of a run (nullptr to create one with inNumThreads workers)
+    void determineSearchLocation(const CubeFloat_t & inA, arma::ucube & outDistInd, const size_t inNumThreads = 1, TaskScheduler * inScheduler = nullptr);
 
-    /// Get indices of components that should be searched at each pixel
+    /// Get indices of components that should be searched at each pixel, built from the dilated
+    /// bounding box of each component without going through a full size indicator cube
     ///
     /// \param inA          Input cube containing all spatial components (d1 x d2 x K)
-    /// \param outDistInd   Output vector of vectors for each pixel indicating component indices to be searched
-    void computeIndicator(const CubeFloat_t & inA, std::vector<arma::uvec>& outInd);
+    /// \param outInd       Output index of the components to be searched at each pixel
+    /// \param inNumThreads Number of worker threads to process components with
+    /// \param inScheduler  Scheduler shared by the stages of a run (nullptr to create one with inNumThreads workers)
+    void computeIndicator(const CubeFloat_t & inA, PixelComponentIndex & outInd, const size_t inNumThreads = 1, TaskScheduler * inScheduler = nullptr);
 
     /// Updates spatial footprints using Basis Pursuit Denoising (designed for parallel processing)
     ///
     /// \param inY              Input movie (w x h x t)
-    /// \param inC              Temporal activity of neurons (n x t)
+    /// \param inDesign         Normalized temporal activity of neurons shared by all pixels (see prepareLassoLarsDesign on C^T)
     /// \param inNoise          Matrix containing noise at each pixel
-    /// \param inIndC           Vector of vectors for each pixel indicating component indices to be searched
+    /// \param inIndC           Index of the components to be searched at each pixel
     /// \param inPixelRange     Range of pixels to process
     /// \param inCct            Cross-correlation of temporal components
     /// \param outA             Output matrix containing spatial footprints for the input pixel group
     void regressionParallel(
         const CubeFloat_t & inY,
-        const MatrixFloat_t & inC,
+        const LassoLarsDesign & inDesign,
         const MatrixFloat_t & inNoise,
-        const std::vector<arma::uvec> & inIndC,
+        const PixelComponentIndex & inIndC,
         const std::pair<size_t, size_t> inPixelRange,
         const ColumnFloat_t & inCct,
         MatrixFloat_t & outA);
 
+    /// Updates spatial footprints of all pixels at once by solving the same nonnegative Lasso problem
+    /// as regressionParallel with hierarchical alternating least squares (block coordinate descent)
+    /// The correlation of each batch of pixels with the components is a single matrix product,
+    /// the coordinate updates are then scalar loops over the candidate components of each pixel.
+    ///
+    /// \param inY                  Input movie (d1 x d2 x T)
+    /// \param inC                  Temporal activity of neurons (K x T)
+    /// \param inNoise              Matrix containing noise at each pixel
+    /// \param inIndC               Index of the components to be searched at each pixel
+    /// \param inCct                Cross-correlation of temporal components
+    /// \param inOutA               Initial estimate of footprints used as a warm start (ignored if its size does not match),
+    ///                             replaced by the output footprints (d1*d2 x K), which are zero outside the candidates of inIndC
+    /// \param inPixelsPerProcess   Number of pixels per batch, batches are processed by separate threads (if using multithreading)
+    /// \param inNumThreads         Number of worker threads to run regression with
+    /// \param inMaxIterations      Maximum number of sweeps over all components
+    /// \param inTolerance          Convergence threshold on the relative change of the footprints between sweeps
+    /// \param inScheduler          Scheduler shared by the stages of a run (nullptr to create one with inNumThreads workers)
+    void hierarchicalAlsRegression(
+        const CubeFloat_t & inY,
+        const MatrixFloat_t & inC,
+        const MatrixFloat_t & inNoise,
+        const PixelComponentIndex & inIndC,
+        const ColumnFloat_t & inCct,
+        MatrixFloat_t & inOutA,
+        const size_t inPixelsPerProcess = 128,
+        const size_t inNumThreads = 1,
+        const size_t inMaxIterations = 100,
+        const float inTolerance = 1e-5f,
+        TaskScheduler * inScheduler = nullptr);
+
     /// Updates spatial footprints using Basis Pursuit Denoising
     ///
     /// \param inY                  Input movie (d1 x d2 x T)
@@ -79,6 +147,8 @@ namespace isx
     /// \param inNoise              Matrix containing noise at each pixel
     /// \param inPixelsPerProcess   Number of pixels to process per thread (if using multithreading)
     /// \param inNumThreads         Number of worker threads to run regression with
+    /// \param inSolver             Solver used for the regression of each pixel onto the temporal components
+    /// \param inScheduler          Scheduler shared by the stages of a run (nullptr to create one with inNumThreads workers)
     void updateSpatialComponents(
         const CubeFloat_t & inY,
         CubeFloat_t & inOutA,
@@ -86,7 +156,9 @@ namespace isx
         const MatrixFloat_t & inNoise,
         const int32_t inCloseKSize = 3,
         const size_t inPixelsPerProcess = 128,
-        const size_t inNumThreads = 1);
+        const size_t inNumThreads = 1,
+        const SpatialSolver_t inSolver = SpatialSolver_t::LASSO_LARS,
+        TaskScheduler * inScheduler = nullptr);
 } // namespace isx
 
 #endif //ISX_CNMFE_SPATIAL_H
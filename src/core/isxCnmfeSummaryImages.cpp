@@ -0,0 +1,400 @@
+#include "isxCnmfeSummaryImages.h"
+#include "isxTaskScheduler.h"
+#include "isxLog.h"
+
+#include "mio.hpp"
+
+#include <algorithm>
+#include <functional>
+
+namespace isx
+{
+namespace
+{
+    /// Number of frames streamed before the workers synchronize
+    const size_t s_framesPerBlock = 64;
+
+    /// Running sums of the pixels of a movie
+    struct SummaryAccumulator
+    {
+        arma::vec m_sum;
+        arma::vec m_sumSquares;
+        RowFloat_t m_max;
+
+        /// Sums of products with the neighbours below, right, below-right and above-right (4 x number of pixels)
+        /// The other neighbours of a pixel are found from the pixels that own the pair
+        arma::mat m_products;
+    };
+
+    /// Runs tasks on the task scheduler, or in the calling thread when a single thread is requested
+    void runTasks(std::vector<std::function<void()>> & inTasks, const size_t inNumThreads, TaskScheduler * inScheduler)
+    {
+        if (inNumThreads < 2 || inTasks.size() < 2)
+        {
+            for (auto & task : inTasks)
+            {
+                task();
+            }
+            return;
+        }
+
+        std::shared_ptr<TaskScheduler> scheduler = getTaskScheduler(inScheduler, inNumThreads);
+        std::vector<std::future<void>> results(inTasks.size());
+        for (size_t idx = 0; idx < inTasks.size(); ++idx)
+        {
+            results[idx] = scheduler->enqueue(inTasks[idx]);
+        }
+
+        scheduler->waitAll(results);
+    }
+
+    /// Accumulates the pixels of a range of columns over a block of frames
+    /// Pixel values at the frames used for noise estimation are copied into the sample buffer of the current band
+    ///
+    /// \param inMovie          Movie stored frame by frame, each frame in column-major order
+    /// \param inNumRows        Number of rows in a movie frame
+    /// \param inNumCols        Number of columns in a movie frame
+    /// \param inFrames         Range of frames to accumulate [start, end)
+    /// \param inCols           Range of columns to accumulate [start, end)
+    /// \param inSampleFrames   Frames used for noise estimation (sorted)
+    /// \param inBandStart      First column of the current band
+    /// \param outSamples       Sample buffer of the current band (number of samples x number of pixels in band)
+    /// \param outAccumulator   Running sums of the pixels (left untouched when empty, i.e. only the noise is computed)
+    template<typename T>
+    void accumulateFrames(
+        const T * inMovie,
+        const size_t inNumRows,
+        const size_t inNumCols,
+        const std::pair<size_t, size_t> inFrames,
+        const std::pair<size_t, size_t> inCols,
+        const arma::uvec & inSampleFrames,
+        const size_t inBandStart,
+        MatrixFloat_t & outSamples,
+        SummaryAccumulator & outAccumulator)
+    {
+        const size_t frameSize = inNumRows * inNumCols;
+        const size_t endAccumulate = outAccumulator.m_sum.is_empty() ? inFrames.first : inFrames.second;
+        for (size_t t = inFrames.first; t < endAccumulate; ++t)
+        {
+            const T * frame = inMovie + t * frameSize;
+            for (size_t col = inCols.first; col < inCols.second; ++col)
+            {
+                const bool hasRight = (col + 1 < inNumCols);
+                for (size_t row = 0; row < inNumRows; ++row)
+                {
+                    const size_t p = col * inNumRows + row;
+                    const double x = static_cast<double>(frame[p]);
+                    outAccumulator.m_sum(p) += x;
+                    outAccumulator.m_sumSquares(p) += x * x;
+                    outAccumulator.m_max(p) = std::max(outAccumulator.m_max(p), static_cast<float>(frame[p]));
+
+                    double * products = outAccumulator.m_products.colptr(p);
+                    if (row + 1 < inNumRows)
+                    {
+                        products[0] += x * static_cast<double>(frame[p + 1]);
+                    }
+                    if (hasRight)
+                    {
+                        products[1] += x * static_cast<double>(frame[p + inNumRows]);
+                        if (row + 1 < inNumRows)
+                        {
+                            products[2] += x * static_cast<double>(frame[p + inNumRows + 1]);
+                        }
+                        if (row > 0)
+                        {
+                            products[3] += x * static_cast<double>(frame[p + inNumRows - 1]);
+                        }
+                    }
+                }
+            }
+        }
+
+        // frames may be sampled more than once when the subsampled spans of a movie overlap
+        const arma::uword * first = std::lower_bound(inSampleFrames.begin(), inSampleFrames.end(), inFrames.first);
+        const arma::uword * last = std::lower_bound(inSampleFrames.begin(), inSampleFrames.end(), inFrames.second);
+        for (const arma::uword * it = first; it != last; ++it)
+        {
+            const size_t j = static_cast<size_t>(it - inSampleFrames.begin());
+            const T * frame = inMovie + (*it) * frameSize;
+            for (size_t p = inCols.first * inNumRows; p < inCols.second * inNumRows; ++p)
+            {
+                outSamples(j, p - inBandStart * inNumRows) = static_cast<float>(frame[p]);
+            }
+        }
+    }
+
+    /// Estimates the noise of a range of pixels of the current band from their samples
+    void estimateNoise(
+        const MatrixFloat_t & inSamples,
+        const std::pair<size_t, size_t> inPixels,
+        const size_t inBandOffset,
+        const std::pair<float,float> inNoiseRange,
+        const AveragingMethod_t inNoiseMethod,
+        MatrixFloat_t & outNoise)
+    {
+        const MatrixFloat_t samples(
+            const_cast<float *>(inSamples.colptr(inPixels.first)),
+            inSamples.n_rows,
+            inPixels.second - inPixels.first,
+            false,
+            true);
+
+        RowFloat_t noise;
+        getNoiseFftFromSamples(samples, noise, inNoiseRange, inNoiseMethod);
+        for (size_t idx = 0; idx < noise.n_elem; ++idx)
+        {
+            outNoise(inBandOffset + inPixels.first + idx) = noise(idx);
+        }
+    }
+
+    /// Converts the running sums to summary images
+    void finalizeSummaryImages(
+        const SummaryAccumulator & inAccumulator,
+        const size_t inNumRows,
+        const size_t inNumCols,
+        const size_t inNumFrames,
+        SummaryImages & outImages)
+    {
+        const double n = static_cast<double>(inNumFrames);
+        const arma::vec mean = inAccumulator.m_sum / n;
+        const arma::vec stdDev = arma::sqrt(arma::clamp(inAccumulator.m_sumSquares / n - arma::square(mean), 0.0, arma::datum::inf));
+
+        outImages.m_mean = arma::conv_to<MatrixFloat_t>::from(mean);
+        outImages.m_mean.reshape(inNumRows, inNumCols);
+        outImages.m_stdDev = arma::conv_to<MatrixFloat_t>::from(stdDev);
+        outImages.m_stdDev.reshape(inNumRows, inNumCols);
+        outImages.m_max = inAccumulator.m_max;
+        outImages.m_max.reshape(inNumRows, inNumCols);
+
+        // correlation of a pair of pixels, pixels with no variation are uncorrelated to their neighbours
+        auto correlation = [&](const size_t p, const size_t q, const size_t k) -> double
+        {
+            if (stdDev(p) == 0.0 || stdDev(q) == 0.0)
+            {
+                return 0.0;
+            }
+            return (inAccumulator.m_products(k, p) / n - mean(p) * mean(q)) / (stdDev(p) * stdDev(q));
+        };
+
+        outImages.m_localCorr.set_size(inNumRows, inNumCols);
+        for (size_t col = 0; col < inNumCols; ++col)
+        {
+            for (size_t row = 0; row < inNumRows; ++row)
+            {
+                const size_t p = col * inNumRows + row;
+                const bool hasAbove = row > 0;
+                const bool hasBelow = row + 1 < inNumRows;
+                const bool hasLeft = col > 0;
+                const bool hasRight = col + 1 < inNumCols;
+
+                double sum = 0.0;
+                size_t count = 0;
+                if (hasBelow) { sum += correlation(p, p + 1, 0); ++count; }
+                if (hasRight) { sum += correlation(p, p + inNumRows, 1); ++count; }
+                if (hasRight && hasBelow) { sum += correlation(p, p + inNumRows + 1, 2); ++count; }
+                if (hasRight && hasAbove) { sum += correlation(p, p + inNumRows - 1, 3); ++count; }
+                if (hasAbove) { sum += correlation(p - 1, p, 0); ++count; }
+                if (hasLeft) { sum += correlation(p - inNumRows, p, 1); ++count; }
+                if (hasLeft && hasAbove) { sum += correlation(p - inNumRows - 1, p, 2); ++count; }
+                if (hasLeft && hasBelow) { sum += correlation(p - inNumRows + 1, p, 3); ++count; }
+
+                outImages.m_localCorr(row, col) = (count > 0) ? static_cast<float>(sum / count) : 0.0f;
+            }
+        }
+    }
+
+    /// Streams a movie in bands of columns and blocks of frames to compute its summary images
+    /// When only the noise is requested, the other images are left empty and only the blocks holding
+    /// frames used for noise estimation are read
+    template<typename T>
+    void streamSummaryImages(
+        const T * inMovie,
+        const size_t inNumRows,
+        const size_t inNumCols,
+        const size_t inNumFrames,
+        const bool inNoiseOnly,
+        SummaryImages & outImages,
+        const std::pair<float,float> noiseRange,
+        const AveragingMethod_t noiseMethod,
+        const size_t inNumThreads,
+        const size_t maxSampleBytes,
+        TaskScheduler * inScheduler)
+    {
+        const size_t numPixels = inNumRows * inNumCols;
+        const arma::uvec sampleFrames = getNoiseFftFrames(inNumFrames);
+
+        SummaryAccumulator accumulator;
+        if (!inNoiseOnly)
+        {
+            accumulator.m_sum.zeros(numPixels);
+            accumulator.m_sumSquares.zeros(numPixels);
+            accumulator.m_max.set_size(numPixels);
+            accumulator.m_max.fill(-std::numeric_limits<float>::max());
+            accumulator.m_products.zeros(4, numPixels);
+        }
+
+        outImages.m_noise.set_size(inNumRows, inNumCols);
+
+        // columns are contiguous in each frame, so a band of columns is read as one contiguous chunk per frame
+        const size_t bytesPerColumn = sizeof(float) * sampleFrames.n_elem * inNumRows;
+        const size_t bandCols = std::min(inNumCols, std::max<size_t>(1, maxSampleBytes / bytesPerColumn));
+        const size_t numThreads = std::max<size_t>(1, inNumThreads);
+
+        MatrixFloat_t samples;
+        for (size_t bandStart = 0; bandStart < inNumCols; bandStart += bandCols)
+        {
+            const size_t bandEnd = std::min(inNumCols, bandStart + bandCols);
+            const size_t numBandCols = bandEnd - bandStart;
+            samples.set_size(sampleFrames.n_elem, numBandCols * inNumRows);
+
+            // workers split the columns of the band and move through the frames together
+            const size_t numColRanges = std::min(numBandCols, numThreads);
+            for (size_t frameStart = 0; frameStart < inNumFrames; frameStart += s_framesPerBlock)
+            {
+                const std::pair<size_t, size_t> frames(frameStart, std::min(inNumFrames, frameStart + s_framesPerBlock));
+                if (inNoiseOnly &&
+                    std::lower_bound(sampleFrames.begin(), sampleFrames.end(), frames.first) ==
+                    std::lower_bound(sampleFrames.begin(), sampleFrames.end(), frames.second))
+                {
+                    continue;
+                }
+
+                std::vector<std::function<void()>> tasks;
+                for (size_t idx = 0; idx < numColRanges; ++idx)
+                {
+                    const std::pair<size_t, size_t> cols(
+                        bandStart + idx * numBandCols / numColRanges,
+                        bandStart + (idx + 1) * numBandCols / numColRanges);
+                    tasks.push_back(std::bind(
+                        accumulateFrames<T>,
+                        inMovie, inNumRows, inNumCols, frames, cols,
+                        std::cref(sampleFrames), bandStart, std::ref(samples), std::ref(accumulator)));
+                }
+                runTasks(tasks, numThreads, inScheduler);
+            }
+
+            // noise of the pixels of the band
+            const size_t numBandPixels = numBandCols * inNumRows;
+            const size_t numPixelRanges = std::min(numBandPixels, 4 * numThreads);
+            std::vector<std::function<void()>> tasks;
+            for (size_t idx = 0; idx < numPixelRanges; ++idx)
+            {
+                const std::pair<size_t, size_t> pixels(
+                    idx * numBandPixels / numPixelRanges,
+                    (idx + 1) * numBandPixels / numPixelRanges);
+                tasks.push_back(std::bind(
+                    estimateNoise,
+                    std::cref(samples), pixels, bandStart * inNumRows,
+                    noiseRange, noiseMethod, std::ref(outImages.m_noise)));
+            }
+            runTasks(tasks, numThreads, inScheduler);
+        }
+
+        if (!inNoiseOnly)
+        {
+            finalizeSummaryImages(accumulator, inNumRows, inNumCols, inNumFrames, outImages);
+        }
+    }
+
+    /// Memory maps a movie written with writeMemoryMappedFileMovie(...) and streams it
+    void streamSummaryImages(
+        const std::string & inFilename,
+        const size_t inNumRows,
+        const size_t inNumCols,
+        const size_t inNumFrames,
+        const DataType inDataType,
+        const bool inNoiseOnly,
+        SummaryImages & outImages,
+        const std::pair<float,float> noiseRange,
+        const AveragingMethod_t noiseMethod,
+        const size_t inNumThreads,
+        const size_t maxSampleBytes,
+        TaskScheduler * inScheduler)
+    {
+        if (inDataType != DataType::U16 && inDataType != DataType::F32)
+        {
+            const std::string errorMessage = "computeSummaryImages: No conversion specified from data type (" + std::to_string(int(inDataType)) + ") to float.";
+            ISX_LOG_WARNING(errorMessage);
+            throw std::runtime_error(errorMessage);
+        }
+
+        std::error_code error;
+        mio::shared_mmap_source mmap;
+        mmap.map(inFilename, error);
+        if (error)
+        {
+            const std::string errorMessage = "Failed to memory map movie: " + error.message();
+            ISX_LOG_WARNING(errorMessage);
+            throw std::runtime_error(errorMessage);
+        }
+
+        const size_t numBytes = inNumRows * inNumCols * inNumFrames * getDataTypeSizeInBytes(inDataType);
+        if (size_t(mmap.size()) != numBytes)
+        {
+            const std::string errorMessage = "Failed memory mapped file read. Size of file (" + std::to_string(size_t(mmap.size())) + ") does not match size of movie (" + std::to_string(numBytes) + ")";
+            ISX_LOG_WARNING(errorMessage);
+            throw std::runtime_error(errorMessage);
+        }
+
+        if (inDataType == DataType::U16)
+        {
+            streamSummaryImages(reinterpret_cast<const uint16_t *>(mmap.data()), inNumRows, inNumCols, inNumFrames,
+                                inNoiseOnly, outImages, noiseRange, noiseMethod, inNumThreads, maxSampleBytes, inScheduler);
+        }
+        else
+        {
+            streamSummaryImages(reinterpret_cast<const float *>(mmap.data()), inNumRows, inNumCols, inNumFrames,
+                                inNoiseOnly, outImages, noiseRange, noiseMethod, inNumThreads, maxSampleBytes, inScheduler);
+        }
+    }
+} // namespace
+
+    void computeSummaryImages(
+        const std::string inFilename,
+        const size_t inNumRows,
+        const size_t inNumCols,
+        const size_t inNumFrames,
+        const DataType inDataType,
+        SummaryImages & outImages,
+        const std::pair<float,float> noiseRange,
+        const AveragingMethod_t noiseMethod,
+        const size_t inNumThreads,
+        const size_t maxSampleBytes,
+        TaskScheduler * inScheduler)
+    {
+        streamSummaryImages(inFilename, inNumRows, inNumCols, inNumFrames, inDataType, false,
+                            outImages, noiseRange, noiseMethod, inNumThreads, maxSampleBytes, inScheduler);
+    }
+
+    void computeNoiseImage(
+        const std::string inFilename,
+        const size_t inNumRows,
+        const size_t inNumCols,
+        const size_t inNumFrames,
+        const DataType inDataType,
+        MatrixFloat_t & outNoise,
+        const std::pair<float,float> noiseRange,
+        const AveragingMethod_t noiseMethod,
+        const size_t inNumThreads,
+        const size_t maxSampleBytes,
+        TaskScheduler * inScheduler)
+    {
+        SummaryImages images;
+        streamSummaryImages(inFilename, inNumRows, inNumCols, inNumFrames, inDataType, true,
+                            images, noiseRange, noiseMethod, inNumThreads, maxSampleBytes, inScheduler);
+        outNoise = std::move(images.m_noise);
+    }
+
+    void computeSummaryImages(
+        const CubeFloat_t & inData,
+        SummaryImages & outImages,
+        const std::pair<float,float> noiseRange,
+        const AveragingMethod_t noiseMethod,
+        const size_t inNumThreads,
+        const size_t maxSampleBytes,
+        TaskScheduler * inScheduler)
+    {
+        streamSummaryImages(inData.memptr(), inData.n_rows, inData.n_cols, inData.n_slices, false,
+                            outImages, noiseRange, noiseMethod, inNumThreads, maxSampleBytes, inScheduler);
+    }
+} // namespace isx
@@ -0,0 +1,108 @@
+#ifndef ISX_CNMFE_SUMMARY_IMAGES_H
+#define ISX_CNMFE_SUMMARY_IMAGES_H
+
+#include "isxArmaUtils.h"
+#include "isxCnmfeNoise.h"
+#include "isxTaskScheduler.h"
+#include "isxUtilities.h"
+
+#include <string>
+
+namespace isx
+{
+    /// Per-pixel summary statistics of a movie, each image has the dimensions of a frame (h x w)
+    struct SummaryImages
+    {
+        /// Mean of each pixel over time
+        MatrixFloat_t m_mean;
+
+        /// Standard deviation of each pixel over time (normalized by the number of frames)
+        MatrixFloat_t m_stdDev;
+
+        /// Maximum of each pixel over time
+        MatrixFloat_t m_max;
+
+        /// Noise level of each pixel, as estimated by getNoiseFft(...)
+        MatrixFloat_t m_noise;
+
+        /// Average correlation of each pixel with its 8 neighbours, as computed by computeLocalCorr(...)
+        MatrixFloat_t m_localCorr;
+    };
+
+    /// Computes summary images of a movie stored in a memory-mapped binary file
+    /// The movie is streamed in blocks of frames and all images are computed in a single pass over the file.
+    /// Pixel values at the frames used for noise estimation are buffered; when this buffer would exceed
+    /// maxSampleBytes the field of view is split into bands of columns that are streamed one after the other.
+    ///
+    /// \param inFilename       Filename of binary file created with writeMemoryMappedFileMovie(...)
+    /// \param inNumRows        Number of rows in a movie frame
+    /// \param inNumCols        Number of columns in a movie frame
+    /// \param inNumFrames      Number of frames in movie
+    /// \param inDataType       Data type representing a pixel in movie
+    /// \param outImages        Summary images of the movie
+    /// \param noiseRange       Range of frequencies over which power spectrum is averaged
+    /// \param noiseMethod      Method for averaging the noise
+    /// \param inNumThreads     Number of threads used to process blocks of frames
+    /// \param maxSampleBytes   Maximum size of the buffer of pixel values used for noise estimation
+    /// \param inScheduler      Scheduler shared by the stages of a run (nullptr to create one with inNumThreads workers)
+    void computeSummaryImages(
+        const std::string inFilename,
+        const size_t inNumRows,
+        const size_t inNumCols,
+        const size_t inNumFrames,
+        const DataType inDataType,
+        SummaryImages & outImages,
+        const std::pair<float,float> noiseRange = {0.25f, 0.5f},
+        const AveragingMethod_t noiseMethod = AveragingMethod_t::LOGMEXP,
+        const size_t inNumThreads = 1,
+        const size_t maxSampleBytes = size_t(1) << 30,
+        TaskScheduler * inScheduler = nullptr);
+
+    /// Computes only the noise image of a movie stored in a memory-mapped binary file
+    /// Gives the same image as the m_noise member of computeSummaryImages(...), but only the blocks
+    /// of frames used for noise estimation are read and no other statistic is accumulated.
+    ///
+    /// \param inFilename       Filename of binary file created with writeMemoryMappedFileMovie(...)
+    /// \param inNumRows        Number of rows in a movie frame
+    /// \param inNumCols        Number of columns in a movie frame
+    /// \param inNumFrames      Number of frames in movie
+    /// \param inDataType       Data type representing a pixel in movie
+    /// \param outNoise         Noise level of each pixel, as estimated by getNoiseFft(...)
+    /// \param noiseRange       Range of frequencies over which power spectrum is averaged
+    /// \param noiseMethod      Method for averaging the noise
+    /// \param inNumThreads     Number of threads used to process blocks of frames
+    /// \param maxSampleBytes   Maximum size of the buffer of pixel values used for noise estimation
+    /// \param inScheduler      Scheduler shared by the stages of a run (nullptr to create one with inNumThreads workers)
+    void computeNoiseImage(
+        const std::string inFilename,
+        const size_t inNumRows,
+        const size_t inNumCols,
+        const size_t inNumFrames,
+        const DataType inDataType,
+        MatrixFloat_t & outNoise,
+        const std::pair<float,float> noiseRange = {0.25f, 0.5f},
+        const AveragingMethod_t noiseMethod = AveragingMethod_t::LOGMEXP,
+        const size_t inNumThreads = 1,
+        const size_t maxSampleBytes = size_t(1) << 30,
+        TaskScheduler * inScheduler = nullptr);
+
+    /// Computes summary images of a movie held in memory
+    ///
+    /// \param inData           Cube of movie data (h x w x t)
+    /// \param outImages        Summary images of the movie
+    /// \param noiseRange       Range of frequencies over which power spectrum is averaged
+    /// \param noiseMethod      Method for averaging the noise
+    /// \param inNumThreads     Number of threads used to process blocks of frames
+    /// \param maxSampleBytes   Maximum size of the buffer of pixel values used for noise estimation
+    /// \param inScheduler      Scheduler shared by the stages of a run (nullptr to create one with inNumThreads workers)
+    void computeSummaryImages(
+        const CubeFloat_t & inData,
+        SummaryImages & outImages,
+        const std::pair<float,float> noiseRange = {0.25f, 0.5f},
+        const AveragingMethod_t noiseMethod = AveragingMethod_t::LOGMEXP,
+        const size_t inNumThreads = 1,
+        const size_t maxSampleBytes = size_t(1) << 30,
+        TaskScheduler * inScheduler = nullptr);
+} // namespace isx
+
+#endif //ISX_CNMFE_SUMMARY_IMAGES_H
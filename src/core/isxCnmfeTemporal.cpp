@@ -1,7 +1,12 @@
 #include "isxCnmfeTemporal.h"
 #include "isxCnmfeUtils.h"
 #include "isxLog.h"
-#include "ThreadPool.h"
+#include "isxOasis.h"
+#include "isxTaskScheduler.h"
+
+#include <cstdint>
+#include <limits>
+#include <set>
 
 namespace isx
 {
@@ -18,16 +23,321 @@ namespace isx
         ColumnFloat_t lCaTrace, lSpikes;
         constrainedFoopsi(inTrace, outArParams, outNoise, lCaTrace, outBaseline, outInitCaVal, lSpikes, inDeconvParams);
 
-        ColumnFloat_t polynomial = arma::join_cols(ColumnFloat_t({1.0f}), -arma::conv_to<ColumnFloat_t>::from(outArParams));
-        float gd = arma::max(arma::real(arma::roots(polynomial)));
-        ColumnFloat_t gdVec(inTrace.n_elem);
-        for (size_t idx = 0; idx < gdVec.n_elem; ++idx)
+        // Decay of the initial calcium, the AR(1) parameter itself or the largest root of the AR(2) polynomial
+        float gd = outArParams[0];
+        if (outArParams.size() > 1)
+        {
+            ColumnFloat_t polynomial = arma::join_cols(ColumnFloat_t({1.0f}), -arma::conv_to<ColumnFloat_t>::from(outArParams));
+            gd = arma::max(arma::real(arma::roots(polynomial)));
+        }
+
+        // Powers of gd up to the trace length, the table of each thread is reused across traces
+        thread_local DecayPowers decayPowers;
+        outC = lCaTrace + outBaseline;
+        decayPowers.reset(gd, outC.n_elem);
+        decayPowers.addScaled(outInitCaVal, outC);
+        outSpikes = std::move(lSpikes);
+    }
+
+    const size_t TraceSketch::s_numBuckets;
+
+    /// Pseudo-random sign of a sample of a sketch, from its time index mixed by the finalizer of MurmurHash3
+    static float sketchSign(uint64_t inIndex)
+    {
+        inIndex ^= inIndex >> 33;
+        inIndex *= 0xff51afd7ed558ccdULL;
+        inIndex ^= inIndex >> 33;
+        inIndex *= 0xc4ceb9fe1a85ec53ULL;
+        inIndex ^= inIndex >> 33;
+        return (inIndex & 1) ? -1.0f : 1.0f;
+    }
+
+    TraceSketch::TraceSketch(const ColumnFloat_t & inTrace)
+        : m_length(inTrace.n_elem)
+        , m_norm(inTrace.is_empty() ? 0.0f : arma::norm(inTrace))
+        , m_buckets(s_numBuckets, arma::fill::zeros)
+    {
+        for (size_t t = 0; t < inTrace.n_elem; ++t)
+        {
+            m_buckets(t % s_numBuckets) += sketchSign(t) * inTrace(t);
+        }
+    }
+
+    float TraceSketch::relativeDistance(const TraceSketch & inReference, const float inScale) const
+    {
+        const float referenceNorm = inScale * inReference.m_norm;
+        if (m_length != inReference.m_length || m_buckets.n_elem != inReference.m_buckets.n_elem || !(referenceNorm > 0.0f))
+        {
+            return std::numeric_limits<float>::infinity();
+        }
+        return arma::norm(m_buckets - inScale * inReference.m_buckets) / referenceNorm;
+    }
+
+    // Scale of a trace relative to a reference trace if the normalized traces match up to a relative tolerance, 0 otherwise
+    static float matchScale(const TraceSketch & inSketch, const TraceSketch & inReference, const float inTolerance)
+    {
+        const float scale = (inReference.m_norm > 0.0f) ? inSketch.m_norm / inReference.m_norm : 0.0f;
+        return (inSketch.relativeDistance(inReference, scale) <= inTolerance) ? scale : 0.0f;
+    }
+
+    bool DeconvolutionStateCache::fetch(
+        const size_t inComponent,
+        const ColumnFloat_t & inTrace,
+        const size_t inArOrder,
+        std::vector<float> & outArParams,
+        float & outNoise) const
+    {
+        outArParams.clear();
+        outNoise = -1.0f;
+
+        if (inComponent >= m_traces.size() || m_arParams[inComponent].size() != inArOrder)
+        {
+            return false;
+        }
+
+        // The cache is remapped when components are merged, so a large change means the trace itself has changed
+        const float scale = matchScale(TraceSketch(inTrace), m_traces[inComponent], m_tolerance);
+        if (scale == 0.0f)
+        {
+            return false;
+        }
+
+        outArParams = m_arParams[inComponent];
+        outNoise = scale * m_noise[inComponent];
+        return true;
+    }
+
+    void DeconvolutionStateCache::store(
+        const size_t inComponent,
+        const ColumnFloat_t & inTrace,
+        const std::vector<float> & inArParams,
+        const float inNoise)
+    {
+        resize(inComponent + 1);
+        m_arParams[inComponent] = inArParams;
+        m_noise[inComponent] = inNoise;
+        m_traces[inComponent] = TraceSketch(inTrace);
+    }
+
+    bool DeconvolutionStateCache::hasChanged(const size_t inComponent, const ColumnFloat_t & inTrace, const float inScale) const
+    {
+        if (inComponent >= m_solvedTraces.size())
+        {
+            return true;
+        }
+
+        return !(TraceSketch(inTrace).relativeDistance(m_solvedTraces[inComponent], inScale) <= m_changeTolerance);
+    }
+
+    bool DeconvolutionStateCache::fetchSolution(
+        const size_t inComponent,
+        const ColumnFloat_t & inC,
+        const size_t inArOrder,
+        ColumnFloat_t & outSpikes,
+        float & outBaseline,
+        float & outInitCaVal,
+        float & outNoise,
+        std::vector<float> & outArParams,
+        float & outScale) const
+    {
+        if (inComponent >= m_solutions.size() || m_arParams[inComponent].size() != inArOrder)
+        {
+            return false;
+        }
+
+        // the solution is only valid if the trace was not modified since it was stored (e.g. by merging), other than rescaled
+        const float scale = matchScale(TraceSketch(inC), m_solutions[inComponent], m_changeTolerance);
+        if (scale == 0.0f)
         {
-            gdVec(idx) = std::pow(gd, static_cast<float>(idx));
+            return false;
         }
 
-        outC = lCaTrace + outBaseline + (outInitCaVal * gdVec);
-        outSpikes = lSpikes;
+        outSpikes = scale * ColumnFloat_t(MatrixFloat_t(m_spikes[inComponent]));
+        outBaseline = scale * m_baselines[inComponent];
+        outInitCaVal = scale * m_initCaVals[inComponent];
+        outNoise = scale * m_solutionNoise[inComponent];
+        outArParams = m_arParams[inComponent];
+        outScale = scale;
+        return true;
+    }
+
+    void DeconvolutionStateCache::storeSolution(
+        const size_t inComponent,
+        const ColumnFloat_t & inTrace,
+        const ColumnFloat_t & inC,
+        const ColumnFloat_t & inSpikes,
+        const float inBaseline,
+        const float inInitCaVal,
+        const float inNoise)
+    {
+        resize(inComponent + 1);
+        m_solvedTraces[inComponent] = TraceSketch(inTrace);
+        m_solutions[inComponent] = TraceSketch(inC);
+        m_spikes[inComponent] = arma::SpMat<float>(inSpikes);
+        m_baselines[inComponent] = inBaseline;
+        m_initCaVals[inComponent] = inInitCaVal;
+        m_solutionNoise[inComponent] = inNoise;
+    }
+
+    void DeconvolutionStateCache::resize(const size_t inNumComponents)
+    {
+        if (inNumComponents <= m_traces.size())
+        {
+            return;
+        }
+
+        m_arParams.resize(inNumComponents);
+        m_noise.resize(inNumComponents, -1.0f);
+        m_traces.resize(inNumComponents);
+        m_solvedTraces.resize(inNumComponents);
+        m_solutions.resize(inNumComponents);
+        m_spikes.resize(inNumComponents);
+        m_baselines.resize(inNumComponents, 0.0f);
+        m_initCaVals.resize(inNumComponents, 0.0f);
+        m_solutionNoise.resize(inNumComponents, -1.0f);
+    }
+
+    void DeconvolutionStateCache::remap(const std::vector<size_t> & inSources)
+    {
+        DeconvolutionStateCache remapped;
+        remapped.m_tolerance = m_tolerance;
+        remapped.m_changeTolerance = m_changeTolerance;
+        remapped.m_numDeconvolved = m_numDeconvolved;
+        remapped.m_numEstimated = m_numEstimated;
+        remapped.resize(inSources.size());
+        for (size_t k = 0; k < inSources.size(); ++k)
+        {
+            const size_t source = inSources[k];
+            if (source >= m_traces.size())
+            {
+                continue;
+            }
+
+            remapped.m_arParams[k] = std::move(m_arParams[source]);
+            remapped.m_noise[k] = m_noise[source];
+            remapped.m_traces[k] = std::move(m_traces[source]);
+            remapped.m_solvedTraces[k] = std::move(m_solvedTraces[source]);
+            remapped.m_solutions[k] = std::move(m_solutions[source]);
+            remapped.m_spikes[k] = std::move(m_spikes[source]);
+            remapped.m_baselines[k] = m_baselines[source];
+            remapped.m_initCaVals[k] = m_initCaVals[source];
+            remapped.m_solutionNoise[k] = m_solutionNoise[source];
+        }
+        *this = std::move(remapped);
+    }
+
+    void computeOverlapNeighbours(const MatrixFloat_t & AA, std::vector<arma::uvec> & outNeighbours)
+    {
+        outNeighbours.resize(AA.n_rows);
+        for (size_t k = 0; k < AA.n_rows; ++k)
+        {
+            outNeighbours[k] = arma::find(AA.row(k));
+        }
+    }
+
+    std::vector<std::vector<size_t>> updateOrderDsatur(const std::vector<arma::uvec> & inNeighbours)
+    {
+        const size_t K = inNeighbours.size();
+        const size_t uncolored = std::numeric_limits<size_t>::max();
+
+        std::vector<size_t> colors(K, uncolored);
+        std::vector<size_t> degrees(K, 0);
+        std::vector<std::set<size_t>> neighbourColors(K);
+        for (size_t k = 0; k < K; ++k)
+        {
+            for (const arma::uword j : inNeighbours[k])
+            {
+                degrees[k] += (j != k);
+            }
+        }
+
+        // DSatur: color the component with the most distinctly colored neighbours next,
+        // breaking ties by degree, using the smallest color unused by its neighbours
+        size_t numColors = 0;
+        for (size_t step = 0; step < K; ++step)
+        {
+            size_t next = uncolored;
+            for (size_t k = 0; k < K; ++k)
+            {
+                if (colors[k] != uncolored)
+                {
+                    continue;
+                }
+
+                if (next == uncolored
+                    || neighbourColors[k].size() > neighbourColors[next].size()
+                    || (neighbourColors[k].size() == neighbourColors[next].size() && degrees[k] > degrees[next]))
+                {
+                    next = k;
+                }
+            }
+
+            size_t color = 0;
+            while (neighbourColors[next].count(color) > 0)
+            {
+                color++;
+            }
+
+            colors[next] = color;
+            numColors = std::max(numColors, color + 1);
+            for (const arma::uword j : inNeighbours[next])
+            {
+                if (j != next)
+                {
+                    neighbourColors[j].insert(color);
+                }
+            }
+        }
+
+        // Balance group sizes by moving components out of groups larger than the average
+        // into groups smaller than the average that hold none of their neighbours
+        std::vector<size_t> groupSizes(numColors, 0);
+        for (size_t k = 0; k < K; ++k)
+        {
+            groupSizes[colors[k]]++;
+        }
+
+        const size_t targetSize = numColors > 0 ? (K + numColors - 1) / numColors : 0;
+        for (size_t k = 0; k < K; ++k)
+        {
+            if (groupSizes[colors[k]] <= targetSize)
+            {
+                continue;
+            }
+
+            for (size_t color = 0; color < numColors; ++color)
+            {
+                if (groupSizes[color] >= targetSize)
+                {
+                    continue;
+                }
+
+                bool conflict = false;
+                for (const arma::uword j : inNeighbours[k])
+                {
+                    if (j != k && colors[j] == color)
+                    {
+                        conflict = true;
+                        break;
+                    }
+                }
+
+                if (!conflict)
+                {
+                    groupSizes[colors[k]]--;
+                    groupSizes[color]++;
+                    colors[k] = color;
+                    break;
+                }
+            }
+        }
+
+        std::vector<std::vector<size_t>> components(numColors);
+        for (size_t k = 0; k < K; ++k)
+        {
+            components[colors[k]].push_back(k);
+        }
+        return components;
     }
 
     void updateIteration(
@@ -41,7 +351,9 @@ namespace isx
         MatrixFloat_t & outG,
         DeconvolutionParams inDeconvParams,
         const size_t inIterations,
-        const size_t inNumThreads)
+        const size_t inNumThreads,
+        DeconvolutionStateCache * inOutCache,
+        TaskScheduler * inScheduler)
     {
         const size_t K = AA.n_rows;
         const size_t p = inDeconvParams.m_firstOrderAR ? 1 : 2;
@@ -55,18 +367,90 @@ namespace isx
 
         MatrixFloat_t Ccopy = inOutC;
 
+        // Noise and AR parameters are reused across iterations even when the caller keeps no cache
+        DeconvolutionStateCache localCache;
+        DeconvolutionStateCache & cache = (inOutCache != nullptr) ? *inOutCache : localCache;
+        const size_t numEstimated = cache.m_numEstimated;
+        const size_t numDeconvolved = cache.m_numDeconvolved;
+
+        // Residuals of a component only change when an overlapping component is updated
+        std::vector<arma::uvec> neighbours;
+        computeOverlapNeighbours(AA, neighbours);
+
         // Group components into sets of non-overlapping components
-        std::vector<std::vector<size_t>> components = updateOrderGreedy(AA);
+        std::vector<std::vector<size_t>> components = updateOrderDsatur(neighbours);
 
-        // Multiprocessing pool used for multithreading
-        ThreadPool pool(inNumThreads);
+        if (inNumThreads > 1 && !components.empty())
+        {
+            // Fraction of the worker threads kept busy while each group is deconvolved, assuming equal cost per component
+            float totalUtilization = 0.0f;
+            size_t minGroupSize = K;
+            size_t maxGroupSize = 0;
+            for (size_t groupIdx = 0; groupIdx < components.size(); ++groupIdx)
+            {
+                const size_t groupSize = components[groupIdx].size();
+                const size_t numRounds = (groupSize + inNumThreads - 1) / inNumThreads;
+                const float utilization = static_cast<float>(groupSize) / static_cast<float>(numRounds * inNumThreads);
+                ISX_LOG_DEBUG("Temporal update group ", groupIdx, ": ", groupSize, " components, ", 100.0f * utilization, "% thread utilization");
+
+                totalUtilization += utilization;
+                minGroupSize = std::min(minGroupSize, groupSize);
+                maxGroupSize = std::max(maxGroupSize, groupSize);
+            }
+
+            ISX_LOG_DEBUG("Updating ", K, " temporal components in ", components.size(),
+                " groups of non-overlapping components (", minGroupSize, " to ", maxGroupSize, " per group, ",
+                100.0f * totalUtilization / static_cast<float>(components.size()), "% mean thread utilization)");
+        }
+
+        // Shared scheduler used for multithreading
+        std::shared_ptr<TaskScheduler> scheduler;
+        if (inNumThreads > 1)
+        {
+            scheduler = getTaskScheduler(inScheduler, inNumThreads);
+        }
+
+        // A component is dirty until it is deconvolved, and again when an overlapping component changes.
+        // Components left unchanged since a previous call, other than rescaled, keep the solution stored in the cache
+        // scaled to their current temporal component. Their traces are compared to the stored ones at the same scale.
+        std::vector<bool> dirty(K, true);
+        std::vector<float> scales(K, 1.0f);
+        for (size_t k = 0; k < K; ++k)
+        {
+            ColumnFloat_t lSp;
+            std::vector<float> lArParams;
+            if (cache.fetchSolution(k, inOutC.row(k).t(), p, lSp, outBl(k), outC1(k), outSn(k), lArParams, scales[k]))
+            {
+                outS.row(k) = lSp.t();
+                outG.col(k) = arma::conv_to<ColumnFloat_t>::from(lArParams);
+                dirty[k] = false;
+            }
+        }
 
         for (size_t iteration = 0; iteration < inIterations; ++iteration)
         {
             size_t cumComponentsUpdated = 0;
-            for (const auto & comp : components)
+            for (const auto & group : components)
             {
+                // Only deconvolve the components of this group that are dirty or whose residual has changed
+                std::vector<size_t> comp;
+                std::vector<ColumnFloat_t> Y;
+                for (const size_t k : group)
+                {
+                    ColumnFloat_t trace = YrA.col(k) + Ccopy.row(k).t();
+                    if (dirty[k] || cache.hasChanged(k, trace, scales[k]))
+                    {
+                        comp.push_back(k);
+                        Y.push_back(std::move(trace));
+                    }
+                }
+
                 const size_t compSize = comp.size();
+                if (compSize == 0)
+                {
+                    continue;
+                }
+
                 std::vector<ColumnFloat_t> lC(compSize);
                 std::vector<ColumnFloat_t> lSp(compSize);
 
@@ -75,28 +459,30 @@ namespace isx
                 std::vector<float> lNoise(compSize, -1.0f);
                 std::vector<std::vector<float>> lArParams(compSize);
 
+                std::vector<bool> cached(compSize);
+                for (unsigned int compIdx = 0; compIdx < compSize; ++compIdx)
+                {
+                    cached[compIdx] = cache.fetch(comp[compIdx], Y[compIdx], p, lArParams[compIdx], lNoise[compIdx]);
+                }
+
                 if (inNumThreads < 2)
                 {
                     // Naive implementation: Update each component one by one.
                     // Can be optimized by processing non-overlapping components in parallel
                     for (unsigned int compIdx = 0; compIdx < compSize; ++compIdx)
                     {
-                        ColumnFloat_t Y = YrA.col(comp[compIdx]) + Ccopy.row(comp[compIdx]).t();
                         constrainedFoopsiParallel(
-                            Y, lArParams[compIdx], lNoise[compIdx], lC[compIdx],
+                            Y[compIdx], lArParams[compIdx], lNoise[compIdx], lC[compIdx],
                             lBl[compIdx], lC1[compIdx], lSp[compIdx], inDeconvParams);
                     }
                 }
                 else
                 {
-                    // Process all components in this set in parallel using a thread pool
-                    std::vector<ColumnFloat_t> Y(compSize);
+                    // Process all components in this set in parallel using the task scheduler
                     std::vector<std::future<void>> results(compSize);
                     for (unsigned int compIdx = 0; compIdx < compSize; ++compIdx)
                     {
-                        Y[compIdx] = YrA.col(comp[compIdx]) + Ccopy.row(comp[compIdx]).t();
-
-                        results[compIdx] = pool.enqueue(
+                        results[compIdx] = scheduler->enqueue(
                             constrainedFoopsiParallel,
                             std::cref(Y[compIdx]),
                             std::ref(lArParams[compIdx]),
@@ -108,16 +494,38 @@ namespace isx
                             inDeconvParams);
                     }
 
-                    for (unsigned int compIdx = 0; compIdx < compSize; ++compIdx)
-                    {
-                        results[compIdx].get();
-                    }
+                    scheduler->waitAll(results);
                 }
 
                 // Update outputs with deconvolution outputs
                 for (unsigned int compIdx = 0; compIdx < compSize; ++compIdx)
                 {
-                    YrA -= ((AA.row(comp[compIdx]).t() * (lC[compIdx].t() - inOutC.row(comp[compIdx])))).t();
+                    const size_t k = comp[compIdx];
+                    if (!cached[compIdx])
+                    {
+                        // reused parameters keep the trace they were estimated from so that slow drifts are caught
+                        cache.store(k, Y[compIdx], lArParams[compIdx], lNoise[compIdx]);
+                        cache.m_numEstimated++;
+                    }
+                    cache.storeSolution(k, Y[compIdx], lC[compIdx], lSp[compIdx], lBl[compIdx], lC1[compIdx], lNoise[compIdx]);
+                    cache.m_numDeconvolved++;
+                    scales[k] = 1.0f;
+
+                    const ColumnFloat_t deltaC = lC[compIdx] - inOutC.row(k).t();
+                    for (const arma::uword j : neighbours[k])
+                    {
+                        YrA.col(j) -= AA(k, j) * deltaC;
+                    }
+
+                    dirty[k] = false;
+                    if (arma::norm(deltaC) > cache.m_changeTolerance * arma::norm(lC[compIdx]))
+                    {
+                        for (const arma::uword j : neighbours[k])
+                        {
+                            dirty[j] = dirty[j] || (j != k);
+                        }
+                    }
+
                     inOutC(comp[compIdx], arma::span::all) = lC[compIdx].t();
                     outS(comp[compIdx], arma::span::all) = lSp[compIdx].t();
                     outBl(comp[compIdx]) = lBl[compIdx];
@@ -129,7 +537,12 @@ namespace isx
                 cumComponentsUpdated += compSize;
             }
 
-            if (arma::norm(Ccopy - inOutC, "fro") <= 1e-3f * arma::norm(inOutC, "fro"))
+            if (cumComponentsUpdated == 0)
+            {
+                ISX_LOG_INFO("Stopping temporal components update, no component changed");
+                break;
+            }
+            else if (arma::norm(Ccopy - inOutC, "fro") <= 1e-3f * arma::norm(inOutC, "fro"))
             {
                 ISX_LOG_INFO("Stopping temporal components update, not changing significantly");
                 break;
@@ -140,6 +553,8 @@ namespace isx
             }
         }
 
+        ISX_LOG_DEBUG("Deconvolved ", cache.m_numDeconvolved - numDeconvolved, " temporal component updates, estimating noise and AR parameters for ",
+            cache.m_numEstimated - numEstimated);
     }
 
     void updateTemporalComponents(
@@ -154,7 +569,9 @@ namespace isx
         MatrixFloat_t & outYrA,
         DeconvolutionParams inDeconvParams,
         const size_t inIterations,
-        const size_t inNumThreads)
+        const size_t inNumThreads,
+        DeconvolutionStateCache * inOutCache,
+        TaskScheduler * inScheduler)
     {
         ColumnFloat_t nA = arma::sum(arma::square(inA)).t() + std::numeric_limits<float>::epsilon();
 
@@ -164,7 +581,7 @@ namespace isx
 
         updateIteration(
             outYrA, AA, inOutC, outS, outBl, outC1, outSn, outG,
-            inDeconvParams, inIterations, inNumThreads);
+            inDeconvParams, inIterations, inNumThreads, inOutCache, inScheduler);
 
         // Remove empty temporal components
         // not currently implemented since this consists of removing traces that only contain zeros,
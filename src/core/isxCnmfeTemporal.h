@@ -4,6 +4,9 @@
 #include "isxArmaUtils.h"
 #include "isxCnmfeNoise.h"
 #include "isxCnmfeDeconv.h"
+#include "isxTaskScheduler.h"
+
+#include <vector>
 
 namespace isx
 {
@@ -19,6 +22,155 @@ namespace isx
         DeconvolutionParams inDeconvParams = DeconvolutionParams()
     );
 
+    /// Count sketch of a trace, used to detect changes of a trace without keeping a copy of it
+    ///
+    /// Each sample is added to one of s_numBuckets buckets with a pseudo-random sign, so the distance between
+    /// the sketches of two traces of the same length is an unbiased estimate of the L2 distance between the traces.
+    struct TraceSketch
+    {
+        /// Number of buckets of a sketch
+        static const size_t s_numBuckets = 64;
+
+        /// Constructor, for an empty trace
+        ///
+        TraceSketch() {}
+
+        /// Constructor
+        ///
+        /// \param inTrace          Trace to summarize
+        explicit TraceSketch(const ColumnFloat_t & inTrace);
+
+        /// \param inReference      Sketch of the reference trace
+        /// \param inScale          Scale applied to the reference trace
+        /// \return                 Estimated L2 distance between this trace and the scaled reference trace, relative to the norm
+        ///                         of the latter, or infinity if the traces differ in length or the scaled reference trace is zero
+        float relativeDistance(const TraceSketch & inReference, const float inScale = 1.0f) const;
+
+        size_t m_length = 0;            ///< Length of the trace
+        float m_norm = 0.0f;            ///< L2 norm of the trace
+        ColumnFloat_t m_buckets;        ///< Sum of the samples of each bucket with their signs
+    };
+
+    /// Deconvolution state of each temporal component, kept across the iterations of
+    /// updateIteration and across calls to updateTemporalComponents.
+    ///
+    /// Noise level and AR parameters require FFTs of the whole trace and an AR fit, so they are only
+    /// estimated again for a component when its trace has changed significantly since they were last estimated.
+    /// The last solution of each component is kept as well so that components whose trace has not
+    /// changed since they were last deconvolved are not deconvolved again. Temporal components are rescaled
+    /// between updates (e.g. normalized by the spatial update while their footprints are scaled up), so traces
+    /// are compared after normalization and the noise level and solutions are scaled with the trace,
+    /// deconvolution being invariant to the scale of the trace. Traces are only kept as sketches and the spikes
+    /// as sparse vectors, so the cache holds no full-length trace. State is kept by component index, so the cache
+    /// has to be remapped with remap(...) whenever components are removed or merged.
+    struct DeconvolutionStateCache
+    {
+        /// Retrieves the parameters of a component if they are still valid for its trace, other than rescaled
+        ///
+        /// \param inComponent      Index of the component
+        /// \param inTrace          Trace of the component to be deconvolved
+        /// \param inArOrder        Order of the AR model
+        /// \param outArParams      Cached AR parameters, or empty if they have to be estimated
+        /// \param outNoise         Cached noise level scaled to the trace, or -1 if it has to be estimated
+        /// \return                 True if cached parameters were retrieved
+        bool fetch(
+            const size_t inComponent,
+            const ColumnFloat_t & inTrace,
+            const size_t inArOrder,
+            std::vector<float> & outArParams,
+            float & outNoise) const;
+
+        /// Stores the parameters estimated for a component
+        ///
+        /// \param inComponent      Index of the component
+        /// \param inTrace          Trace the parameters were estimated from
+        /// \param inArParams       AR parameters of the component
+        /// \param inNoise          Noise level of the component
+        void store(
+            const size_t inComponent,
+            const ColumnFloat_t & inTrace,
+            const std::vector<float> & inArParams,
+            const float inNoise);
+
+        /// \param inComponent      Index of the component
+        /// \param inTrace          Trace of the component to be deconvolved
+        /// \param inScale          Scale of the trace relative to the trace the component was last deconvolved from
+        /// \return                 True if the trace has changed significantly since the component was last deconvolved
+        bool hasChanged(const size_t inComponent, const ColumnFloat_t & inTrace, const float inScale = 1.0f) const;
+
+        /// Retrieves the last solution of a component if its temporal trace was not modified since, other than rescaled
+        ///
+        /// \param inComponent      Index of the component
+        /// \param inC              Current temporal trace of the component
+        /// \param inArOrder        Order of the AR model
+        /// \param outSpikes        Spikes of the solution
+        /// \param outBaseline      Baseline of the solution
+        /// \param outInitCaVal     Initial calcium concentration of the solution
+        /// \param outNoise         Noise level used for the solution
+        /// \param outArParams      AR parameters used for the solution
+        /// \param outScale         Scale of the current temporal trace relative to the stored one, applied to the solution
+        /// \return                 True if a solution was retrieved
+        bool fetchSolution(
+            const size_t inComponent,
+            const ColumnFloat_t & inC,
+            const size_t inArOrder,
+            ColumnFloat_t & outSpikes,
+            float & outBaseline,
+            float & outInitCaVal,
+            float & outNoise,
+            std::vector<float> & outArParams,
+            float & outScale) const;
+
+        /// Stores the solution of a component
+        ///
+        /// \param inComponent      Index of the component
+        /// \param inTrace          Trace the component was deconvolved from
+        /// \param inC              Deconvolved temporal trace
+        /// \param inSpikes         Deconvolved spikes
+        /// \param inBaseline       Baseline of the trace
+        /// \param inInitCaVal      Initial calcium concentration of the trace
+        /// \param inNoise          Noise level used for the solution
+        void storeSolution(
+            const size_t inComponent,
+            const ColumnFloat_t & inTrace,
+            const ColumnFloat_t & inC,
+            const ColumnFloat_t & inSpikes,
+            const float inBaseline,
+            const float inInitCaVal,
+            const float inNoise);
+
+        /// Grows the cache to hold at least the given number of components
+        ///
+        /// \param inNumComponents  Number of components
+        void resize(const size_t inNumComponents);
+
+        /// Moves the state of each component to its new index after components were removed or merged
+        ///
+        /// \param inSources        Previous index of each component (each index at most once), components whose previous index
+        ///                         is out of the range of the cache (e.g. std::numeric_limits<size_t>::max()) start without state
+        void remap(const std::vector<size_t> & inSources);
+
+        float m_tolerance = 0.05f;                      ///< Relative change of a normalized trace (L2 norm) above which its parameters are estimated again
+        float m_changeTolerance = 1e-3f;                ///< Relative change of a trace (L2 norm) above which it is deconvolved again
+        std::vector<std::vector<float>> m_arParams;     ///< AR parameters of each component
+        std::vector<float> m_noise;                     ///< Noise level of each component
+        std::vector<TraceSketch> m_traces;              ///< Sketch of the trace of each component when its parameters were estimated
+        std::vector<TraceSketch> m_solvedTraces;        ///< Sketch of the trace of each component when it was last deconvolved
+        std::vector<TraceSketch> m_solutions;           ///< Sketch of the last deconvolved temporal trace of each component
+        std::vector<arma::SpMat<float>> m_spikes;       ///< Last deconvolved spikes of each component
+        std::vector<float> m_baselines;                 ///< Last baseline of each component
+        std::vector<float> m_initCaVals;                ///< Last initial calcium concentration of each component
+        std::vector<float> m_solutionNoise;             ///< Noise level used for the last solution of each component
+        size_t m_numDeconvolved = 0;                    ///< Number of traces deconvolved with this cache
+        size_t m_numEstimated = 0;                      ///< Number of traces whose noise and AR parameters were estimated with this cache
+    };
+
+    /// Finds the components that spatially overlap each component, i.e. the non-zero entries in each row of AA
+    ///
+    /// \param AA               Overlap of spatial components (K x K)
+    /// \param outNeighbours    Indices of the overlapping components of each component, including itself
+    void computeOverlapNeighbours(const MatrixFloat_t & AA, std::vector<arma::uvec> & outNeighbours);
+
     /// Helper function for updating temporal components using a block coordinate descent approach.
     void updateIteration(
         MatrixFloat_t & YrA,
@@ -31,7 +183,9 @@ namespace isx
         MatrixFloat_t & outG,
         DeconvolutionParams inDeconvParams = DeconvolutionParams(),
         const size_t inIterations = 2,
-        const size_t inNumThreads = 1
+        const size_t inNumThreads = 1,
+        DeconvolutionStateCache * inOutCache = nullptr,
+        TaskScheduler * inScheduler = nullptr
     );
 
     /// Update temporal components given spatial components using a block coordinate descent approach.
@@ -48,6 +202,8 @@ namespace isx
     /// \param inDeconvParams       Deconvolution parameters for estimating noise and AR params
     /// \param inIterations         Maximum number of block coordinate descent loops
     /// \param inNumThreads         Number of worker threads to run deconvolution with
+    /// \param inOutCache           Deconvolution state reused across calls (optional, indexed by component)
+    /// \param inScheduler          Scheduler shared by the stages of a run (nullptr to create one with inNumThreads workers)
     void updateTemporalComponents(
         const MatrixFloat_t & inY,
         const MatrixFloat_t & inA,
@@ -60,40 +216,19 @@ namespace isx
         MatrixFloat_t & outYrA, 
         DeconvolutionParams inDeconvParams = DeconvolutionParams(),
         const size_t inIterations = 2,
-        const size_t inNumThreads = 1
+        const size_t inNumThreads = 1,
+        DeconvolutionStateCache * inOutCache = nullptr,
+        TaskScheduler * inScheduler = nullptr
     );
 
-    /// Determines the update order of the temporal components using a greedy approach
-    /// to find non overlapping spatial components.
+    /// Determines the update order of the temporal components by coloring the overlap graph of
+    /// the spatial components with DSatur, so that each group holds non overlapping components.
+    /// Components are then moved from the largest groups to the smallest ones where possible,
+    /// keeping the number of groups, to even out the parallel work available between barriers.
     ///
-    /// \param A    Input matrix representing spatial components. (K x K)
-    inline std::vector<std::vector<size_t>> updateOrderGreedy(const MatrixFloat_t & A)
-    {
-        const size_t K = A.n_cols;
-        std::vector<std::vector<size_t>> components;
-
-        for (size_t i = 0; i < K; ++i)
-        {
-            bool newList = true;
-            for (auto & list : components)
-            {
-                arma::uvec indices = arma::conv_to<arma::uvec>::from(list);
-                // If no non-zero elements
-                if (!arma::any(arma::vectorise(A.submat(arma::uvec({i}), indices))))
-                {
-                    list.push_back(i);
-                    newList = false;
-                    break;
-                }
-            }
-
-            if (newList)
-            {
-                components.push_back({i});
-            }
-        }
-        return components;
-    }
+    /// \param inNeighbours     Indices of the overlapping components of each component (see computeOverlapNeighbours)
+    /// \return                 Groups of non overlapping components, in increasing order within each group
+    std::vector<std::vector<size_t>> updateOrderDsatur(const std::vector<arma::uvec> & inNeighbours);
 } // namespace isx
 
 #endif //ISX_CNMFE_TEMPORAL_H
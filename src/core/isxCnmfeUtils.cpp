@@ -1,8 +1,8 @@
 #include "isxCnmfeUtils.h"
 #include "isxLassoLars.h"
 #include "isxLog.h"
-#include <opencv2/core/core.hpp>
-#include <opencv2/imgproc/imgproc.hpp>
+#include "isxTaskScheduler.h"
+#include <algorithm>
 #include <map>
 
 namespace isx
@@ -146,72 +146,311 @@ namespace isx
         return {r, c};
     }
 
-    void computeLocalCorr(const CubeFloat_t & inData, MatrixFloat_t & outCorrMatrix)
+    /// Scratch buffers of computeLocalCorr(...)
+    /// Kept per thread so that repeated calls on small boxes do not allocate
+    struct LocalCorrScratch
     {
-        // Get mean of each pixel along time axis (slices)
-        const MatrixFloat_t mean = arma::mean(inData, 2);
+        /// Mean of each pixel
+        std::vector<double> m_mean;
 
-        // Get stddev of each pixel
-        MatrixFloat_t stddev(inData.n_rows, inData.n_cols);
-        for (size_t colIndex = 0; colIndex < inData.n_cols; ++colIndex)
+        /// Inverse of the standard deviation of each pixel (0 for pixels with no variation)
+        std::vector<double> m_invStdDev;
+
+        /// Sums of products of normalized values with the neighbours below, right, below-right and above-right (4 per pixel)
+        std::vector<double> m_products;
+    };
+
+    /// Region of a movie over which the local correlation is computed
+    struct LocalCorrRegion
+    {
+        /// Movie (h x w x t)
+        const CubeFloat_t & m_data;
+
+        /// First row and column of the region in the movie
+        size_t m_row;
+        size_t m_col;
+
+        /// Number of rows and columns of the region
+        size_t m_numRows;
+        size_t m_numCols;
+
+        /// Per-pixel thresholds of the movie (h x w), values below their threshold are read as zero (null for none)
+        const float * m_minValues;
+
+        /// Value of a pixel of the region (given by its index in the region) in a frame of the movie
+        inline double value(const float * inFrame, const size_t inRow, const size_t inCol) const
+        {
+            const size_t p = (m_col + inCol) * m_data.n_rows + m_row + inRow;
+            const float x = inFrame[p];
+            return (m_minValues && x < m_minValues[p]) ? 0.0 : static_cast<double>(x);
+        }
+    };
+
+    /// Accumulates the first two moments of a range of columns of the region over all frames
+    static void accumulateLocalCorrMoments(
+        const LocalCorrRegion & inRegion,
+        const std::pair<size_t, size_t> inCols,
+        LocalCorrScratch & outScratch)
+    {
+        const size_t numRows = inRegion.m_numRows;
+        const size_t first = inCols.first * numRows;
+        const size_t last = inCols.second * numRows;
+        std::fill(outScratch.m_mean.begin() + first, outScratch.m_mean.begin() + last, 0.0);
+        std::fill(outScratch.m_invStdDev.begin() + first, outScratch.m_invStdDev.begin() + last, 0.0);
+
+        for (size_t t = 0; t < inRegion.m_data.n_slices; ++t)
         {
-            // Get a plane through the cube along a col - shape: (inData.n_rows, inData.n_slices)
-            const MatrixFloat_t temp = inData(arma::span::all, arma::span(colIndex), arma::span::all);
-            // Get stddev along time axis
-            stddev.col(colIndex) = arma::stddev(temp, 1, 1);
+            const float * frame = inRegion.m_data.slice_memptr(t);
+            for (size_t col = inCols.first; col < inCols.second; ++col)
+            {
+                for (size_t row = 0; row < numRows; ++row)
+                {
+                    const size_t p = col * numRows + row;
+                    const double x = inRegion.value(frame, row, col);
+                    outScratch.m_mean[p] += x;
+                    outScratch.m_invStdDev[p] += x * x;
+                }
+            }
         }
 
-        // Set all zero values to infinity
-        stddev.transform( [](float val) {return (val == 0) ? std::numeric_limits<float>::max() : val; } );
+        const double n = static_cast<double>(inRegion.m_data.n_slices);
+        for (size_t p = first; p < last; ++p)
+        {
+            const double mean = outScratch.m_mean[p] / n;
+            const double variance = outScratch.m_invStdDev[p] / n - mean * mean;
+            outScratch.m_mean[p] = mean;
+            outScratch.m_invStdDev[p] = (variance > 0.0) ? 1.0 / std::sqrt(variance) : 0.0;
+        }
+    }
 
-        // Process input data
-        CubeFloat_t processedData = inData;
+    /// Accumulates the products of normalized values of neighbouring pixels for a range of columns of the region
+    /// Frames are streamed one at a time and normalized on the fly
+    static void accumulateLocalCorrProducts(
+        const LocalCorrRegion & inRegion,
+        const std::pair<size_t, size_t> inCols,
+        LocalCorrScratch & outScratch)
+    {
+        const size_t numRows = inRegion.m_numRows;
+        const size_t numCols = inRegion.m_numCols;
+        const double * mean = outScratch.m_mean.data();
+        const double * invStdDev = outScratch.m_invStdDev.data();
+        std::fill(outScratch.m_products.begin() + 4 * inCols.first * numRows,
+                  outScratch.m_products.begin() + 4 * inCols.second * numRows, 0.0);
+
+        for (size_t t = 0; t < inRegion.m_data.n_slices; ++t)
+        {
+            const float * frame = inRegion.m_data.slice_memptr(t);
+            auto normalized = [&](const size_t row, const size_t col) -> double
+            {
+                const size_t p = col * numRows + row;
+                return (inRegion.value(frame, row, col) - mean[p]) * invStdDev[p];
+            };
 
-        // Create convolution filter for 8 neighbours
-        // Perform 2D seperable convolution as 2x1D convolutions
-        MatrixFloat_t filter = {{1, 1, 1}};
-        cv::Mat rowFilter = armaToCvMat(filter);
-        cv::Mat colFilter = armaToCvMat(filter, true);
+            for (size_t col = inCols.first; col < inCols.second; ++col)
+            {
+                const bool hasRight = (col + 1 < numCols);
+                for (size_t row = 0; row < numRows; ++row)
+                {
+                    const double z = normalized(row, col);
+                    if (z == 0.0)
+                    {
+                        continue;
+                    }
+
+                    double * products = &outScratch.m_products[4 * (col * numRows + row)];
+                    if (row + 1 < numRows)
+                    {
+                        products[0] += z * normalized(row + 1, col);
+                    }
+                    if (hasRight)
+                    {
+                        products[1] += z * normalized(row, col + 1);
+                        if (row + 1 < numRows)
+                        {
+                            products[2] += z * normalized(row + 1, col + 1);
+                        }
+                        if (row > 0)
+                        {
+                            products[3] += z * normalized(row - 1, col + 1);
+                        }
+                    }
+                }
+            }
+        }
+    }
 
-        for (size_t slice = 0; slice < processedData.n_slices; ++slice)
+    /// Runs a local correlation pass over ranges of columns, in parallel when several threads are requested
+    static void runLocalCorrPass(
+        void (*inPass)(const LocalCorrRegion &, const std::pair<size_t, size_t>, LocalCorrScratch &),
+        const LocalCorrRegion & inRegion,
+        const size_t inNumThreads,
+        TaskScheduler * inScheduler,
+        LocalCorrScratch & outScratch)
+    {
+        const size_t numRanges = std::min(inRegion.m_numCols, inNumThreads);
+        if (numRanges < 2)
         {
-            processedData.slice(slice) -= mean;
-            processedData.slice(slice) /= stddev;
-            cv::Mat mat = armaToCvMat(processedData.slice(slice));
-            cv::sepFilter2D(mat, mat, -1, rowFilter, colFilter, cv::Point(-1, -1), 0, cv::BORDER_CONSTANT);
-            // Subtract each pixel's value from it's correlation result after performing the 2x1D convolution trick
-            processedData.slice(slice) = (cvToArmaMat<float>(mat) - processedData.slice(slice)) % processedData.slice(slice);
+            inPass(inRegion, std::make_pair(size_t(0), inRegion.m_numCols), outScratch);
+            return;
         }
 
-        cv::Mat maskMat = cv::Mat(static_cast<int>(processedData.n_rows), static_cast<int>(processedData.n_cols), CV_64FC1, 1);
-        cv::sepFilter2D(maskMat, maskMat, -1, rowFilter, colFilter, cv::Point(-1, -1), 0, cv::BORDER_CONSTANT);
-        MatrixFloat_t mask = cvToArmaMat<float>(maskMat) - arma::ones<MatrixFloat_t>(processedData.n_rows, processedData.n_cols);
+        // pixels of different column ranges are independent, neighbours in the next column are only read
+        std::shared_ptr<TaskScheduler> scheduler = getTaskScheduler(inScheduler, inNumThreads);
+        std::vector<std::future<void>> results(numRanges);
+        for (size_t idx = 0; idx < numRanges; ++idx)
+        {
+            const std::pair<size_t, size_t> cols(idx * inRegion.m_numCols / numRanges, (idx + 1) * inRegion.m_numCols / numRanges);
+            results[idx] = scheduler->enqueue(inPass, std::cref(inRegion), cols, std::ref(outScratch));
+        }
 
-        outCorrMatrix = arma::mean(processedData, 2);
-        outCorrMatrix /= mask;
+        scheduler->waitAll(results);
     }
 
-    void lassoLars(MatrixFloat_t inX, RowFloat_t inY, ColumnFloat_t & outBeta, const float lambda, const bool positive)
+    /// Computes the local correlation image of a region of a movie
+    static void computeLocalCorrRegion(
+        const LocalCorrRegion & inRegion,
+        MatrixFloat_t & outCorrMatrix,
+        const size_t inNumThreads,
+        TaskScheduler * inScheduler)
+    {
+        // a thread waiting on parallel passes may run other tasks, so only serial calls share the thread's buffers
+        static thread_local LocalCorrScratch threadScratch;
+        LocalCorrScratch localScratch;
+        LocalCorrScratch & scratch = (inNumThreads > 1) ? localScratch : threadScratch;
+
+        const size_t numRows = inRegion.m_numRows;
+        const size_t numCols = inRegion.m_numCols;
+        const size_t numPixels = numRows * numCols;
+        if (scratch.m_mean.size() < numPixels)
+        {
+            scratch.m_mean.resize(numPixels);
+            scratch.m_invStdDev.resize(numPixels);
+            scratch.m_products.resize(4 * numPixels);
+        }
+
+        runLocalCorrPass(accumulateLocalCorrMoments, inRegion, inNumThreads, inScheduler, scratch);
+        runLocalCorrPass(accumulateLocalCorrProducts, inRegion, inNumThreads, inScheduler, scratch);
+
+        // each pair of neighbours is accumulated once, by the pixel on its left or above
+        const double * products = scratch.m_products.data();
+        const double n = static_cast<double>(inRegion.m_data.n_slices);
+        outCorrMatrix.set_size(numRows, numCols);
+        for (size_t col = 0; col < numCols; ++col)
+        {
+            for (size_t row = 0; row < numRows; ++row)
+            {
+                const size_t p = col * numRows + row;
+                const bool hasAbove = row > 0;
+                const bool hasBelow = row + 1 < numRows;
+                const bool hasLeft = col > 0;
+                const bool hasRight = col + 1 < numCols;
+
+                double sum = 0.0;
+                size_t count = 0;
+                if (hasBelow) { sum += products[4 * p]; ++count; }
+                if (hasRight) { sum += products[4 * p + 1]; ++count; }
+                if (hasRight && hasBelow) { sum += products[4 * p + 2]; ++count; }
+                if (hasRight && hasAbove) { sum += products[4 * p + 3]; ++count; }
+                if (hasAbove) { sum += products[4 * (p - 1)]; ++count; }
+                if (hasLeft) { sum += products[4 * (p - numRows) + 1]; ++count; }
+                if (hasLeft && hasAbove) { sum += products[4 * (p - numRows - 1) + 2]; ++count; }
+                if (hasLeft && hasBelow) { sum += products[4 * (p - numRows + 1) + 3]; ++count; }
+
+                outCorrMatrix(row, col) = (count > 0) ? static_cast<float>(sum / (n * count)) : 0.0f;
+            }
+        }
+    }
+
+    void computeLocalCorr(const CubeFloat_t & inData, MatrixFloat_t & outCorrMatrix, const size_t inNumThreads, TaskScheduler * inScheduler)
+    {
+        const LocalCorrRegion region{inData, 0, 0, inData.n_rows, inData.n_cols, nullptr};
+        computeLocalCorrRegion(region, outCorrMatrix, inNumThreads, inScheduler);
+    }
+
+    void computeLocalCorr(
+        const CubeFloat_t & inData,
+        const std::tuple<size_t,size_t,size_t,size_t> & inRoi,
+        const MatrixFloat_t & inMinValues,
+        MatrixFloat_t & outCorrMatrix,
+        const size_t inNumThreads,
+        TaskScheduler * inScheduler)
+    {
+        const LocalCorrRegion region{
+            inData,
+            std::get<0>(inRoi),
+            std::get<2>(inRoi),
+            std::get<1>(inRoi) - std::get<0>(inRoi) + 1,
+            std::get<3>(inRoi) - std::get<2>(inRoi) + 1,
+            inMinValues.empty() ? nullptr : inMinValues.memptr()};
+        computeLocalCorrRegion(region, outCorrMatrix, inNumThreads, inScheduler);
+    }
+
+    void prepareLassoLarsDesign(MatrixFloat_t inX, LassoLarsDesign & outDesign)
     {
         // normalize data
         inX.each_row() -= arma::mean(inX, 0);
-        RowFloat_t norms(inX.n_cols);
+        outDesign.m_norms.set_size(inX.n_cols);
         for (size_t idx = 0; idx < inX.n_cols; idx++)
         {
-            norms.at(idx) = arma::norm(inX.col(idx));
+            outDesign.m_norms.at(idx) = arma::norm(inX.col(idx));
         }
-        inX.each_row() /= norms;
+        inX.each_row() /= outDesign.m_norms;
+        inX /= static_cast<float>(inX.n_rows);
+
+        outDesign.m_gram = inX.t() * inX;
+        outDesign.m_x = std::move(inX);
+    }
+
+    void lassoLars(MatrixFloat_t inX, RowFloat_t inY, ColumnFloat_t & outBeta, const float lambda, const bool positive)
+    {
+        LassoLarsDesign design;
+        prepareLassoLarsDesign(std::move(inX), design);
+        lassoLars(design, std::move(inY), outBeta, lambda, positive);
+    }
+
+    void lassoLars(const LassoLarsDesign & inDesign, RowFloat_t inY, ColumnFloat_t & outBeta, const float lambda, const bool positive)
+    {
+        const size_t numObservations = inDesign.m_x.n_rows;
         inY -= arma::mean(inY);
+        inY /= static_cast<float>(numObservations);
 
-        inX /= static_cast<float>(inX.n_rows);
-        inY /= static_cast<float>(inX.n_rows);
+        // train model
+        LARS<float> lars(true, inDesign.m_gram, lambda/numObservations, 0.0, 2.220446049250313e-16);
+        lars.Train(inDesign.m_x, inY, outBeta, false);
+
+        // adjust betas
+        outBeta /= inDesign.m_norms.t();
+        if (positive)
+        {
+            outBeta.elem(arma::find(outBeta < 0)).zeros();
+        }
+    }
+
+    void lassoLars(
+        const LassoLarsDesign & inDesign,
+        const arma::uvec & inPredictors,
+        const MatrixFloat_t & inGram,
+        const RowFloat_t & inY,
+        ColumnFloat_t & outBeta,
+        const float lambda,
+        const bool positive)
+    {
+        // center the response as the other overloads do, the centered predictors make this exact in theory
+        // but the mean of a large response would otherwise cancel in float precision in the products below
+        const size_t numObservations = inDesign.m_x.n_rows;
+        const ColumnFloat_t y = (inY.t() - arma::mean(inY)) / static_cast<float>(numObservations);
+        ColumnFloat_t xy(inPredictors.n_elem);
+        for (size_t idx = 0; idx < inPredictors.n_elem; idx++)
+        {
+            xy.at(idx) = arma::dot(inDesign.m_x.col(inPredictors(idx)), y);
+        }
 
         // train model
-        LARS<float> lars(true, lambda/inX.n_rows, 0.0, 2.220446049250313e-16);
-        lars.Train(inX, inY, outBeta, false);
+        LARS<float> lars(true, inGram, lambda/numObservations, 0.0, 2.220446049250313e-16);
+        lars.TrainCovariance(xy, outBeta);
 
         // adjust betas
-        outBeta /= norms.t();
+        outBeta /= ColumnFloat_t(inDesign.m_norms.elem(inPredictors));
         if (positive)
         {
             outBeta.elem(arma::find(outBeta < 0)).zeros();
@@ -3,6 +3,9 @@
 
 #include "isxArmaUtils.h"
 #include "isxCnmfeParams.h"
+#include "isxTaskScheduler.h"
+
+#include <tuple>
 
 namespace isx
 {
@@ -30,11 +33,46 @@ namespace isx
     /// \param inMatrix    Input matrix
     std::pair<float,float> computeCentroid(const MatrixFloat_t inMatrix);
 
-    /// Computes the correlation image (8 neighbors for each pixeL) for inData using an optimized FFT-based method
+    /// Computes the correlation image (8 neighbors for each pixeL) for inData
+    /// Frames are streamed and normalized on the fly, the products of neighbouring pixels are accumulated
+    /// in scratch buffers reused across calls from the same thread
     ///
     /// \param inData               Cube of movie data (h x w x t)
     /// \param outCorrMatrix        Matrix of cross-correlation with adjacent pixels
-    void computeLocalCorr(const CubeFloat_t & inData, MatrixFloat_t & outCorrMatrix);
+    /// \param inNumThreads         Number of threads used to process ranges of columns in parallel
+    /// \param inScheduler          Scheduler shared by the stages of a run (nullptr to create one with inNumThreads workers)
+    void computeLocalCorr(const CubeFloat_t & inData, MatrixFloat_t & outCorrMatrix, const size_t inNumThreads = 1, TaskScheduler * inScheduler = nullptr);
+
+    /// Computes the correlation image (8 neighbors for each pixel) of a region of inData
+    /// Values below their pixel threshold are read as zero, so no thresholded copy of the movie is needed
+    ///
+    /// \param inData               Cube of movie data (h x w x t)
+    /// \param inRoi                Region defined as (start row index, end row index, start col index, end col index)
+    /// \param inMinValues          Threshold of each pixel of the movie (h x w), or an empty matrix for no threshold
+    /// \param outCorrMatrix        Matrix of cross-correlation with adjacent pixels within the region
+    /// \param inNumThreads         Number of threads used to process ranges of columns in parallel
+    /// \param inScheduler          Scheduler shared by the stages of a run (nullptr to create one with inNumThreads workers)
+    void computeLocalCorr(
+        const CubeFloat_t & inData,
+        const std::tuple<size_t,size_t,size_t,size_t> & inRoi,
+        const MatrixFloat_t & inMinValues,
+        MatrixFloat_t & outCorrMatrix,
+        const size_t inNumThreads = 1,
+        TaskScheduler * inScheduler = nullptr);
+
+    /// Normalized predictors of a Lasso model, which can be shared between fits using any subset of the predictors
+    struct LassoLarsDesign
+    {
+        MatrixFloat_t m_x;      ///< Centered predictors with unit norm columns, scaled by the number of observations
+        MatrixFloat_t m_gram;   ///< Gram matrix of m_x
+        RowFloat_t m_norms;     ///< Norm of each centered predictor
+    };
+
+    /// Centers and normalizes predictors and computes their Gram matrix for use with lassoLars
+    ///
+    /// \param inX        Predictors (observations x predictor values)
+    /// \param outDesign  Normalized predictors and Gram matrix
+    void prepareLassoLarsDesign(MatrixFloat_t inX, LassoLarsDesign & outDesign);
 
     /// Computes the coefficients of a Lasso model fit using Least Angle Regression (aka Lars)
     ///
@@ -44,6 +82,35 @@ namespace isx
     /// \param positive   Restricts coefficients to be positive if true
     void lassoLars(MatrixFloat_t inX, RowFloat_t inY, ColumnFloat_t & outBeta, const float lambda, const bool positive);
 
+    /// Computes the coefficients of a Lasso model fit using Least Angle Regression (aka Lars)
+    /// from predictors that have already been normalized with prepareLassoLarsDesign
+    ///
+    /// \param inDesign   Normalized predictors and Gram matrix
+    /// \param inY        Response variable
+    /// \param outBeta    Model coefficients
+    /// \param positive   Restricts coefficients to be positive if true
+    void lassoLars(const LassoLarsDesign & inDesign, RowFloat_t inY, ColumnFloat_t & outBeta, const float lambda, const bool positive);
+
+    /// Computes the coefficients of a Lasso model fit using Least Angle Regression (aka Lars)
+    /// on a subset of predictors that have already been normalized with prepareLassoLarsDesign.
+    /// The fit only uses the Gram matrix and the correlations of the selected predictors with the response,
+    /// so no copy of the selected predictors is made.
+    ///
+    /// \param inDesign       Normalized predictors and Gram matrix
+    /// \param inPredictors   Indices of the predictors used in the model
+    /// \param inGram         Gram matrix of the selected predictors (i.e. rows and columns inPredictors of inDesign.m_gram)
+    /// \param inY            Response variable
+    /// \param outBeta        Model coefficients of the selected predictors
+    /// \param positive       Restricts coefficients to be positive if true
+    void lassoLars(
+        const LassoLarsDesign & inDesign,
+        const arma::uvec & inPredictors,
+        const MatrixFloat_t & inGram,
+        const RowFloat_t & inY,
+        ColumnFloat_t & outBeta,
+        const float lambda,
+        const bool positive);
+
     /// Remove empty components from the set of footprints and traces - empty means flat trace or black footprint
     ///
     /// \param inOutA               Spatial footprints
@@ -3,12 +3,51 @@
 #include "isxCnmfeIO.h"
 #include "isxTiffMovie.h"
 #include "isxCnmfePatch.h"
+#include "isxCnmfeInitialization.h"
 #include "isxLog.h"
+#include "isxTaskScheduler.h"
 #include "json.hpp"
+#include <algorithm>
+#include <stdexcept>
 #include <tuple>
 
 namespace isx
 {
+    static const char * const s_appName = "Inscopix CNMF-E";
+
+    /// Selects the frames of a movie read for a preview
+    /// Consecutive frames are kept so that the noise of each pixel is estimated as in a full run
+    ///
+    /// \param inNumFrames      Number of frames in the movie
+    /// \param inMaxNumFrames   Maximum number of frames to select (<= 0 to select all frames)
+    /// \return                 Indices of the selected frames, in increasing order (empty for an empty movie)
+    static arma::uvec getPreviewFrames(const size_t inNumFrames, const int inMaxNumFrames)
+    {
+        if (inNumFrames == 0)
+        {
+            return arma::uvec();
+        }
+        if (inMaxNumFrames <= 0 || inNumFrames <= static_cast<size_t>(inMaxNumFrames))
+        {
+            return arma::regspace<arma::uvec>(0, inNumFrames - 1);
+        }
+
+        // segments at the start, middle and end of the movie (a single segment in the middle for fewer than 3 frames)
+        const size_t maxNumFrames = static_cast<size_t>(inMaxNumFrames);
+        const size_t numSegments = std::min(maxNumFrames, size_t(3));
+        const size_t segmentLength = maxNumFrames / numSegments;
+        arma::uvec frames(numSegments * segmentLength);
+        for (size_t segment = 0; segment < numSegments; ++segment)
+        {
+            const size_t first = (numSegments > 1)
+                ? segment * (inNumFrames - segmentLength) / (numSegments - 1)
+                : (inNumFrames - segmentLength) / 2;
+            frames.subvec(segment * segmentLength, (segment + 1) * segmentLength - 1) =
+                arma::regspace<arma::uvec>(first, first + segmentLength - 1);
+        }
+        return frames;
+    }
+
     std::tuple<arma::Cube<float>,arma::Mat<float>> cnmfe(
         const std::string & inputMoviePath,
         const std::string & outputDirPath,
@@ -27,7 +66,8 @@ namespace isx
         const int patchOverlap,
         const int traceOutputUnits,
         const int deconvolve,
-        const int verbose)
+        const int verbose,
+        const int spatialSolver)
     {
         using nlohmann::json;
 
@@ -38,10 +78,8 @@ namespace isx
 
         const std::string timeStamp = getCurrentDateTime("%Y%m%d-%H%M%S", false);
         const std::string logFileName = outputDirPath.empty() ? "" : outputDirPath + "/" + "Inscopix_CNMF-E_Log_" + timeStamp + ".txt";
-        const std::string appName = "Inscopix CNMF-E";
-        const std::string appVersion = "1.0.2";
         const bool verboseEnabled = verbose==1 ? true : false;
-        Logger::initialize(logFileName, appName, appVersion, verboseEnabled);
+        Logger::initialize(logFileName, s_appName, s_cnmfeVersion, verboseEnabled);
 
         nlohmann::json params;
         params["inputMoviePath"] = inputMoviePath;
@@ -62,6 +100,7 @@ namespace isx
         params["traceOutputUnits"] = traceOutputUnits;
         params["deconvolve"] = deconvolve;
         params["verbose"] = verbose;
+        params["spatialSolver"] = spatialSolver;
         ISX_LOG_INFO("CNMF-E parameters:\n" + params.dump(4));
 
         const SpTiffMovie_t movie = std::shared_ptr<TiffMovie>(new TiffMovie(inputMoviePath));
@@ -79,6 +118,7 @@ namespace isx
         SpatialParams spatialParams;
         spatialParams.m_bgSsub = backgroundDownsamplingFactor;
         spatialParams.m_closingKSize = closingKernelSize;
+        spatialParams.m_solver = static_cast<SpatialSolver_t>(spatialSolver);
 
         DeconvolutionParams deconvParams;
 
@@ -92,11 +132,14 @@ namespace isx
 
         const CnmfeOutputType_t outputType = static_cast<CnmfeOutputType_t>(traceOutputUnits);
 
+        // worker threads are shared by all parallel stages of this run
+        TaskScheduler taskScheduler(static_cast<size_t>(std::max(numThreads, 1)));
+
         // run cnmfe
         CubeFloat_t footprints;  // spatial footprints
         MatrixFloat_t traces;    // raw temporal traces
         patchCnmfe(movie, memoryMapPath, footprints, traces, deconvParams, initParams, spatialParams, patchParams,
-           maxNumNeurons, ringSizeFactor, mergeThreshold, numIterations, numThreads, outputType, deconvolve);
+           maxNumNeurons, ringSizeFactor, mergeThreshold, numIterations, numThreads, outputType, deconvolve, &taskScheduler);
 
         if (footprints.n_slices == 0 || traces.n_rows == 0)
         {
@@ -123,4 +166,57 @@ namespace isx
 
         return std::make_tuple(footprints, traces);
     }
+
+    std::tuple<arma::Mat<float>,arma::Mat<float>,arma::Mat<float>> cnmfePreview(
+        const std::string & inputMoviePath,
+        const int averageCellDiameter,
+        const float minCorr,
+        const float minPnr,
+        const int gaussianKernelSize,
+        const int maxNumFrames,
+        const int numThreads,
+        const int verbose)
+    {
+        const bool verboseEnabled = verbose==1 ? true : false;
+        Logger::initialize("", s_appName, s_cnmfeVersion, verboseEnabled);
+
+        const SpTiffMovie_t movie = std::shared_ptr<TiffMovie>(new TiffMovie(inputMoviePath));
+
+        // same initialization parameters as cnmfe(...), including the auto estimated filter size
+        InitializationParams initParams;
+        initParams.m_averageCellDiameter = averageCellDiameter * 2;
+        initParams.m_minCorr = minCorr;
+        initParams.m_minPNR = minPnr;
+        initParams.m_gaussianKernelSize = gaussianKernelSize;
+        if (initParams.m_gaussianKernelSize < 2)
+        {
+            initParams.m_gaussianKernelSize = estimateFilterSize(initParams.m_averageCellDiameter);
+        }
+
+        const arma::uvec frames = getPreviewFrames(movie->getNumFrames(), maxNumFrames);
+        if (frames.is_empty())
+        {
+            const std::string errorMessage = "Cannot preview a movie with no frames: " + inputMoviePath;
+            ISX_LOG_WARNING(errorMessage);
+            throw std::runtime_error(errorMessage);
+        }
+        ISX_LOG_INFO("Reading ", frames.n_elem, " of ", movie->getNumFrames(), " frames for preview");
+
+        CubeFloat_t data(movie->getFrameHeight(), movie->getFrameWidth(), frames.n_elem);
+        for (size_t i = 0; i < frames.n_elem; ++i)
+        {
+            MatrixFloat_t frame;
+            movie->getFrame(frames(i), frame);
+            data.slice(i) = frame;
+        }
+
+        const size_t numWorkers = static_cast<size_t>(std::max(numThreads, 1));
+        TaskScheduler taskScheduler(numWorkers);
+
+        MatrixFloat_t pnr, localCorr, seeds;
+        computeSeedSearchImages(data, initParams, pnr, localCorr, seeds, numWorkers, &taskScheduler);
+        ISX_LOG_INFO(arma::accu(seeds > 0), " candidate seed pixels");
+
+        return std::make_tuple(pnr, localCorr, seeds);
+    }
 }
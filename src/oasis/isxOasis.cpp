@@ -1,7 +1,74 @@
 #include "isxOasis.h"
 
+#include <algorithm>
+#include <limits>
+
 namespace isx
 {
+    const size_t DecayPowers::s_maxNumPowers = size_t(1) << 20;
+
+    DecayPowers::DecayPowers()
+        : m_gamma(std::numeric_limits<float>::quiet_NaN()), m_maxNumPowers(0), m_capped(true)
+    {
+    }
+
+    DecayPowers::DecayPowers(const float inGamma, const size_t inMaxNumPowers)
+        : DecayPowers()
+    {
+        reset(inGamma, inMaxNumPowers);
+    }
+
+    void DecayPowers::reset(const float inGamma, const size_t inMaxNumPowers)
+    {
+        const size_t maxNumPowers = std::min(inMaxNumPowers, s_maxNumPowers);
+        // a table that underflowed before its length holds all powers needed for longer traces
+        if (inGamma == m_gamma &&
+            (maxNumPowers == m_maxNumPowers || (!m_capped && maxNumPowers >= m_powers.size())))
+        {
+            return;
+        }
+
+        m_gamma = inGamma;
+        m_maxNumPowers = maxNumPowers;
+        m_capped = false;
+        m_powers.clear();
+
+        if (!(std::abs(m_gamma) < 1.0f))
+        {
+            // powers do not decay, all of them are computed with std::pow
+            m_capped = true;
+            return;
+        }
+
+        // denormal powers are treated as zero, repeated multiplication gets stuck at the smallest denormal
+        float tmp = 1.0f;
+        while (std::abs(tmp) >= std::numeric_limits<float>::min())
+        {
+            if (m_powers.size() == maxNumPowers)
+            {
+                m_capped = true;
+                break;
+            }
+            m_powers.push_back(tmp);
+            tmp *= m_gamma;
+        }
+    }
+
+    void DecayPowers::addScaled(const float inScale, ColumnFloat_t & inOutTrace) const
+    {
+        const size_t numPowers = std::min<size_t>(inOutTrace.n_elem, m_powers.size());
+        if (numPowers > 0)
+        {
+            const arma::Col<float> powers(const_cast<float *>(m_powers.data()), numPowers, false, true);
+            inOutTrace.head(numPowers) += inScale * powers;
+        }
+
+        for (size_t t = numPowers; m_capped && t < inOutTrace.n_elem; t++)
+        {
+            inOutTrace(t) += inScale * std::pow(m_gamma, static_cast<float>(t));
+        }
+    }
+
     void Oasis::solveFoopsi(
         const ColumnFloat_t &inY,
         float &outB,
@@ -17,7 +84,8 @@ namespace isx
         // Remove initial calcium to align with other foopsi methods
         // Added back in constrainedFoopsiParallel
         outCa1 = m_C(0);
-        outC = m_C - outCa1 * m_filter(arma::span(0, m_T - 1));
+        outC = m_C;
+        m_filter.addScaled(-outCa1, outC);
         outB = m_b;
     }
 
@@ -44,15 +112,17 @@ namespace isx
     void Oasis::initialize(const ColumnFloat_t &inY)
     {
         m_T = inY.n_elem;
-        m_C = ColumnFloat_t(m_T);
+        m_C.set_size(m_T);
 
-        float tmp = 1.0f;
-        m_filter = ColumnFloat_t(2 * m_T);
-        for (size_t power = 0; power < 2 * m_T; power++)
+        // The kernel is only recomputed when the decay constant or the trace length changes
+        m_filter.reset(m_gamma, m_T);
+
+        // At most one pool per time point
+        if (m_pools.size() < m_T)
         {
-            m_filter(power) = tmp;
-            tmp *= m_gamma;
+            m_pools.resize(m_T);
         }
+        m_numPools = 0;
 
         m_b = nthPercentile(inY, 0.15f);
         m_errorThreshold = m_noise * m_noise * m_T;
@@ -60,58 +130,55 @@ namespace isx
 
     void Oasis::run(const ColumnFloat_t &inY)
     {
-        std::list<Pool>::iterator curr, prev;
-
         // Create pool for each value in Y
-        m_pools.push_back(Pool(inY(0) - m_b, 1, 0, 1));
+        size_t top = 0;
+        m_pools[0] = Pool(inY(0) - m_b, 1, 0, 1);
         for (size_t t = 1; t < m_T; t++)
         {
-            m_pools.push_back(Pool(inY(t) - m_b, 1, t, 1));
-            prev = curr = --m_pools.end(); // last element
-            --prev;
-            resolveViolations(prev, curr);
+            m_pools[++top] = Pool(inY(t) - m_b, 1, t, 1);
+            resolveViolations(top);
         }
+        m_numPools = top + 1;
 
         constructSolution();
     }
 
     void Oasis::run()
     {
-        std::list<Pool>::iterator curr, prev;
-        prev = curr = m_pools.begin();
-        curr++;
-        while (curr != m_pools.end())
+        // Pools are compacted in place, the pools above the top of the stack are yet to be visited
+        size_t top = 0;
+        for (size_t next = 1; next < m_numPools; next++)
         {
-            resolveViolations(prev, curr);
-            prev = curr++;
+            m_pools[++top] = m_pools[next];
+            resolveViolations(top);
         }
+        m_numPools = top + 1;
 
         constructSolution();
     }
 
-    void Oasis::resolveViolations(
-        std::list<Pool>::iterator &prev,
-        std::list<Pool>::iterator &curr)
+    void Oasis::resolveViolations(size_t &inOutTop)
     {
-        while (curr != m_pools.begin() && // Backtrack until violations of calcium dynamics are resolved
-               (*prev).m_v / (*prev).m_w * m_filter((*prev).m_l) > (*curr).m_v / (*curr).m_w)
+        while (inOutTop > 0 && // Backtrack until violations of calcium dynamics are resolved
+               m_pools[inOutTop - 1].m_v / m_pools[inOutTop - 1].m_w * filter(m_pools[inOutTop - 1].m_l) > m_pools[inOutTop].m_v / m_pools[inOutTop].m_w)
         {
             // Merge pools
-            (*prev).m_v += (*curr).m_v * m_filter((*prev).m_l);
-            (*prev).m_w += (*curr).m_w * m_filter(2 * (*prev).m_l);
-            (*prev).m_l += (*curr).m_l;
+            Pool &prev = m_pools[inOutTop - 1];
+            const Pool &curr = m_pools[inOutTop];
+            prev.m_v += curr.m_v * filter(prev.m_l);
+            prev.m_w += curr.m_w * filter(2 * prev.m_l);
+            prev.m_l += curr.m_l;
 
-            curr = m_pools.erase(curr);
-            --curr;
-            --prev;
+            --inOutTop;
         }
     }
 
     void Oasis::constructSolution()
     {
         float tmp;
-        for (const auto &pool : m_pools)
+        for (size_t i = 0; i < m_numPools; i++)
         {
+            const Pool &pool = m_pools[i];
             tmp = fmax(pool.m_v, 0.0f) / pool.m_w;
             for (size_t k = 0; k < pool.m_l; k++)
             {
@@ -125,28 +192,30 @@ namespace isx
     {
         // Calculate total shift due to contribution of lambda and baseline
         ColumnFloat_t shift(m_T);
-        std::list<Pool>::iterator lastIt = --m_pools.end();
+        const size_t last = m_numPools - 1;
         float tmp;
-        for (std::list<Pool>::iterator it = m_pools.begin(); it != m_pools.end(); ++it)
+        for (size_t i = 0; i < m_numPools; i++)
         {
-            if (it == lastIt)
+            const Pool &pool = m_pools[i];
+            if (i == last)
             {
-                tmp = 1.0f / (*it).m_w;
+                tmp = 1.0f / pool.m_w;
             }
             else
             {
-                tmp = (1.0f - m_filter((*it).m_l)) / (*it).m_w;
+                tmp = (1.0f - filter(pool.m_l)) / pool.m_w;
             }
-            for (size_t j = 0; j < (*it).m_l; j++)
+            for (size_t j = 0; j < pool.m_l; j++)
             {
-                shift((*it).m_t + j) = tmp;
+                shift(pool.m_t + j) = tmp;
                 tmp *= m_gamma;
             }
         }
         tmp = 0.0f;
-        for (const auto &pool : m_pools)
+        for (size_t i = 0; i < m_numPools; i++)
         {
-            tmp += (1.0f - m_filter(pool.m_l)) * (1.0f - m_filter(pool.m_l)) / pool.m_w;
+            const Pool &pool = m_pools[i];
+            tmp += (1.0f - filter(pool.m_l)) * (1.0f - filter(pool.m_l)) / pool.m_w;
         }
         shift -= 1.0f / m_T / (1.0f - m_gamma) * tmp;
         float alpha = arma::dot(shift, shift);
@@ -164,9 +233,9 @@ namespace isx
 
         m_b += deltaPhi * (1.0f - m_gamma);
         // Perform shift on pools
-        for (std::list<Pool>::iterator it = m_pools.begin(); it != m_pools.end(); ++it)
+        for (size_t i = 0; i < m_numPools; i++)
         {
-            (*it).m_v -= deltaPhi * (1.0f - m_filter((*it).m_l));
+            m_pools[i].m_v -= deltaPhi * (1.0f - filter(m_pools[i].m_l));
         }
     }
 
@@ -175,10 +244,109 @@ namespace isx
         float deltaB = arma::mean(inY - m_C) - m_b;
         m_b += deltaB;
         float deltaLambda = -deltaB / (1.0f - m_gamma);
-        std::list<Pool>::iterator lastIt = --m_pools.end();
-        (*lastIt).m_v -= deltaLambda * m_filter((*lastIt).m_l);
-        m_C(arma::span((*lastIt).m_t, (*lastIt).m_t + (*lastIt).m_l - 1)) =
-            fmax((*lastIt).m_v, 0.0f) / (*lastIt).m_w * m_filter(arma::span(0, (*lastIt).m_l - 1));
+        Pool &lastPool = m_pools[m_numPools - 1];
+        lastPool.m_v -= deltaLambda * filter(lastPool.m_l);
+        const float lastValue = fmax(lastPool.m_v, 0.0f) / lastPool.m_w;
+        for (size_t k = 0; k < lastPool.m_l; k++)
+        {
+            m_C(lastPool.m_t + k) = lastValue * filter(k);
+        }
+    }
+
+    OnlineOasis::OnlineOasis(
+        const float inGamma,
+        const float inBaseline,
+        const float inLambda,
+        const size_t inLag)
+        : m_gamma(inGamma), m_baseline(inBaseline), m_lambda(inLambda), m_lag(inLag),
+          m_T(0), m_numFinalized(0), m_lastC(0.0f), m_filter(inGamma)
+    {
+    }
+
+    void OnlineOasis::update(
+        const ColumnFloat_t &inY,
+        ColumnFloat_t &outC,
+        ColumnFloat_t &outS)
+    {
+        std::vector<float> c, s;
+        for (size_t t = 0; t < inY.n_elem; t++)
+        {
+            push(inY(t));
+            if (m_T > m_lag)
+            {
+                finalize(m_T - m_lag, c, s);
+            }
+        }
+
+        outC = ColumnFloat_t(c);
+        outS = ColumnFloat_t(s);
+    }
+
+    void OnlineOasis::flush(
+        ColumnFloat_t &outC,
+        ColumnFloat_t &outS)
+    {
+        std::vector<float> c, s;
+        finalize(m_T, c, s);
+
+        outC = ColumnFloat_t(c);
+        outS = ColumnFloat_t(s);
+    }
+
+    size_t OnlineOasis::getNumSamples() const
+    {
+        return m_T;
+    }
+
+    size_t OnlineOasis::getNumFinalized() const
+    {
+        return m_numFinalized;
+    }
+
+    void OnlineOasis::push(const float inY)
+    {
+        m_pools.push_back(Pool(inY - m_baseline - m_lambda * (1.0f - m_gamma), 1, m_T, 1));
+        m_T++;
+
+        // Backtrack until violations of calcium dynamics are resolved
+        while (m_pools.size() > 1)
+        {
+            Pool &prev = m_pools[m_pools.size() - 2];
+            const Pool &curr = m_pools.back();
+            if (prev.m_v / prev.m_w * power(prev.m_l) <= curr.m_v / curr.m_w)
+            {
+                break;
+            }
+
+            // Merge pools
+            prev.m_v += curr.m_v * power(prev.m_l);
+            prev.m_w += curr.m_w * power(2 * prev.m_l);
+            prev.m_l += curr.m_l;
+            m_pools.pop_back();
+        }
+    }
+
+    void OnlineOasis::finalize(
+        const size_t inEnd,
+        std::vector<float> &outC,
+        std::vector<float> &outS)
+    {
+        while (m_numFinalized < inEnd && !m_pools.empty())
+        {
+            // bottom pools are dropped once all their values are finalized, the top pool is always kept
+            // (a fully finalized top pool stays until a later sample either merges into it or opens a new pool)
+            while (m_pools.size() > 1 && m_numFinalized >= m_pools.front().m_t + m_pools.front().m_l)
+            {
+                m_pools.pop_front();
+            }
+
+            const Pool &pool = m_pools.front();
+            const float c = fmax(pool.m_v, 0.0f) / pool.m_w * power(m_numFinalized - pool.m_t);
+            outC.push_back(c);
+            outS.push_back(m_numFinalized == 0 ? 0.0f : c - m_gamma * m_lastC);
+            m_lastC = c;
+            m_numFinalized++;
+        }
     }
 
 } // namespace isx
@@ -2,7 +2,9 @@
 #define ISX_CNMFE_OASIS_H
 
 #include "isxArmaUtils.h"
-#include <list>
+#include <cmath>
+#include <deque>
+#include <vector>
 
 namespace isx
 {
@@ -31,6 +33,70 @@ namespace isx
         }
     };
 
+    /// Table of the powers of a calcium decay constant, gamma^k
+    ///
+    /// Powers are computed by repeated multiplication and stored up to the number of powers needed
+    /// (e.g. the length of the traces the table is applied to) or until they underflow (higher powers are zero).
+    /// Each solver owns its table and recomputes it only when the decay constant or the number of powers changes.
+    class DecayPowers
+    {
+    public:
+        /// Maximum number of powers stored, powers of decay constants close to 1 are computed with std::pow beyond it
+        static const size_t s_maxNumPowers;
+
+        /// Constructor, the table is empty until reset
+        ///
+        DecayPowers();
+
+        /// Constructor
+        ///
+        /// \param inGamma            Calcium dynamics decay constant
+        /// \param inMaxNumPowers     Number of powers needed
+        explicit DecayPowers(const float inGamma, const size_t inMaxNumPowers = s_maxNumPowers);
+
+        /// Recomputes the table for a decay constant, keeping its storage
+        /// Nothing is computed if the table of the decay constant already holds the powers needed.
+        ///
+        /// \param inGamma            Calcium dynamics decay constant
+        /// \param inMaxNumPowers     Number of powers needed
+        void reset(const float inGamma, const size_t inMaxNumPowers);
+
+        /// \return decay constant of the table
+        float getGamma() const
+        {
+            return m_gamma;
+        }
+
+        /// \return number of powers stored in the table, higher powers are zero unless the table was capped
+        size_t getNumPowers() const
+        {
+            return m_powers.size();
+        }
+
+        /// \param inPower            Exponent
+        /// \return                   Decay constant to the given power
+        float operator()(const size_t inPower) const
+        {
+            if (inPower < m_powers.size())
+            {
+                return m_powers[inPower];
+            }
+            return m_capped ? std::pow(m_gamma, static_cast<float>(inPower)) : 0.0f;
+        }
+
+        /// Adds a scaled decaying exponential to a trace, out(t) += inScale * gamma^t
+        ///
+        /// \param inScale            Value of the exponential at t = 0
+        /// \param inOutTrace         Trace to add the exponential to
+        void addScaled(const float inScale, ColumnFloat_t & inOutTrace) const;
+
+    private:
+        float m_gamma;                  ///< Calcium dynamics decay constant
+        size_t m_maxNumPowers;          ///< Number of powers requested
+        bool m_capped;                  ///< True if the table was capped before the powers underflowed
+        std::vector<float> m_powers;    ///< Powers of the decay constant until they underflow or reach the number requested
+    };
+
     /// Class implementing the OASIS model
     ///
     class Oasis
@@ -42,7 +108,18 @@ namespace isx
             const float inGamma,
             const float inNoise,
             const size_t inMaxIterations = 5)
-            : m_gamma(inGamma), m_noise(inNoise), m_maxIterations(inMaxIterations) {}
+            : m_gamma(inGamma), m_noise(inNoise), m_maxIterations(inMaxIterations), m_T(0), m_numPools(0) {}
+
+        /// Sets the model parameters used by subsequent calls to solveFoopsi
+        /// The solver keeps its buffers so it can be reused across traces without reallocating
+        ///
+        /// \param inGamma            Calcium dynamics decay constant
+        /// \param inNoise            Standard deviation of estimated noise
+        void setParameters(const float inGamma, const float inNoise)
+        {
+            m_gamma = inGamma;
+            m_noise = inNoise;
+        }
 
         /// Denoise and deconvolve the calcium concentration dynamics and neural spike activity
         /// from a raw fluorescence trace using the OASIS algorithm
@@ -62,15 +139,23 @@ namespace isx
             ColumnFloat_t &outS);
 
     private:
-        const float m_gamma;           ///< Calcium dynamics decay constant
-        const float m_noise;           ///< Standard deviation of estimated noise
+        float m_gamma;                 ///< Calcium dynamics decay constant
+        float m_noise;                 ///< Standard deviation of estimated noise
         const size_t m_maxIterations;  ///< Maximum number of iteration to allow hyper-parameters to converge
         float m_errorThreshold;        ///< Hard constraint on the minimum acceptable error in the final solution generated
         float m_b;                     ///< Offset baseline
         size_t m_T;                    ///< Size of input temporal trace
         ColumnFloat_t m_C;             ///< Constructed solution of denoised calcium concentration dynamics
-        ColumnFloat_t m_filter;        ///< Precomputed calcium kernel which appears often throughout calculations
-        std::list<Pool> m_pools;       ///< Groups of values which satisfy constraints of calcium dynamics (i.e., grouping of spikes)
+        std::vector<Pool> m_pools;     ///< Stack of groups of values which satisfy constraints of calcium dynamics (i.e., grouping of spikes)
+        size_t m_numPools;             ///< Number of pools on the stack, the first m_numPools entries of m_pools
+        DecayPowers m_filter;          ///< Precomputed calcium kernel which appears often throughout calculations, up to the trace length
+
+        /// \param inPower            Exponent
+        /// \return                   Calcium kernel at the given time lag
+        float filter(const size_t inPower) const
+        {
+            return m_filter(inPower);
+        }
 
         /// Fits the model to the raw flurescence trace observed
         ///
@@ -92,10 +177,10 @@ namespace isx
         void run();
 
         /// Resolve violations of the calcium dynamics constraint
+        /// Merges the pool at the top of the stack with the pools below it until the constraint holds
         ///
-        void resolveViolations(
-            std::list<Pool>::iterator &prev,
-            std::list<Pool>::iterator &curr);
+        /// \param inOutTop           Index of the pool at the top of the stack
+        void resolveViolations(size_t &inOutTop);
 
         /// Construct solution for calcium concentration dynamics C
         ///
@@ -110,6 +195,80 @@ namespace isx
         void updateHyperParameters(const ColumnFloat_t &inY);
     };
 
+    /// Class implementing the OASIS model for streaming data
+    ///
+    /// Samples are deconvolved as they arrive, for an autoregressive model of order p = 1 (i.e., AR1)
+    /// with a fixed baseline and sparsity penalty. The pool stack is kept across calls and a value is
+    /// finalized once it is older than the lag: the solution of earlier time points may still change
+    /// when later samples arrive, so a longer lag trades latency for agreement with the batch solution.
+    /// Pools whose values are all finalized are dropped, so memory does not grow with the recording length.
+    class OnlineOasis
+    {
+    public:
+        /// Constructor
+        ///
+        /// \param inGamma            Calcium dynamics decay constant
+        /// \param inBaseline         Baseline fluorescence subtracted from each sample
+        /// \param inLambda           Sparsity penalty on the spikes
+        /// \param inLag              Number of samples after which a value is finalized
+        OnlineOasis(
+            const float inGamma,
+            const float inBaseline = 0.0f,
+            const float inLambda = 0.0f,
+            const size_t inLag = 10);
+
+        /// Appends samples to the trace and returns the values finalized by them
+        ///
+        /// \param inY                New samples of the raw fluorescence trace
+        /// \param outC               Denoised calcium values finalized during this call
+        /// \param outS               Deconvolved neural spikes finalized during this call
+        void update(
+            const ColumnFloat_t &inY,
+            ColumnFloat_t &outC,
+            ColumnFloat_t &outS);
+
+        /// Finalizes all remaining values, e.g. at the end of a recording
+        ///
+        /// \param outC               Denoised calcium values not finalized before
+        /// \param outS               Deconvolved neural spikes not finalized before
+        void flush(
+            ColumnFloat_t &outC,
+            ColumnFloat_t &outS);
+
+        /// \return number of samples received
+        size_t getNumSamples() const;
+
+        /// \return number of values finalized, i.e. the time index of the next finalized value
+        size_t getNumFinalized() const;
+
+    private:
+        const float m_gamma;           ///< Calcium dynamics decay constant
+        const float m_baseline;        ///< Baseline fluorescence
+        const float m_lambda;          ///< Sparsity penalty
+        const size_t m_lag;            ///< Number of samples after which a value is finalized
+        size_t m_T;                    ///< Number of samples received
+        size_t m_numFinalized;         ///< Number of values finalized
+        float m_lastC;                 ///< Last finalized calcium value, used to compute spikes
+        std::deque<Pool> m_pools;      ///< Stack of pools holding values that are not finalized, bottom first
+        DecayPowers m_filter;          ///< Powers of the decay constant, the length of the trace is not known in advance
+
+        /// \param inPower            Exponent
+        /// \return                   Decay constant to the given power
+        float power(const size_t inPower) const
+        {
+            return m_filter(inPower);
+        }
+
+        /// Pushes a sample on the pool stack and resolves violations of the calcium dynamics
+        void push(const float inY);
+
+        /// Finalizes values up to (but excluding) the given time index
+        void finalize(
+            const size_t inEnd,
+            std::vector<float> &outC,
+            std::vector<float> &outS);
+    };
+
 } // namespace isx
 
 #endif // ISX_OASIS_H
@@ -179,6 +179,7 @@ License: BSD-3-clause
 #define ISX_LASSO_LARS_HPP
 
 #include "isxArmaUtils.h"
+#include <stdexcept>
 
 namespace isx
 {
@@ -411,6 +412,20 @@ namespace isx
                     const arma::Row<T> &responses,
                     const bool transposeData = true);
 
+            /**
+   * Run LARS using only the precalculated Gram matrix passed to the
+   * constructor and the correlations of the predictors with the responses
+   * (X' * y), without access to the data itself. This is useful when many
+   * responses are regressed onto the same predictors, since the cost of each
+   * fit no longer depends on the number of observations. The Gram matrix must
+   * have been passed to the constructor.
+   *
+   * @param vecXTy Correlations of each predictor with the responses (X' * y).
+   * @param beta Vector to store the solution (the coefficients) in.
+   */
+            void TrainCovariance(const arma::Col<T> &vecXTy,
+                                 arma::Col<T> &beta);
+
             /**
    * Predict y_i for each data point in the given data matrix using the
    * currently-trained LARS model.
@@ -991,6 +1006,246 @@ namespace isx
             return Train(data, responses, beta, transposeData);
         }
 
+        template <typename T>
+        void LARS<T>::TrainCovariance(const arma::Col<T> &vecXTy,
+                                      arma::Col<T> &beta)
+        {
+            // Clear any previous solution information.
+            betaPath.clear();
+            lambdaPath.clear();
+            activeSet.clear();
+            isActive.clear();
+            ignoreSet.clear();
+            isIgnored.clear();
+            matUtriCholFactor.reset();
+
+            const size_t numPredictors = vecXTy.n_elem;
+            if (matGram->n_rows != numPredictors || matGram->n_cols != numPredictors)
+            {
+                throw std::invalid_argument("LARS::TrainCovariance(): Gram matrix does not match the number of predictors");
+            }
+
+            isActive.resize(numPredictors, false);
+            isIgnored.resize(numPredictors, false);
+
+            beta = arma::zeros<arma::Col<T>>(numPredictors);
+
+            bool lassocond = false;
+
+            // Compute the initial maximum correlation among all dimensions.
+            arma::Col<T> corr = vecXTy;
+            T maxCorr = 0;
+            size_t changeInd = 0;
+            for (size_t i = 0; i < vecXTy.n_elem; ++i)
+            {
+                if (fabs(corr(i)) > maxCorr)
+                {
+                    maxCorr = fabs(corr(i));
+                    changeInd = i;
+                }
+            }
+
+            betaPath.push_back(beta);
+            lambdaPath.push_back(maxCorr);
+
+            // If the maximum correlation is too small, there is no reason to continue.
+            if (maxCorr < lambda1)
+            {
+                lambdaPath[0] = lambda1;
+                return;
+            }
+
+            // Main loop.  This follows Train() exactly, with every product against
+            // the data replaced by the equivalent product against the Gram matrix:
+            // X' * yHat = G * beta and X' * (X * betaDirection) = G * betaDirection.
+            while (((activeSet.size() + ignoreSet.size()) < numPredictors) &&
+                   (maxCorr > tolerance))
+            {
+                // Compute the maximum correlation among inactive dimensions.
+                maxCorr = 0;
+                for (size_t i = 0; i < numPredictors; ++i)
+                {
+                    if ((!isActive[i]) && (!isIgnored[i]) && (fabs(corr(i)) > maxCorr))
+                    {
+                        maxCorr = fabs(corr(i));
+                        changeInd = i;
+                    }
+                }
+
+                if (!lassocond)
+                {
+                    if (useCholesky)
+                    {
+                        arma::Col<T> newGramCol = matGram->elem(changeInd * numPredictors +
+                                                                arma::conv_to<arma::uvec>::from(activeSet));
+
+                        CholeskyInsert((*matGram)(changeInd, changeInd), newGramCol);
+                    }
+
+                    // Add variable to active set.
+                    Activate(changeInd);
+                }
+
+                // Compute signs of correlations.
+                arma::Col<T> s = arma::Col<T>(activeSet.size());
+                for (size_t i = 0; i < activeSet.size(); ++i)
+                    s(i) = corr(activeSet[i]) / fabs(corr(activeSet[i]));
+
+                // Compute the "equiangular" direction in parameter space (betaDirection).
+                arma::Col<T> unnormalizedBetaDirection;
+                T normalization;
+                arma::Col<T> betaDirection;
+                if (useCholesky)
+                {
+                    // Check for singularity.
+                    const T lastUtriElement = matUtriCholFactor(
+                        matUtriCholFactor.n_cols - 1, matUtriCholFactor.n_rows - 1);
+                    if (std::abs(lastUtriElement) > tolerance)
+                    {
+                        // Ok, no singularity.
+                        unnormalizedBetaDirection = solve(trimatu(matUtriCholFactor),
+                                                          solve(trimatl(trans(matUtriCholFactor)), s));
+
+                        normalization = T(1.0) / sqrt(dot(s, unnormalizedBetaDirection));
+                        betaDirection = normalization * unnormalizedBetaDirection;
+                    }
+                    else
+                    {
+                        // Singularity, so remove variable from active set, add to ignores set,
+                        // and look for new variable to add.
+                        Deactivate(activeSet.size() - 1);
+                        Ignore(changeInd);
+                        CholeskyDelete(matUtriCholFactor.n_rows - 1);
+                        continue;
+                    }
+                }
+                else
+                {
+                    arma::Mat<T> matGramActive = arma::Mat<T>(activeSet.size(), activeSet.size());
+                    for (size_t i = 0; i < activeSet.size(); ++i)
+                        for (size_t j = 0; j < activeSet.size(); ++j)
+                            matGramActive(i, j) = (*matGram)(activeSet[i], activeSet[j]);
+
+                    // Check for singularity.
+                    arma::Mat<T> matS = s * arma::ones<arma::Mat<T>>(1, activeSet.size());
+                    const bool solvedOk = solve(unnormalizedBetaDirection,
+                                                matGramActive % trans(matS) % matS,
+                                                arma::ones<arma::Mat<T>>(activeSet.size(), 1));
+                    if (solvedOk)
+                    {
+                        // Ok, no singularity.
+                        normalization = T(1.0) / sqrt(sum(unnormalizedBetaDirection));
+                        betaDirection = normalization * unnormalizedBetaDirection % s;
+                    }
+                    else
+                    {
+                        // Singularity, so remove variable from active set, add to ignores set,
+                        // and look for new variable to add.
+                        Deactivate(activeSet.size() - 1);
+                        Ignore(changeInd);
+                        continue;
+                    }
+                }
+
+                T gamma = maxCorr / normalization;
+
+                // If not all variables are active.
+                if ((activeSet.size() + ignoreSet.size()) < numPredictors)
+                {
+                    // Compute correlations with direction.
+                    for (size_t ind = 0; ind < numPredictors; ind++)
+                    {
+                        if (isActive[ind] || isIgnored[ind])
+                            continue;
+
+                        T dirCorr = 0;
+                        for (size_t i = 0; i < activeSet.size(); ++i)
+                            dirCorr += (*matGram)(ind, activeSet[i]) * betaDirection(i);
+
+                        T val1 = (maxCorr - corr(ind)) / (normalization - dirCorr);
+                        T val2 = (maxCorr + corr(ind)) / (normalization + dirCorr);
+                        if ((val1 > 0) && (val1 < gamma))
+                            gamma = val1;
+                        if ((val2 > 0) && (val2 < gamma))
+                            gamma = val2;
+                    }
+                }
+
+                // Bound gamma according to LASSO.
+                if (lasso)
+                {
+                    lassocond = false;
+                    T lassoboundOnGamma = std::numeric_limits<T>::max();
+                    size_t activeIndToKickOut = -1;
+
+                    for (size_t i = 0; i < activeSet.size(); ++i)
+                    {
+                        T val = -beta(activeSet[i]) / betaDirection(i);
+                        if ((val > 0) && (val < lassoboundOnGamma))
+                        {
+                            lassoboundOnGamma = val;
+                            activeIndToKickOut = i;
+                        }
+                    }
+
+                    if (lassoboundOnGamma < gamma)
+                    {
+                        gamma = lassoboundOnGamma;
+                        lassocond = true;
+                        changeInd = activeIndToKickOut;
+                    }
+                }
+
+                // Update the estimator.
+                for (size_t i = 0; i < activeSet.size(); ++i)
+                {
+                    beta(activeSet[i]) += gamma * betaDirection(i);
+                }
+
+                // Sanity check to make sure the kicked out dimension is actually zero.
+                if (lassocond)
+                {
+                    if (beta(activeSet[changeInd]) != 0)
+                        beta(activeSet[changeInd]) = 0;
+                }
+
+                betaPath.push_back(beta);
+
+                if (lassocond)
+                {
+                    // Index is in position changeInd in activeSet.
+                    if (useCholesky)
+                        CholeskyDelete(changeInd);
+
+                    Deactivate(changeInd);
+                }
+
+                corr = vecXTy - (*matGram) * beta;
+                if (elasticNet)
+                    corr -= lambda2 * beta;
+
+                T curLambda = 0;
+                for (size_t i = 0; i < activeSet.size(); ++i)
+                    curLambda += fabs(corr(activeSet[i]));
+
+                curLambda /= ((T)activeSet.size());
+
+                lambdaPath.push_back(curLambda);
+
+                // Time to stop for LASSO?
+                if (lasso)
+                {
+                    if (curLambda <= lambda1)
+                    {
+                        InterpolateBeta();
+                        break;
+                    }
+                }
+            }
+
+            beta = betaPath.back();
+        }
+
         template <typename T>
         void LARS<T>::Predict(const arma::Mat<T> &points,
                               arma::Row<T> &predictions,
@@ -0,0 +1,205 @@
+#include "isxTaskScheduler.h"
+
+#include <algorithm>
+
+namespace isx
+{
+namespace
+{
+    // Scheduler and worker index of the calling thread (null for threads that are not workers)
+    thread_local const TaskScheduler * t_currentScheduler = nullptr;
+    thread_local size_t t_currentWorker = 0;
+} // namespace
+
+    TaskScheduler::TaskScheduler(const size_t inNumThreads)
+        : m_numQueued(0)
+        , m_stop(false)
+        , m_numEvents(0)
+        , m_numWaiting(0)
+    {
+        const size_t numThreads = std::max(inNumThreads, size_t(1));
+        m_workers.reserve(numThreads);
+        for (size_t i = 0; i < numThreads; ++i)
+        {
+            m_workers.emplace_back(new Worker());
+            m_workers.back()->m_pendingCost = 0;
+        }
+
+        m_threads.reserve(numThreads);
+        for (size_t i = 0; i < numThreads; ++i)
+        {
+            m_threads.emplace_back(&TaskScheduler::workerLoop, this, i);
+        }
+    }
+
+    TaskScheduler::~TaskScheduler()
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_sleepMutex);
+            m_stop = true;
+        }
+        m_sleepCondition.notify_all();
+
+        for (auto & thread : m_threads)
+        {
+            thread.join();
+        }
+    }
+
+    size_t TaskScheduler::getNumThreads() const
+    {
+        return m_workers.size();
+    }
+
+    void TaskScheduler::push(std::function<void()> inFunction, const size_t inCost)
+    {
+        const size_t numWorkers = m_workers.size();
+
+        size_t target = 0;
+        if (t_currentScheduler == this)
+        {
+            // nested tasks stay on the queue of the worker that spawned them
+            target = t_currentWorker;
+        }
+        else
+        {
+            size_t minCost = m_workers[0]->m_pendingCost;
+            for (size_t i = 1; i < numWorkers; ++i)
+            {
+                const size_t cost = m_workers[i]->m_pendingCost;
+                if (cost < minCost)
+                {
+                    minCost = cost;
+                    target = i;
+                }
+            }
+        }
+
+        {
+            Worker & worker = *m_workers[target];
+            std::unique_lock<std::mutex> lock(worker.m_mutex);
+            worker.m_tasks.push_back(Task{std::move(inFunction), inCost});
+            worker.m_pendingCost += inCost;
+        }
+
+        bool notifyWaiting = false;
+        {
+            // incremented under the sleep mutex so that a worker about to sleep cannot miss the notification
+            std::unique_lock<std::mutex> lock(m_sleepMutex);
+            ++m_numQueued;
+            ++m_numEvents;
+            notifyWaiting = (m_numWaiting > 0);
+        }
+        m_sleepCondition.notify_one();
+        if (notifyWaiting)
+        {
+            m_eventCondition.notify_all();
+        }
+    }
+
+    size_t TaskScheduler::getNumEvents()
+    {
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        return m_numEvents;
+    }
+
+    void TaskScheduler::waitForEvent(const size_t inNumEvents)
+    {
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        ++m_numWaiting;
+        m_eventCondition.wait(lock, [this, inNumEvents] { return m_numEvents != inNumEvents; });
+        --m_numWaiting;
+    }
+
+    bool TaskScheduler::tryPop(const size_t inWorker, const bool inFromBack, Task & outTask)
+    {
+        Worker & worker = *m_workers[inWorker];
+        std::unique_lock<std::mutex> lock(worker.m_mutex);
+        if (worker.m_tasks.empty())
+        {
+            return false;
+        }
+
+        if (inFromBack)
+        {
+            outTask = std::move(worker.m_tasks.back());
+            worker.m_tasks.pop_back();
+        }
+        else
+        {
+            outTask = std::move(worker.m_tasks.front());
+            worker.m_tasks.pop_front();
+        }
+        worker.m_pendingCost -= outTask.m_cost;
+        --m_numQueued;
+        return true;
+    }
+
+    bool TaskScheduler::isWorkerThread() const
+    {
+        return t_currentScheduler == this;
+    }
+
+    bool TaskScheduler::runPendingTask()
+    {
+        const size_t numWorkers = m_workers.size();
+        const size_t self = t_currentWorker;
+
+        Task task;
+        bool found = tryPop(self, true, task);
+        for (size_t i = 1; !found && i < numWorkers; ++i)
+        {
+            found = tryPop((self + i) % numWorkers, false, task);
+        }
+
+        if (found)
+        {
+            task.m_function();
+
+            bool notifyWaiting = false;
+            {
+                std::unique_lock<std::mutex> lock(m_sleepMutex);
+                ++m_numEvents;
+                notifyWaiting = (m_numWaiting > 0);
+            }
+            if (notifyWaiting)
+            {
+                m_eventCondition.notify_all();
+            }
+        }
+        return found;
+    }
+
+    void TaskScheduler::workerLoop(const size_t inWorker)
+    {
+        t_currentScheduler = this;
+        t_currentWorker = inWorker;
+
+        while (true)
+        {
+            if (runPendingTask())
+            {
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(m_sleepMutex);
+            m_sleepCondition.wait(lock, [this] { return m_stop || m_numQueued > 0; });
+            if (m_stop && m_numQueued == 0)
+            {
+                break;
+            }
+        }
+
+        t_currentScheduler = nullptr;
+    }
+
+    std::shared_ptr<TaskScheduler> getTaskScheduler(TaskScheduler * inScheduler, const size_t inNumThreads)
+    {
+        if (inScheduler)
+        {
+            return std::shared_ptr<TaskScheduler>(inScheduler, [](TaskScheduler *) {});
+        }
+        return std::make_shared<TaskScheduler>(inNumThreads);
+    }
+
+} // namespace isx
@@ -0,0 +1,212 @@
+#ifndef ISX_TASK_SCHEDULER_H
+#define ISX_TASK_SCHEDULER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace isx
+{
+    /// Work-stealing task scheduler shared by the parallel stages of CNMF-E
+    ///
+    /// Each worker owns a double-ended queue of tasks. A worker pops from the back of its own queue
+    /// and steals from the front of the other queues once its own is empty, so load imbalance between
+    /// stages (and between tasks of one stage) is absorbed without spawning new threads.
+    /// Tasks may enqueue further tasks and wait on them: a worker waiting on a future runs pending tasks
+    /// until the future is ready, so nested parallelism cannot deadlock the scheduler. Threads outside the
+    /// scheduler only block while they wait, so no more than getNumThreads() tasks ever run at once.
+    class TaskScheduler
+    {
+    public:
+        /// Constructor
+        ///
+        /// \param inNumThreads     Number of worker threads (at least one worker is created)
+        explicit TaskScheduler(const size_t inNumThreads);
+
+        /// Destructor
+        /// Runs all pending tasks before joining the worker threads
+        ~TaskScheduler();
+
+        TaskScheduler(const TaskScheduler &) = delete;
+        TaskScheduler & operator=(const TaskScheduler &) = delete;
+
+        /// \return number of worker threads
+        size_t getNumThreads() const;
+
+        /// Enqueues a task with unit cost
+        /// Same interface as ThreadPool::enqueue
+        ///
+        /// \param f        Callable to run
+        /// \param args     Arguments bound to the callable (use std::ref/std::cref for references)
+        /// \return         Future holding the result of the task
+        template<class F, class... Args>
+        auto enqueue(F && f, Args &&... args)
+            -> std::future<typename std::result_of<F(Args...)>::type>
+        {
+            return enqueueWithHint(1, std::forward<F>(f), std::forward<Args>(args)...);
+        }
+
+        /// Enqueues a task with a cost estimate
+        ///
+        /// \param inCost       Estimated relative cost of the task, used to place it on the least loaded worker
+        /// \param f            Callable to run
+        /// \param args         Arguments bound to the callable (use std::ref/std::cref for references)
+        /// \return             Future holding the result of the task
+        template<class F, class... Args>
+        auto enqueueWithHint(const size_t inCost, F && f, Args &&... args)
+            -> std::future<typename std::result_of<F(Args...)>::type>
+        {
+            using ReturnType = typename std::result_of<F(Args...)>::type;
+
+            auto task = std::make_shared<std::packaged_task<ReturnType()>>(
+                std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+            std::future<ReturnType> result = task->get_future();
+
+            push([task]() { (*task)(); }, inCost);
+            return result;
+        }
+
+        /// Waits for a task to complete and returns its result
+        /// A worker runs pending tasks while the future is not ready, which makes it safe to wait
+        /// from within a task. Other threads block without running tasks.
+        ///
+        /// \param inFuture     Future returned by enqueue or enqueueWithHint
+        /// \return             Result of the task (rethrows any exception raised by the task)
+        template<class T>
+        T wait(std::future<T> & inFuture)
+        {
+            if (!isWorkerThread())
+            {
+                return inFuture.get();
+            }
+
+            while (true)
+            {
+                // read before checking the future: a task completing after the check always changes the count
+                const size_t numEvents = getNumEvents();
+                if (inFuture.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+                {
+                    break;
+                }
+                if (!runPendingTask())
+                {
+                    waitForEvent(numEvents);
+                }
+            }
+            return inFuture.get();
+        }
+
+        /// Waits for all tasks of a stage to complete, then rethrows the first exception raised by any of them
+        /// Tasks typically hold references to data owned by the caller, so the caller is only unwound
+        /// once none of them is queued or running anymore.
+        ///
+        /// \param inFutures    Futures returned by enqueue or enqueueWithHint (invalid futures are skipped)
+        template<class T>
+        void waitAll(std::vector<std::future<T>> & inFutures)
+        {
+            std::exception_ptr error;
+            for (std::future<T> & future : inFutures)
+            {
+                if (!future.valid())
+                {
+                    continue;
+                }
+
+                try
+                {
+                    wait(future);
+                }
+                catch (...)
+                {
+                    if (!error)
+                    {
+                        error = std::current_exception();
+                    }
+                }
+            }
+
+            if (error)
+            {
+                std::rethrow_exception(error);
+            }
+        }
+
+    private:
+        struct Task
+        {
+            std::function<void()> m_function;
+            size_t m_cost;
+        };
+
+        struct Worker
+        {
+            std::mutex m_mutex;
+            std::deque<Task> m_tasks;
+            std::atomic<size_t> m_pendingCost;
+        };
+
+        /// Places a task on a worker queue and wakes up a sleeping worker
+        void push(std::function<void()> inFunction, const size_t inCost);
+
+        /// \return true if the calling thread is a worker of this scheduler
+        bool isWorkerThread() const;
+
+        /// Runs one pending task of the calling worker if there is any
+        /// The worker looks at its own queue first, then steals from the others
+        ///
+        /// \return true if a task was run
+        bool runPendingTask();
+
+        /// \return number of tasks queued or completed so far
+        size_t getNumEvents();
+
+        /// Blocks until a task is queued or completed
+        ///
+        /// \param inNumEvents  Value of getNumEvents() read before the caller found nothing to do
+        void waitForEvent(const size_t inNumEvents);
+
+        /// Pops a task from a worker queue
+        ///
+        /// \param inWorker     Index of the worker queue
+        /// \param inFromBack   Pop from the back (owner) rather than the front (thief)
+        /// \param outTask      Popped task
+        /// \return true if a task was popped
+        bool tryPop(const size_t inWorker, const bool inFromBack, Task & outTask);
+
+        /// Main loop of a worker thread
+        ///
+        /// \param inWorker     Index of the worker
+        void workerLoop(const size_t inWorker);
+
+        std::vector<std::unique_ptr<Worker>> m_workers;
+        std::vector<std::thread> m_threads;
+
+        std::mutex m_sleepMutex;
+        std::condition_variable m_sleepCondition;
+        std::atomic<size_t> m_numQueued;
+        bool m_stop;
+
+        std::condition_variable m_eventCondition;   ///< Wakes threads waiting on a future, guarded by m_sleepMutex
+        size_t m_numEvents;                         ///< Number of tasks queued or completed so far
+        size_t m_numWaiting;                        ///< Number of threads blocked in waitForEvent
+    };
+
+    /// Returns the scheduler a parallel stage runs its tasks with
+    ///
+    /// \param inScheduler      Scheduler shared by the stages of a run (nullptr if there is none)
+    /// \param inNumThreads     Number of worker threads of the scheduler created when inScheduler is nullptr
+    /// \return                 inScheduler (not owned), or a new scheduler owned by the caller
+    std::shared_ptr<TaskScheduler> getTaskScheduler(TaskScheduler * inScheduler, const size_t inNumThreads);
+
+} // namespace isx
+
+#endif // ISX_TASK_SCHEDULER_H
@@ -71,5 +71,14 @@ TEST_CASE("CnmfeDeconvolveTraces", "[cnmfe-deconv]")
             REQUIRE(approxEqual(arma::norm_dot(outS.row(i), expectedS.row(i)), 1., 1e-5));
         }
         REQUIRE(arma::approx_equal(outSn, expectedSn, "rel_tol", 1e-5));
+
+        // traces are deconvolved independently, so batches processed in parallel give the same result
+        isx::MatrixFloat_t parallelDeconvolvedTraces;
+        isx::MatrixFloat_t parallelS;
+        isx::ColumnFloat_t parallelSn;
+        isx::deconvolveTraces(inRawTraces, parallelDeconvolvedTraces, parallelS, parallelSn, inDeconvParams, inNumIterations, 2);
+        REQUIRE(arma::approx_equal(parallelDeconvolvedTraces, outDeconvolvedTraces, "absdiff", 0.0f));
+        REQUIRE(arma::approx_equal(parallelS, outS, "absdiff", 0.0f));
+        REQUIRE(arma::approx_equal(parallelSn, outSn, "absdiff", 0.0f));
     }
 }
@@ -1,6 +1,57 @@
 #include "isxCnmfeInitialization.h"
 #include "catch.hpp"
+#include <opencv2/imgproc/imgproc.hpp>
+#include <cmath>
 #include <string>
+#include <vector>
+
+namespace
+{
+    isx::CubeFloat_t generateNeuronMovie()
+    {
+        // synthetic movie of neurons with gaussian footprints, some close enough to share a neighbourhood
+        const size_t numRows = 48;
+        const size_t numCols = 52;
+        const size_t numFrames = 300;
+        const std::vector<std::pair<float,float>> centers = {
+            {8.0f, 9.0f}, {10.0f, 40.0f}, {38.0f, 10.0f}, {40.0f, 42.0f}, {24.0f, 25.0f}, {28.0f, 29.0f}
+        };
+
+        arma::arma_rng::set_seed(0);
+        isx::CubeFloat_t movie(numRows, numCols, numFrames, arma::fill::randn);
+        movie *= 0.2f;
+        for (const auto & center : centers)
+        {
+            isx::MatrixFloat_t footprint(numRows, numCols);
+            for (size_t col = 0; col < numCols; ++col)
+            {
+                for (size_t row = 0; row < numRows; ++row)
+                {
+                    const float dr = static_cast<float>(row) - center.first;
+                    const float dc = static_cast<float>(col) - center.second;
+                    footprint(row, col) = std::exp(-(dr * dr + dc * dc) / 8.0f);
+                }
+            }
+
+            const isx::ColumnFloat_t spikes = arma::conv_to<isx::ColumnFloat_t>::from(
+                arma::randu<isx::ColumnFloat_t>(numFrames) > 0.97f);
+            isx::ColumnFloat_t trace(numFrames);
+            float c = 0.0f;
+            for (size_t t = 0; t < numFrames; ++t)
+            {
+                c = 0.9f * c + 10.0f * spikes(t);
+                trace(t) = c;
+            }
+
+            for (size_t t = 0; t < numFrames; ++t)
+            {
+                movie.slice(t) += footprint * trace(t);
+            }
+        }
+
+        return movie;
+    }
+}
 
 TEST_CASE("CnmfeInitializationExtractAC", "[cnmfe-initialization]")
 {
@@ -240,3 +291,89 @@ TEST_CASE("CnmfeInitializationExtractAC", "[cnmfe-initialization]")
         REQUIRE(arma::approx_equal(exptCi, outCi, "reldiff", 1e-5f));
     }
 }
+
+TEST_CASE("CnmfeInitializationSeedBatches", "[cnmfe-initialization]")
+{
+    const isx::CubeFloat_t movie = generateNeuronMovie();
+
+    const isx::DeconvolutionParams deconvParams;
+    const isx::InitializationParams initParams(true, 7, 2, 0.6f, 5.0f, 3, 0, 2);
+
+    isx::CubeFloat_t expA, actA;
+    isx::MatrixFloat_t expC, expCRaw, expS, actC, actCRaw, actS;
+    isx::initNeuronsCorrPNR(movie, expA, expC, expCRaw, expS, deconvParams, initParams, 0, 1);
+    isx::initNeuronsCorrPNR(movie, actA, actC, actCRaw, actS, deconvParams, initParams, 0, 4);
+
+    // concurrent seeds give the neurons of the sequential order
+    REQUIRE(expA.n_slices > 0);
+    REQUIRE(arma::size(actA) == arma::size(expA));
+    REQUIRE(arma::approx_equal(actA, expA, "absdiff", 0.0f));
+    REQUIRE(arma::approx_equal(actC, expC, "absdiff", 0.0f));
+    REQUIRE(arma::approx_equal(actCRaw, expCRaw, "absdiff", 0.0f));
+    REQUIRE(arma::approx_equal(actS, expS, "absdiff", 0.0f));
+}
+
+TEST_CASE("CnmfeInitializationLargeFilter", "[cnmfe-initialization]")
+{
+    // kernel of the background filter is large enough to be applied in the frequency domain
+    const isx::CubeFloat_t movie = generateNeuronMovie();
+    const isx::DeconvolutionParams deconvParams;
+    const isx::InitializationParams initParams(false, 7, 4, 0.6f, 5.0f, 3, 0, 2);
+
+    isx::CubeFloat_t expA, actA;
+    isx::MatrixFloat_t expC, expCRaw, expS, actC, actCRaw, actS;
+    isx::initNeuronsCorrPNR(movie, expA, expC, expCRaw, expS, deconvParams, initParams, 0, 1);
+    isx::initNeuronsCorrPNR(movie, actA, actC, actCRaw, actS, deconvParams, initParams, 0, 3);
+
+    REQUIRE(expA.n_slices > 0);
+    REQUIRE(arma::size(actA) == arma::size(expA));
+    REQUIRE(arma::approx_equal(actA, expA, "absdiff", 0.0f));
+    REQUIRE(arma::approx_equal(actC, expC, "absdiff", 0.0f));
+    REQUIRE(arma::approx_equal(actCRaw, expCRaw, "absdiff", 0.0f));
+}
+
+TEST_CASE("CnmfeInitializationFilterMovie", "[cnmfe-initialization]")
+{
+    arma::arma_rng::set_seed(0);
+    const isx::CubeFloat_t movie(24, 31, 5, arma::fill::randn);
+
+    auto filterReference = [&movie](const cv::Mat & inKernel) -> isx::CubeFloat_t
+    {
+        // filter2D with a replicated border on each frame, then removal of the mean over time
+        isx::CubeFloat_t filtered(arma::size(movie));
+        for (size_t frameIndex = 0; frameIndex < movie.n_slices; ++frameIndex)
+        {
+            const cv::Mat frame = isx::armaToCvMat<float>(movie.slice(frameIndex));
+            cv::Mat filteredFrame;
+            cv::filter2D(frame, filteredFrame, -1, inKernel, cv::Point(-1,-1), 0, cv::BORDER_REPLICATE);
+            filtered.slice(frameIndex) = isx::cvToArmaMat<float>(cv::Mat_<float>(filteredFrame));
+        }
+        const isx::MatrixFloat_t mean(arma::mean(filtered, 2));
+        filtered.each_slice() -= mean;
+        return filtered;
+    };
+
+    SECTION("kernel applied in the frequency domain")
+    {
+        // non-square and asymmetric so that a transposed or flipped kernel would not match
+        const isx::MatrixFloat_t kernel = arma::randu<isx::MatrixFloat_t>(13, 11) / 143.0f;
+        const cv::Mat cvKernel = isx::armaToCvMat<float>(kernel);
+        const isx::CubeFloat_t expected = filterReference(cvKernel);
+
+        isx::CubeFloat_t actual;
+        isx::filterMovie(movie, cvKernel, actual, 3);
+        REQUIRE(arma::size(actual) == arma::size(expected));
+        REQUIRE(arma::approx_equal(actual, expected, "absdiff", 1e-5f));
+    }
+
+    SECTION("small kernel")
+    {
+        const isx::MatrixFloat_t kernel = arma::randu<isx::MatrixFloat_t>(5, 3) / 15.0f;
+        const cv::Mat cvKernel = isx::armaToCvMat<float>(kernel);
+        const isx::CubeFloat_t expected = filterReference(cvKernel);
+
+        isx::CubeFloat_t actual;
+        isx::filterMovie(movie, cvKernel, actual, 3);
+        REQUIRE(arma::approx_equal(actual, expected, "absdiff", 1e-5f));
+    }
+}
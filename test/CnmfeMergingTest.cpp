@@ -26,3 +26,117 @@ TEST_CASE("CnmfeMergeConnectedComponents", "[cnmfe-merging]")
         REQUIRE(arma::approx_equal(expectedConnComponents, actualConnComponents, "reldiff", 0));
     }
 }
+
+TEST_CASE("CnmfeMergeOverlappingComponents", "[cnmfe-merging]")
+{
+    // footprints covering random squares of a 20x20 FOV, some of them empty
+    const size_t numRows = 20;
+    const size_t numCols = 20;
+    const size_t numComponents = 30;
+    const size_t numFrames = 50;
+
+    arma::arma_rng::set_seed(0);
+    isx::MatrixFloat_t A = arma::zeros<isx::MatrixFloat_t>(numRows * numCols, numComponents);
+    for (size_t k = 0; k < numComponents; ++k)
+    {
+        if (k % 7 == 3)
+        {
+            continue;
+        }
+
+        isx::MatrixFloat_t footprint = arma::zeros<isx::MatrixFloat_t>(numRows, numCols);
+        const arma::uvec corner = arma::randi<arma::uvec>(2, arma::distr_param(0, 15));
+        footprint(arma::span(corner(0), corner(0) + 4), arma::span(corner(1), corner(1) + 4)) =
+            arma::randu<isx::MatrixFloat_t>(5, 5);
+        A.col(k) = arma::vectorise(footprint);
+    }
+    const isx::MatrixFloat_t C = arma::randu<isx::MatrixFloat_t>(numComponents, numFrames);
+
+    SECTION("overlapping pairs match the inner products of the footprints")
+    {
+        std::vector<isx::ComponentOverlap> overlaps;
+        isx::findOverlappingComponents(A, numRows, numCols, overlaps);
+
+        std::vector<isx::ComponentOverlap> mismatchedOverlaps;
+        REQUIRE_THROWS(isx::findOverlappingComponents(A, numRows, numCols + 1, mismatchedOverlaps));
+
+        const isx::MatrixFloat_t Acorr = A.t() * A;
+        size_t expectedNumOverlaps = 0;
+        for (size_t j = 0; j < numComponents; ++j)
+        {
+            for (size_t i = 0; i < j; ++i)
+            {
+                expectedNumOverlaps += (Acorr(i, j) > 0.0f) ? 1 : 0;
+            }
+        }
+        REQUIRE(overlaps.size() == expectedNumOverlaps);
+
+        for (size_t idx = 0; idx < overlaps.size(); ++idx)
+        {
+            REQUIRE(overlaps[idx].m_first < overlaps[idx].m_second);
+            REQUIRE(overlaps[idx].m_positive);
+            REQUIRE(Acorr(overlaps[idx].m_first, overlaps[idx].m_second) > 0.0f);
+            if (idx > 0)
+            {
+                const bool sorted = (overlaps[idx - 1].m_first < overlaps[idx].m_first) ||
+                    (overlaps[idx - 1].m_first == overlaps[idx].m_first && overlaps[idx - 1].m_second < overlaps[idx].m_second);
+                REQUIRE(sorted);
+            }
+        }
+    }
+
+    SECTION("correlations of the traces match pearsonr")
+    {
+        std::vector<isx::ComponentOverlap> overlaps, parallelOverlaps;
+        isx::findOverlappingComponents(A, numRows, numCols, overlaps);
+        REQUIRE(!overlaps.empty());
+        parallelOverlaps = overlaps;
+
+        isx::correlateOverlappingComponents(C, overlaps);
+        isx::correlateOverlappingComponents(C, parallelOverlaps, 3);
+
+        for (size_t idx = 0; idx < overlaps.size(); ++idx)
+        {
+            const float expected = isx::pearsonr(C.row(overlaps[idx].m_first).t(), C.row(overlaps[idx].m_second).t());
+            REQUIRE(approxEqual(overlaps[idx].m_corr, expected, 1e-5));
+            REQUIRE(parallelOverlaps[idx].m_corr == overlaps[idx].m_corr);
+        }
+    }
+}
+
+TEST_CASE("CnmfeMergeGroupComponents", "[cnmfe-merging]")
+{
+    SECTION("groups of overlapping components with correlated activity")
+    {
+        const std::vector<isx::ComponentOverlap> overlaps = {
+            {0, 2, true, 0.9f},
+            {0, 5, true, 0.3f},
+            {1, 3, true, 0.95f},
+            {2, 5, true, 0.95f},
+            {3, 4, false, 0.99f},
+            {4, 6, true, 0.5f}
+        };
+
+        isx::MergeGroups groups;
+        isx::groupComponentsToMerge(overlaps, 7, 0.8f, groups);
+
+        // uncorrelated pairs within a group still count towards its score
+        REQUIRE(groups.m_scores.size() == 2);
+        REQUIRE(groups.m_offsets == std::vector<size_t>({0, 3, 5}));
+        REQUIRE(groups.m_members == std::vector<arma::uword>({0, 2, 5, 1, 3}));
+        REQUIRE(approxEqual(groups.m_scores[0], 0.9f + 0.3f + 0.95f, 1e-6));
+        REQUIRE(approxEqual(groups.m_scores[1], 0.95f, 1e-6));
+        REQUIRE(arma::approx_equal(groups.getMembers(1), arma::uvec({1, 3}), "absdiff", 0));
+    }
+
+    SECTION("no correlated pairs")
+    {
+        const std::vector<isx::ComponentOverlap> overlaps = {{0, 1, true, 0.2f}};
+
+        isx::MergeGroups groups;
+        isx::groupComponentsToMerge(overlaps, 3, 0.8f, groups);
+
+        REQUIRE(groups.m_scores.empty());
+        REQUIRE(groups.m_members.empty());
+    }
+}
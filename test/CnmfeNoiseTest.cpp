@@ -225,6 +225,25 @@ TEST_CASE("CNMFeNoiseFFT", "[cnmfe-noise]")
         REQUIRE(arma::approx_equal(expResult, actResult, "reldiff", 1e-5f));
     }
 
+    SECTION("cube input - pixel blocks processed in parallel")
+    {
+        // enough pixels to be split into several blocks
+        arma::arma_rng::set_seed(0);
+        const isx::CubeFloat_t largeCube(64, 48, 50, arma::fill::randu);
+        std::pair<float,float> noiseRange(0.25f, 0.5f);
+
+        isx::MatrixFloat_t expResult;
+        isx::getNoiseFft(largeCube, expResult, noiseRange, isx::AveragingMethod_t::LOGMEXP, 4096, 1);
+
+        isx::MatrixFloat_t actResult;
+        isx::getNoiseFft(largeCube, actResult, noiseRange, isx::AveragingMethod_t::LOGMEXP, 4096, 4);
+
+        REQUIRE(arma::size(actResult) == arma::size(largeCube.slice(0)));
+        REQUIRE(arma::approx_equal(expResult, actResult, "absdiff", 0.0f));
+        REQUIRE(isx::getNoiseFft(isx::ColumnFloat_t(largeCube.tube(5, 7)), noiseRange, isx::AveragingMethod_t::LOGMEXP) ==
+            Approx(actResult(5, 7)));
+    }
+
     SECTION("column input - exponential noise averaging")
     {
         const float expResult = 26.443470429738795f;
@@ -2,6 +2,7 @@
 #include "isxTest.h"
 #include "catch.hpp"
 
+#include <cstdlib>
 #include <thread>
 
 TEST_CASE("CircularConstraint", "[cnmfe-spatial]")
@@ -189,20 +190,163 @@ TEST_CASE("CnmfeSpatialRegressionParallel", "[cnmfe-spatial]")
         };
         isx::ColumnFloat_t inCct = {0.9997f, 0.9995f};
 
-        std::vector<arma::uvec> inIndC;
-        inIndC.emplace_back(arma::uvec{});
-        inIndC.emplace_back(arma::uvec{0});
-        inIndC.emplace_back(arma::uvec{1});
-        inIndC.emplace_back(arma::uvec{});
-        inIndC.emplace_back(arma::uvec{0});
+        // Pixels search components {}, {0}, {1}, {}, {0}
+        isx::PixelComponentIndex inIndC;
+        inIndC.m_rowPtr = {0, 0, 1, 2, 2, 3};
+        inIndC.m_compIds = {0, 1, 0};
 
         const std::pair<size_t, size_t> inPixelRange(0,5);
 
         isx::MatrixFloat_t expectedA = {{0.0f,0.0f},{0.0f,0.0f},{0.0f,1.28880965f},{0.0f,0.0f},{0.0f,0.0f}};
 
+        isx::LassoLarsDesign design;
+        isx::prepareLassoLarsDesign(inC.t(), design);
+
         isx::MatrixFloat_t outA;
-        isx::regressionParallel(inY, inC, inNoise, inIndC, inPixelRange, inCct, outA);
+        isx::regressionParallel(inY, design, inNoise, inIndC, inPixelRange, inCct, outA);
 
         REQUIRE(arma::approx_equal(expectedA, outA, "reldiff", 1e-5f));
     }
 }
+
+TEST_CASE("CnmfeSpatialHierarchicalAlsRegression", "[cnmfe-spatial]")
+{
+    const float inYdata[72] = {
+        9.34f, 13.36f, 14.48f, 5.23f, 14.53f, 14.49f,
+        12.335f, 11.946f, 9.82f, 4.76f, 17.484f, 11.113f,
+        13.245f, 11.224f, 8.06f, 4.78f, 18.172f, 9.834f,
+        12.185f, 8.818f, 5.36f, 4.83f, 15.824f, 7.263f,
+        10.045f, 8.52f, 6.45f, 5.28f, 12.888f, 7.316f,
+        8.55f, 5.536f, 2.37f, 4.96f, 10.02f, 3.325f,
+        9.585f, 5.906f, 2.29f, 5.08f, 11.398f, 4.096f,
+        12.895f, 8.272f, 3.63f, 4.88f, 15.6f, 5.965f,
+        15.345f, 12.768f, 8.4f, 5.0f, 21.636f, 10.487f,
+        16.3f, 12.616f, 8.12f, 4.93f, 22.97f, 10.735f,
+        15.53f, 13.714f, 10.15f, 4.91f, 21.798f, 12.081f,
+        13.05f, 13.338f, 11.9f, 5.05f, 18.868f, 12.586f
+    };
+    const isx::CubeFloat_t inY(inYdata, 3, 2, 12);
+
+    const isx::MatrixFloat_t inC = {
+        {3.0f, 4.87f, 5.55f, 4.75f, 3.31f, 2.54f, 3.25f, 5.13f, 6.99f, 7.64f, 6.82f, 5.38f},
+        {4.8f, 2.55f, 1.42f, 0.19f, 0.66f, -1.43f, -1.42f, -0.81f, 1.73f, 1.47f, 2.59f, 3.32f}
+    };
+    const isx::MatrixFloat_t inNoise = 0.1f * arma::ones<isx::MatrixFloat_t>(3, 2);
+    const isx::ColumnFloat_t inCct = arma::sum(arma::square(inC), 1);
+
+    // Pixels search components {0}, {0, 1}, {1}, {}, {0, 1}, {0, 1}
+    isx::PixelComponentIndex inIndC;
+    inIndC.m_rowPtr = {0, 1, 3, 4, 4, 6, 8};
+    inIndC.m_compIds = {0, 0, 1, 1, 0, 1, 0, 1};
+
+    isx::LassoLarsDesign design;
+    isx::prepareLassoLarsDesign(inC.t(), design);
+
+    isx::MatrixFloat_t expectedA;
+    isx::regressionParallel(inY, design, inNoise, inIndC, {0, 6}, inCct, expectedA);
+
+    SECTION("cold start matches lasso lars")
+    {
+        isx::MatrixFloat_t outA;
+        isx::hierarchicalAlsRegression(inY, inC, inNoise, inIndC, inCct, outA);
+
+        REQUIRE(arma::approx_equal(expectedA, outA, "absdiff", 1e-3f));
+    }
+
+    SECTION("warm start and multiple threads match lasso lars")
+    {
+        isx::MatrixFloat_t outA(6, 2, arma::fill::ones);
+        isx::hierarchicalAlsRegression(inY, inC, inNoise, inIndC, inCct, outA, 2, 2);
+
+        REQUIRE(arma::approx_equal(expectedA, outA, "absdiff", 1e-3f));
+    }
+
+    SECTION("coefficients zeroed by the penalty match lasso lars")
+    {
+        // higher noise at some pixels drops one of their two components from the lasso lars solution
+        const isx::MatrixFloat_t noise = {
+            {0.1f, 0.1f},
+            {0.5f, 1.0f},
+            {0.1f, 0.5f}
+        };
+        isx::MatrixFloat_t expectedSparseA;
+        isx::regressionParallel(inY, design, noise, inIndC, {0, 6}, inCct, expectedSparseA);
+        REQUIRE(expectedSparseA(4, 0) > 0.0f);
+        REQUIRE(expectedSparseA(4, 1) == 0.0f);
+        REQUIRE(expectedSparseA(5, 0) == 0.0f);
+        REQUIRE(expectedSparseA(5, 1) > 0.0f);
+
+        isx::MatrixFloat_t outA(6, 2, arma::fill::ones);
+        isx::hierarchicalAlsRegression(inY, inC, noise, inIndC, inCct, outA, 4, 2);
+
+        REQUIRE(arma::approx_equal(expectedSparseA, outA, "absdiff", 1e-3f));
+        REQUIRE(outA(4, 1) == 0.0f);
+        REQUIRE(outA(5, 0) == 0.0f);
+    }
+}
+
+TEST_CASE("CnmfeSpatialComputeIndicator", "[cnmfe-spatial]")
+{
+    isx::CubeFloat_t inA(8, 7, 3, arma::fill::zeros);
+    inA(1, 1, 0) = 0.5f;
+    inA(2, 1, 0) = 1.0f;
+    inA(3, 5, 1) = 2.0f;
+    inA(7, 6, 1) = 0.1f;
+    inA(2, 2, 2) = 0.3f;
+
+    // Expected search locations on the full image: dilating with the 5x5 diamond selects
+    // the pixels within a city block distance of 2 from the support of each footprint
+    arma::ucube expectedInd(arma::size(inA), arma::fill::zeros);
+    for (size_t k = 0; k < inA.n_slices; ++k)
+    {
+        for (size_t col = 0; col < inA.n_cols; ++col)
+        {
+            for (size_t row = 0; row < inA.n_rows; ++row)
+            {
+                for (size_t srcCol = 0; srcCol < inA.n_cols; ++srcCol)
+                {
+                    for (size_t srcRow = 0; srcRow < inA.n_rows; ++srcRow)
+                    {
+                        const int dist = std::abs(int(row) - int(srcRow)) + std::abs(int(col) - int(srcCol));
+                        if (inA(srcRow, srcCol, k) > 0.0f && dist <= 2)
+                        {
+                            expectedInd(row, col, k) = 1;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // a few locations worked out by hand
+    REQUIRE(arma::accu(expectedInd.slice(0)) == 15);
+    REQUIRE(expectedInd(0, 0, 0) == 1);
+    REQUIRE(expectedInd(4, 1, 0) == 1);
+    REQUIRE(expectedInd(4, 2, 0) == 0);
+    REQUIRE(expectedInd(5, 6, 1) == 1);
+    REQUIRE(expectedInd(7, 4, 1) == 1);
+    REQUIRE(expectedInd(6, 5, 1) == 1);
+    REQUIRE(expectedInd(6, 4, 1) == 0);
+    REQUIRE(arma::accu(expectedInd.slice(2)) == 13);
+
+    for (size_t numThreads : {1, 2})
+    {
+        arma::ucube distInd;
+        isx::determineSearchLocation(inA, distInd, numThreads);
+        REQUIRE(arma::size(distInd) == arma::size(expectedInd));
+        REQUIRE(arma::all(arma::vectorise(distInd) == arma::vectorise(expectedInd)));
+
+        isx::PixelComponentIndex ind;
+        isx::computeIndicator(inA, ind, numThreads);
+
+        REQUIRE(ind.m_rowPtr.size() == inA.n_rows * inA.n_cols + 1);
+        for (size_t pxIdx = 0; pxIdx < inA.n_rows * inA.n_cols; ++pxIdx)
+        {
+            arma::uvec expected = arma::find(arma::vectorise(expectedInd.tube(pxIdx % inA.n_rows, pxIdx / inA.n_rows)));
+            arma::uvec actual(ind.getNumComponents(pxIdx));
+            std::copy(ind.getComponents(pxIdx), ind.getComponents(pxIdx) + actual.n_elem, actual.begin());
+            REQUIRE(expected.n_elem == actual.n_elem);
+            REQUIRE(arma::all(expected == actual));
+        }
+    }
+}
@@ -0,0 +1,90 @@
+#include "catch.hpp"
+#include "isxCnmfeSummaryImages.h"
+#include "isxCnmfeUtils.h"
+#include "isxMemoryMappedFileUtils.h"
+#include "isxTest.h"
+
+namespace {
+    void requireSummaryImages(
+        const isx::CubeFloat_t & inData,
+        const isx::SummaryImages & inImages)
+    {
+        isx::MatrixFloat_t stdDev(inData.n_rows, inData.n_cols);
+        for (size_t colIndex = 0; colIndex < inData.n_cols; ++colIndex)
+        {
+            const isx::MatrixFloat_t temp = inData(arma::span::all, arma::span(colIndex), arma::span::all);
+            stdDev.col(colIndex) = arma::stddev(temp, 1, 1);
+        }
+
+        isx::MatrixFloat_t noise;
+        isx::getNoiseFft(inData, noise);
+
+        isx::MatrixFloat_t localCorr;
+        isx::computeLocalCorr(inData, localCorr);
+
+        REQUIRE(arma::approx_equal(inImages.m_mean, isx::MatrixFloat_t(arma::mean(inData, 2)), "reldiff", 1e-5f));
+        REQUIRE(arma::approx_equal(inImages.m_max, isx::MatrixFloat_t(arma::max(inData, 2)), "absdiff", 0.0f));
+        REQUIRE(arma::approx_equal(inImages.m_stdDev, stdDev, "reldiff", 1e-4f));
+        REQUIRE(arma::approx_equal(inImages.m_noise, noise, "reldiff", 1e-5f));
+        REQUIRE(arma::approx_equal(inImages.m_localCorr, localCorr, "absdiff", 1e-4f));
+    }
+}
+
+TEST_CASE("CnmfeSummaryImages", "[cnmfe-summary]")
+{
+    SECTION("in-memory movie")
+    {
+        arma::arma_rng::set_seed(0);
+        isx::CubeFloat_t data(9, 7, 150, arma::fill::randn);
+        data.tube(3, 3, 4, 4) += 2.0f * data.tube(4, 4, 4, 4);
+
+        isx::SummaryImages images;
+        isx::computeSummaryImages(data, images);
+        requireSummaryImages(data, images);
+    }
+
+    SECTION("movie longer than the noise estimation window streamed in bands of columns")
+    {
+        arma::arma_rng::set_seed(0);
+        const isx::CubeFloat_t data(6, 5, 1100, arma::fill::randu);
+
+        // buffer of samples holds a single column of pixels, with several threads splitting each block of frames
+        isx::SummaryImages images;
+        isx::computeSummaryImages(
+            data, images, std::pair<float,float>(0.25f, 0.5f), isx::AveragingMethod_t::LOGMEXP,
+            3, sizeof(float) * 1024 * data.n_rows);
+        requireSummaryImages(data, images);
+    }
+
+    SECTION("memory-mapped movie")
+    {
+        const std::string inputMoviePath = "test/data/movie.tif";  // movie dims: 128x128x100 (width * height * num_frames)
+        const std::string outputMemoryMapPath = "test/data/mmap.bin";
+
+        const isx::SpTiffMovie_t movie = std::shared_ptr<isx::TiffMovie>(new isx::TiffMovie(inputMoviePath));
+        isx::writeMemoryMappedFileMovie(movie, outputMemoryMapPath);
+
+        isx::CubeFloat_t data(movie->getFrameHeight(), movie->getFrameWidth(), movie->getNumFrames());
+        for (size_t i = 0; i < movie->getNumFrames(); i++)
+        {
+            isx::MatrixFloat_t frame;
+            movie->getFrame(i, frame);
+            data.slice(i) = frame;
+        }
+
+        isx::SummaryImages images;
+        isx::computeSummaryImages(
+            outputMemoryMapPath, data.n_rows, data.n_cols, data.n_slices, movie->getDataType(), images,
+            std::pair<float,float>(0.25f, 0.5f), isx::AveragingMethod_t::LOGMEXP, 4);
+        requireSummaryImages(data, images);
+
+        // noise alone matches the noise of the summary images
+        isx::MatrixFloat_t noise;
+        isx::computeNoiseImage(
+            outputMemoryMapPath, data.n_rows, data.n_cols, data.n_slices, movie->getDataType(), noise,
+            std::pair<float,float>(0.25f, 0.5f), isx::AveragingMethod_t::LOGMEXP, 4);
+        REQUIRE(arma::approx_equal(noise, images.m_noise, "absdiff", 0.0f));
+
+        std::remove(outputMemoryMapPath.c_str());
+    }
+}
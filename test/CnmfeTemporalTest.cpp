@@ -0,0 +1,270 @@
+#include "isxCnmfeTemporal.h"
+#include "isxTest.h"
+#include "catch.hpp"
+
+#include <limits>
+
+
+TEST_CASE("CnmfeTemporalUpdateOrder", "[cnmfe-temporal]")
+{
+    SECTION("crown graph is split into two groups")
+    {
+        // Components 2i and 2j+1 overlap for i != j. First-fit coloring in index order needs
+        // one group per pair of components while the graph is bipartite.
+        const size_t n = 4;
+        isx::MatrixFloat_t AA = arma::eye<isx::MatrixFloat_t>(2 * n, 2 * n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            for (size_t j = 0; j < n; ++j)
+            {
+                if (i != j)
+                {
+                    AA(2 * i, 2 * j + 1) = 0.5f;
+                    AA(2 * j + 1, 2 * i) = 0.5f;
+                }
+            }
+        }
+
+        std::vector<arma::uvec> neighbours;
+        isx::computeOverlapNeighbours(AA, neighbours);
+        std::vector<std::vector<size_t>> groups = isx::updateOrderDsatur(neighbours);
+
+        const std::vector<std::vector<size_t>> expectedGroups = {{0, 2, 4, 6}, {1, 3, 5, 7}};
+        REQUIRE(groups == expectedGroups);
+    }
+
+    SECTION("groups hold every component once and no overlapping components")
+    {
+        const isx::MatrixFloat_t AA = {
+            {1.0f, 0.2f, 0.0f, 0.0f, 0.1f, 0.0f},
+            {0.3f, 1.0f, 0.4f, 0.0f, 0.0f, 0.0f},
+            {0.0f, 0.1f, 1.0f, 0.2f, 0.0f, 0.0f},
+            {0.0f, 0.0f, 0.6f, 1.0f, 0.0f, 0.0f},
+            {0.2f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f},
+            {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f}
+        };
+
+        std::vector<arma::uvec> neighbours;
+        isx::computeOverlapNeighbours(AA, neighbours);
+        std::vector<std::vector<size_t>> groups = isx::updateOrderDsatur(neighbours);
+
+        REQUIRE(groups.size() == 2);
+
+        std::vector<size_t> counts(AA.n_rows, 0);
+        for (const auto & group : groups)
+        {
+            for (const size_t k : group)
+            {
+                counts[k]++;
+                for (const size_t j : group)
+                {
+                    REQUIRE((j == k || AA(k, j) == 0.0f));
+                }
+            }
+        }
+        REQUIRE(counts == std::vector<size_t>(AA.n_rows, 1));
+    }
+}
+
+TEST_CASE("CnmfeTemporalDeconvolutionStateCache", "[cnmfe-temporal]")
+{
+    const isx::ColumnFloat_t trace = {1.0f, 2.0f, 4.0f, 3.0f, 2.0f, 1.5f, 1.0f, 1.0f};
+    const std::vector<float> arParams = {0.9f};
+    const float noise = 0.2f;
+
+    isx::DeconvolutionStateCache cache;
+    cache.store(1, trace, arParams, noise);
+
+    std::vector<float> actArParams;
+    float actNoise = 0.0f;
+
+    SECTION("parameters are reused for a similar trace")
+    {
+        isx::ColumnFloat_t similarTrace = trace;
+        similarTrace(2) = 4.1f;
+        REQUIRE(cache.fetch(1, similarTrace, 1, actArParams, actNoise));
+        REQUIRE(actArParams == arParams);
+        REQUIRE(actNoise == Approx(noise).epsilon(0.02));
+    }
+
+    SECTION("noise level is scaled with a rescaled trace")
+    {
+        REQUIRE(cache.fetch(1, 3.0f * trace, 1, actArParams, actNoise));
+        REQUIRE(actArParams == arParams);
+        REQUIRE(actNoise == Approx(3.0f * noise));
+    }
+
+    SECTION("parameters are estimated again for a changed trace")
+    {
+        isx::ColumnFloat_t changedTrace = trace;
+        changedTrace(2) = 1.0f;
+        REQUIRE(!cache.fetch(1, changedTrace, 1, actArParams, actNoise));
+        REQUIRE(actArParams.empty());
+        REQUIRE(actNoise == -1.0f);
+    }
+
+    SECTION("parameters are estimated again for another AR order or an unknown component")
+    {
+        REQUIRE(!cache.fetch(1, trace, 2, actArParams, actNoise));
+        REQUIRE(!cache.fetch(0, trace, 1, actArParams, actNoise));
+        REQUIRE(!cache.fetch(2, trace, 1, actArParams, actNoise));
+    }
+
+    SECTION("solutions are reused until the trace or the temporal component changes")
+    {
+        const isx::ColumnFloat_t c = {0.5f, 1.5f, 3.5f, 2.5f, 1.5f, 1.0f, 0.5f, 0.5f};
+        const isx::ColumnFloat_t spikes = {0.0f, 1.0f, 2.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+        REQUIRE(cache.hasChanged(1, trace));
+
+        cache.storeSolution(1, trace, c, spikes, 0.5f, 0.1f, noise);
+        REQUIRE(!cache.hasChanged(1, trace));
+        REQUIRE(cache.hasChanged(1, 1.01f * trace));
+        REQUIRE(cache.hasChanged(0, trace));
+
+        isx::ColumnFloat_t actSpikes;
+        float actBaseline = 0.0f;
+        float actInitCaVal = 0.0f;
+        float actScale = 0.0f;
+        REQUIRE(cache.fetchSolution(1, c, 1, actSpikes, actBaseline, actInitCaVal, actNoise, actArParams, actScale));
+        REQUIRE(actScale == Approx(1.0f));
+        REQUIRE(arma::approx_equal(actSpikes, spikes, "absdiff", 1e-6f));
+        REQUIRE(actBaseline == Approx(0.5f));
+        REQUIRE(actInitCaVal == Approx(0.1f));
+        REQUIRE(actNoise == Approx(noise));
+        REQUIRE(actArParams == arParams);
+
+        isx::ColumnFloat_t changedC = c;
+        changedC(2) = 1.0f;
+        REQUIRE(!cache.fetchSolution(1, changedC, 1, actSpikes, actBaseline, actInitCaVal, actNoise, actArParams, actScale));
+        REQUIRE(!cache.fetchSolution(1, c, 2, actSpikes, actBaseline, actInitCaVal, actNoise, actArParams, actScale));
+    }
+
+    SECTION("solutions are scaled with rescaled temporal components")
+    {
+        const isx::ColumnFloat_t c = {0.5f, 1.5f, 3.5f, 2.5f, 1.5f, 1.0f, 0.5f, 0.5f};
+        const isx::ColumnFloat_t spikes = {0.0f, 1.0f, 2.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+        cache.storeSolution(1, trace, c, spikes, 0.5f, 0.1f, noise);
+
+        isx::ColumnFloat_t actSpikes;
+        float actBaseline = 0.0f;
+        float actInitCaVal = 0.0f;
+        float actScale = 0.0f;
+        REQUIRE(cache.fetchSolution(1, 0.25f * c, 1, actSpikes, actBaseline, actInitCaVal, actNoise, actArParams, actScale));
+        REQUIRE(actScale == Approx(0.25f));
+        REQUIRE(arma::approx_equal(actSpikes, 0.25f * spikes, "absdiff", 1e-6f));
+        REQUIRE(actBaseline == Approx(0.125f));
+        REQUIRE(actInitCaVal == Approx(0.025f));
+        REQUIRE(actNoise == Approx(0.25f * noise));
+
+        // traces are compared at the scale of the solution
+        REQUIRE(!cache.hasChanged(1, 0.25f * trace, actScale));
+        REQUIRE(cache.hasChanged(1, 0.25f * trace));
+        REQUIRE(cache.hasChanged(1, trace, actScale));
+    }
+
+    SECTION("state follows components to their new indices")
+    {
+        const isx::ColumnFloat_t c = {0.5f, 1.5f, 3.5f, 2.5f, 1.5f, 1.0f, 0.5f, 0.5f};
+        const isx::ColumnFloat_t spikes = {0.0f, 1.0f, 2.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+        cache.storeSolution(1, trace, c, spikes, 0.5f, 0.1f, noise);
+
+        // component 0 is merged away, component 1 moves to index 0 and a merged component is appended
+        cache.remap({1, std::numeric_limits<size_t>::max()});
+
+        REQUIRE(cache.fetch(0, trace, 1, actArParams, actNoise));
+        REQUIRE(actArParams == arParams);
+        REQUIRE(actNoise == noise);
+        REQUIRE(!cache.hasChanged(0, trace));
+
+        isx::ColumnFloat_t actSpikes;
+        float actBaseline = 0.0f;
+        float actInitCaVal = 0.0f;
+        float actScale = 0.0f;
+        REQUIRE(cache.fetchSolution(0, c, 1, actSpikes, actBaseline, actInitCaVal, actNoise, actArParams, actScale));
+        REQUIRE(arma::approx_equal(actSpikes, spikes, "absdiff", 1e-6f));
+        REQUIRE(actBaseline == Approx(0.5f));
+
+        REQUIRE(!cache.fetch(1, trace, 1, actArParams, actNoise));
+        REQUIRE(cache.hasChanged(1, trace));
+        REQUIRE(!cache.fetchSolution(1, c, 1, actSpikes, actBaseline, actInitCaVal, actNoise, actArParams, actScale));
+    }
+}
+
+TEST_CASE("CnmfeTemporalReuseAcrossUpdates", "[cnmfe-temporal]")
+{
+    // three components with disjoint footprints and AR(1) activity
+    const size_t numPixels = 30;
+    const size_t numComponents = 3;
+    const size_t numFrames = 500;
+
+    arma::arma_rng::set_seed(0);
+    isx::MatrixFloat_t A = arma::zeros<isx::MatrixFloat_t>(numPixels, numComponents);
+    isx::MatrixFloat_t trueC = arma::zeros<isx::MatrixFloat_t>(numComponents, numFrames);
+    const isx::MatrixFloat_t draws = arma::randu<isx::MatrixFloat_t>(numComponents, numFrames);
+    for (size_t k = 0; k < numComponents; ++k)
+    {
+        A(arma::span(10 * k, 10 * k + 9), arma::span(k)) = arma::randu<isx::ColumnFloat_t>(10) + 0.5f;
+        for (size_t t = 1; t < numFrames; ++t)
+        {
+            const float spike = (draws(k, t) < 0.02f) ? 5.0f : 0.0f;
+            trueC(k, t) = 0.9f * trueC(k, t - 1) + spike;
+        }
+    }
+    const isx::MatrixFloat_t Y = A * trueC + 0.2f * arma::randn<isx::MatrixFloat_t>(numPixels, numFrames);
+
+    isx::DeconvolutionStateCache cache;
+    isx::MatrixFloat_t C = trueC;
+    isx::ColumnFloat_t bl, c1, sn;
+    isx::MatrixFloat_t g, S, YrA;
+    isx::updateTemporalComponents(Y, A, C, bl, c1, g, sn, S, YrA, isx::DeconvolutionParams(), 2, 1, &cache);
+    REQUIRE(cache.m_numDeconvolved == numComponents);
+
+    // the spatial update normalizes the temporal components and scales the footprints up accordingly
+    const isx::ColumnFloat_t norms = arma::sqrt(arma::sum(arma::square(C), 1)) + std::numeric_limits<float>::epsilon();
+    isx::MatrixFloat_t scaledA = A;
+    isx::MatrixFloat_t scaledC = C;
+    for (size_t k = 0; k < numComponents; ++k)
+    {
+        scaledA.col(k) *= norms(k);
+        scaledC.row(k) /= norms(k);
+    }
+
+    SECTION("solutions of rescaled components are reused and scaled")
+    {
+        isx::MatrixFloat_t actC = scaledC;
+        isx::ColumnFloat_t actBl, actC1, actSn;
+        isx::MatrixFloat_t actG, actS, actYrA;
+        isx::updateTemporalComponents(Y, scaledA, actC, actBl, actC1, actG, actSn, actS, actYrA, isx::DeconvolutionParams(), 2, 1, &cache);
+
+        REQUIRE(cache.m_numDeconvolved == numComponents);
+        REQUIRE(arma::approx_equal(actC, scaledC, "absdiff", 0.0f));
+        REQUIRE(arma::approx_equal(actG, g, "absdiff", 0.0f));
+        for (size_t k = 0; k < numComponents; ++k)
+        {
+            REQUIRE(arma::approx_equal(actS.row(k), S.row(k) / norms(k), "reldiff", 1e-5f));
+            REQUIRE(approxEqual(actBl(k), bl(k) / norms(k), 1e-5));
+            REQUIRE(approxEqual(actC1(k), c1(k) / norms(k), 1e-5));
+            REQUIRE(approxEqual(actSn(k), sn(k) / norms(k), 1e-5));
+        }
+
+        // same solution as deconvolving the rescaled traces again, up to the tolerance of the solver
+        isx::MatrixFloat_t expC = scaledC;
+        isx::ColumnFloat_t expBl, expC1, expSn;
+        isx::MatrixFloat_t expG, expS, expYrA;
+        isx::updateTemporalComponents(Y, scaledA, expC, expBl, expC1, expG, expSn, expS, expYrA, isx::DeconvolutionParams(), 2, 1);
+        REQUIRE(arma::norm(actC - expC, "fro") <= 1e-2f * arma::norm(expC, "fro"));
+    }
+
+    SECTION("changed components are deconvolved again")
+    {
+        isx::MatrixFloat_t actC = scaledC;
+        actC.row(1) = arma::fliplr(actC.row(1));
+        isx::ColumnFloat_t actBl, actC1, actSn;
+        isx::MatrixFloat_t actG, actS, actYrA;
+        isx::updateTemporalComponents(Y, scaledA, actC, actBl, actC1, actG, actSn, actS, actYrA, isx::DeconvolutionParams(), 2, 1, &cache);
+
+        REQUIRE(cache.m_numDeconvolved > numComponents);
+        REQUIRE(arma::approx_equal(actC.row(0), scaledC.row(0), "absdiff", 0.0f));
+        REQUIRE(arma::approx_equal(actC.row(2), scaledC.row(2), "absdiff", 0.0f));
+    }
+}
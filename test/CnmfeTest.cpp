@@ -1,6 +1,8 @@
 #define CATCH_CONFIG_MAIN  // This tells Catch to provide a main() - only do this in one cpp file
 #include "catch.hpp"
 #include "isx/cnmfe.h"
+#include "isxCnmfeInitialization.h"
+#include "isxTiffMovie.h"
 #include "isxUtilities.h"
 
 TEST_CASE("CnmfeFullTest", "[cnmfe]")
@@ -57,3 +59,83 @@ TEST_CASE("CnmfeFullTest", "[cnmfe]")
     REQUIRE(isx::pathExists(expTracesFile));
     isx::removeDirectory(outputDirPath);
 }
+
+namespace
+{
+    /// Reads the given frames of a tiff movie
+    isx::CubeFloat_t readFrames(const std::string & inMoviePath, const arma::uvec & inFrames)
+    {
+        isx::TiffMovie movie(inMoviePath);
+        isx::CubeFloat_t data(movie.getFrameHeight(), movie.getFrameWidth(), inFrames.n_elem);
+        for (size_t i = 0; i < inFrames.n_elem; ++i)
+        {
+            isx::MatrixFloat_t frame;
+            movie.getFrame(inFrames(i), frame);
+            data.slice(i) = frame;
+        }
+        return data;
+    }
+}
+
+TEST_CASE("CnmfePreviewTest", "[cnmfe]")
+{
+    const std::string inputMoviePath = "test/data/movie.tif";  // movie dims: 128x128x100 (width * height * num_frames)
+    const int averageCellDiameter = 7;
+    const float minCorr = 0.8;
+    const float minPnr = 10.0;
+    const int gaussianKernelSize = 0;  // auto estimate
+    const int numThreads = 4;
+
+    // initialization parameters set by cnmfePreview(...)
+    isx::InitializationParams initParams;
+    initParams.m_averageCellDiameter = averageCellDiameter * 2;
+    initParams.m_minCorr = minCorr;
+    initParams.m_minPNR = minPnr;
+    initParams.m_gaussianKernelSize = isx::estimateFilterSize(initParams.m_averageCellDiameter);
+
+    SECTION("all frames")
+    {
+        const std::tuple<arma::Mat<float>,arma::Mat<float>,arma::Mat<float>> preview = isx::cnmfePreview(
+            inputMoviePath, averageCellDiameter, minCorr, minPnr, gaussianKernelSize, 0, numThreads);
+        const arma::Mat<float> & pnr = std::get<0>(preview);
+        const arma::Mat<float> & localCorr = std::get<1>(preview);
+        const arma::Mat<float> & seeds = std::get<2>(preview);
+
+        REQUIRE(pnr.n_rows == 128);
+        REQUIRE(pnr.n_cols == 128);
+        REQUIRE(arma::size(localCorr) == arma::size(pnr));
+        REQUIRE(arma::size(seeds) == arma::size(pnr));
+
+        // candidate seed pixels pass both initialization thresholds
+        const arma::uvec seedIndices = arma::find(seeds > 0.0f);
+        REQUIRE(!seedIndices.empty());
+        REQUIRE(arma::all(pnr.elem(seedIndices) >= minPnr));
+        REQUIRE(arma::all(localCorr.elem(seedIndices) >= minCorr));
+
+        // images are the ones screened by the initialization of neurons
+        isx::MatrixFloat_t expPnr, expLocalCorr, expSeeds;
+        isx::computeSeedSearchImages(
+            readFrames(inputMoviePath, arma::regspace<arma::uvec>(0, 99)), initParams, expPnr, expLocalCorr, expSeeds, numThreads);
+        REQUIRE(arma::approx_equal(pnr, expPnr, "absdiff", 1e-5f));
+        REQUIRE(arma::approx_equal(localCorr, expLocalCorr, "absdiff", 1e-5f));
+        REQUIRE(arma::approx_equal(seeds, expSeeds, "absdiff", 1e-5f));
+    }
+
+    SECTION("subset of frames")
+    {
+        const std::tuple<arma::Mat<float>,arma::Mat<float>,arma::Mat<float>> preview = isx::cnmfePreview(
+            inputMoviePath, averageCellDiameter, minCorr, minPnr, gaussianKernelSize, 60, numThreads);
+
+        REQUIRE(std::get<0>(preview).n_rows == 128);
+        REQUIRE(std::get<0>(preview).n_cols == 128);
+        REQUIRE(arma::size(std::get<2>(preview)) == arma::size(std::get<0>(preview)));
+
+        // segments of 20 frames at the start, middle and end of the movie
+        const arma::uvec frames = arma::join_cols(arma::join_cols(
+            arma::regspace<arma::uvec>(0, 19), arma::regspace<arma::uvec>(40, 59)), arma::regspace<arma::uvec>(80, 99));
+        isx::MatrixFloat_t expPnr, expLocalCorr, expSeeds;
+        isx::computeSeedSearchImages(readFrames(inputMoviePath, frames), initParams, expPnr, expLocalCorr, expSeeds, numThreads);
+        REQUIRE(arma::approx_equal(std::get<0>(preview), expPnr, "absdiff", 1e-5f));
+        REQUIRE(arma::approx_equal(std::get<1>(preview), expLocalCorr, "absdiff", 1e-5f));
+    }
+}
@@ -290,6 +290,59 @@ TEST_CASE("LocalCorrelationsFftTest", "[cnmfe-utils]")
         isx::computeLocalCorr(input, actResult);
         REQUIRE(arma::approx_equal(expResult, actResult, "reldiff", 1e-5f));
     }
+
+    SECTION("parallel and repeated calls on boxes of a movie")
+    {
+        arma::arma_rng::set_seed(0);
+        isx::CubeFloat_t input(20, 17, 30, arma::fill::randn);
+        input.tube(5, 6, 9, 12).zeros();
+
+        isx::MatrixFloat_t expResult;
+        isx::computeLocalCorr(input, expResult);
+
+        isx::MatrixFloat_t actResult;
+        isx::computeLocalCorr(input, actResult, 4);
+        REQUIRE(arma::approx_equal(expResult, actResult, "absdiff", 1e-6f));
+
+        // smaller box after a larger one reuses the scratch buffers of the thread
+        const isx::CubeFloat_t box = input(arma::span(2, 8), arma::span(3, 11), arma::span::all);
+        isx::MatrixFloat_t boxResult;
+        isx::computeLocalCorr(box, boxResult);
+        REQUIRE(boxResult.n_rows == 7);
+        REQUIRE(boxResult.n_cols == 9);
+
+        isx::computeLocalCorr(input, actResult);
+        REQUIRE(arma::approx_equal(expResult, actResult, "absdiff", 0.0f));
+
+        isx::MatrixFloat_t boxResultAgain;
+        isx::computeLocalCorr(box, boxResultAgain);
+        REQUIRE(arma::approx_equal(boxResult, boxResultAgain, "absdiff", 0.0f));
+    }
+
+    SECTION("thresholded region of a movie")
+    {
+        arma::arma_rng::set_seed(0);
+        const isx::CubeFloat_t input(12, 10, 25, arma::fill::randn);
+        const isx::MatrixFloat_t minValues(12, 10, arma::fill::randn);
+
+        // reference computed on a thresholded copy of the region
+        isx::CubeFloat_t box = input(arma::span(3, 9), arma::span(2, 8), arma::span::all);
+        const isx::MatrixFloat_t minBox = minValues(arma::span(3, 9), arma::span(2, 8));
+        for (size_t i = 0; i < box.n_slices; ++i)
+        {
+            box.slice(i).elem(arma::find(box.slice(i) < minBox)).fill(0);
+        }
+        isx::MatrixFloat_t expResult;
+        isx::computeLocalCorr(box, expResult);
+
+        isx::MatrixFloat_t actResult;
+        isx::computeLocalCorr(input, std::make_tuple(3, 9, 2, 8), minValues, actResult);
+        REQUIRE(arma::approx_equal(expResult, actResult, "absdiff", 1e-6f));
+
+        isx::computeLocalCorr(input, std::make_tuple(0, 11, 0, 9), isx::MatrixFloat_t(), actResult, 3);
+        isx::computeLocalCorr(input, expResult);
+        REQUIRE(arma::approx_equal(expResult, actResult, "absdiff", 1e-6f));
+    }
 }
 
 TEST_CASE("LassoLars", "[cnmfe-utils]")
@@ -354,6 +407,39 @@ TEST_CASE("LassoLars", "[cnmfe-utils]")
 
         REQUIRE(arma::approx_equal(expectedBeta, outBeta, "reldiff", 1e-5f));
     }
+
+    SECTION("precomputed design with subsets of predictors")
+    {
+        isx::MatrixFloat_t inX = {
+                {5.0f, 5.0f, 0.5f},
+                {5.0f, 4.0f, 9.1f},
+                {6.0f, 3.0f, 4.0f},
+                {5.0f, 4.0f, 12.0f},
+                {7.0f, -5.0f, 0.9f},
+        };
+        isx::RowFloat_t inY = {-1.0f, 2.0f, 42.0f, -6.0f, 1.0f};
+        float lambda = 0.02294787473418495f;
+
+        isx::LassoLarsDesign design;
+        isx::prepareLassoLarsDesign(inX, design);
+
+        const arma::uvec allPredictors = {0, 1, 2};
+        isx::ColumnFloat_t expectedBeta = {61.54273113f, 12.2913786f, 0.86923194f};
+        isx::ColumnFloat_t outBeta;
+        isx::lassoLars(design, allPredictors, design.m_gram, inY, outBeta, lambda, true);
+        REQUIRE(arma::approx_equal(expectedBeta, outBeta, "reldiff", 1e-4f));
+
+        const arma::uvec subsetPredictors = {0, 2};
+        isx::lassoLars(inX.cols(subsetPredictors), inY, expectedBeta, lambda, true);
+        isx::lassoLars(design, subsetPredictors, design.m_gram.submat(subsetPredictors, subsetPredictors), inY, outBeta, lambda, true);
+        REQUIRE(arma::approx_equal(expectedBeta, outBeta, "reldiff", 1e-4f));
+
+        // the response is centered like in the other overloads, so an offset does not change the fit
+        const isx::RowFloat_t offsetY = inY + 1000.0f;
+        isx::lassoLars(inX.cols(subsetPredictors), offsetY, expectedBeta, lambda, true);
+        isx::lassoLars(design, subsetPredictors, design.m_gram.submat(subsetPredictors, subsetPredictors), offsetY, outBeta, lambda, true);
+        REQUIRE(arma::approx_equal(expectedBeta, outBeta, "reldiff", 1e-4f));
+    }
 }
 
 TEST_CASE("CnmfeUtilsScaleSpatialTemporalComponents")
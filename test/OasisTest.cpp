@@ -61,5 +61,155 @@ TEST_CASE("OasisAccuracy", "[oasis]")
       REQUIRE(approxEqual(actualB, expectedB, 1e-5));
       REQUIRE(approxEqual(actualCa1, expectedCa1, 1e-5));
       REQUIRE(approxEqual(arma::norm_dot(actualS, expectedS), 1.0, 1e-7));
+
+      SECTION("solver reused across traces")
+      {
+          // solve a shorter trace with other parameters first so that buffers are larger than needed
+          const isx::ColumnFloat_t otherY = arma::reverse(y.head(30));
+          isx::ColumnFloat_t otherC, otherS;
+          float otherB, otherCa1;
+          isx::Oasis otherOasis(0.9f, 1.0f);
+          otherOasis.solveFoopsi(otherY, otherB, otherCa1, otherC, otherS);
+
+          oasis.setParameters(0.9f, 1.0f);
+          oasis.solveFoopsi(otherY, actualB, actualCa1, actualC, actualS);
+          REQUIRE(arma::approx_equal(actualC, otherC, "absdiff", 0.0f));
+          REQUIRE(arma::approx_equal(actualS, otherS, "absdiff", 0.0f));
+          REQUIRE(actualB == otherB);
+          REQUIRE(actualCa1 == otherCa1);
+
+          oasis.setParameters(gamma, noise);
+          oasis.solveFoopsi(y, actualB, actualCa1, actualC, actualS);
+          REQUIRE(approxEqual(arma::norm_dot(actualC, expectedC), 1.0, 1e-7));
+          REQUIRE(approxEqual(actualB, expectedB, 1e-5));
+          REQUIRE(approxEqual(actualCa1, expectedCa1, 1e-5));
+          REQUIRE(approxEqual(arma::norm_dot(actualS, expectedS), 1.0, 1e-7));
+      }
+    }
+}
+
+TEST_CASE("OnlineOasis", "[oasis]")
+{
+    const isx::ColumnFloat_t y = {1.0f, 3.0f, 0.0f, 0.0f};
+    const float gamma = 0.5f;
+
+    SECTION("lag longer than the trace gives the batch solution")
+    {
+        isx::OnlineOasis oasis(gamma, 0.0f, 0.0f, 10);
+
+        isx::ColumnFloat_t actualC, actualS;
+        oasis.update(y, actualC, actualS);
+        REQUIRE(actualC.n_elem == 0);
+        REQUIRE(oasis.getNumSamples() == 4);
+        REQUIRE(oasis.getNumFinalized() == 0);
+
+        oasis.flush(actualC, actualS);
+        const isx::ColumnFloat_t expectedC = {1.0f, 2.2857143f, 1.1428571f, 0.5714286f};
+        const isx::ColumnFloat_t expectedS = {0.0f, 1.7857143f, 0.0f, 0.0f};
+        REQUIRE(arma::approx_equal(actualC, expectedC, "absdiff", 1e-6f));
+        REQUIRE(arma::approx_equal(actualS, expectedS, "absdiff", 1e-6f));
+        REQUIRE(oasis.getNumFinalized() == 4);
+    }
+
+    SECTION("values are finalized after the lag")
+    {
+        isx::OnlineOasis oasis(gamma, 0.0f, 0.0f, 1);
+
+        // samples are fed one at a time, values are finalized one sample later
+        std::vector<float> actualC;
+        for (size_t t = 0; t < y.n_elem; t++)
+        {
+            isx::ColumnFloat_t c, s;
+            oasis.update(y.subvec(t, t), c, s);
+            REQUIRE(c.n_elem == (t == 0 ? 0 : 1));
+            REQUIRE(oasis.getNumFinalized() == t);
+            actualC.insert(actualC.end(), c.begin(), c.end());
+        }
+
+        isx::ColumnFloat_t c, s;
+        oasis.flush(c, s);
+        actualC.insert(actualC.end(), c.begin(), c.end());
+
+        // the peak is finalized before the following samples lower the fit of its pool
+        const isx::ColumnFloat_t expectedC = {1.0f, 2.4f, 1.1428571f, 0.5714286f};
+        REQUIRE(arma::approx_equal(isx::ColumnFloat_t(actualC), expectedC, "absdiff", 1e-6f));
+    }
+
+    SECTION("values are finalized immediately with no lag")
+    {
+        isx::OnlineOasis oasis(gamma, 0.0f, 0.0f, 0);
+
+        // each sample opens a pool once the previous one is fully finalized
+        isx::ColumnFloat_t c1, s1, c2, s2;
+        oasis.update(y.subvec(0, 0), c1, s1);
+        oasis.update(y.subvec(1, 1), c2, s2);
+
+        REQUIRE(oasis.getNumFinalized() == 2);
+        REQUIRE(c1.n_elem == 1);
+        REQUIRE(c2.n_elem == 1);
+        REQUIRE(c1(0) == Approx(1.0f));
+        REQUIRE(c2(0) == Approx(3.0f));
+        REQUIRE(s2(0) == Approx(2.5f));
+    }
+
+    SECTION("samples received after a flush")
+    {
+        isx::OnlineOasis oasis(gamma, 0.0f, 0.0f, 10);
+
+        isx::ColumnFloat_t c, s;
+        oasis.update(y, c, s);
+        oasis.flush(c, s);
+        REQUIRE(oasis.getNumFinalized() == 4);
+
+        const isx::ColumnFloat_t next = {4.0f};
+        oasis.update(next, c, s);
+        REQUIRE(c.n_elem == 0);
+        oasis.flush(c, s);
+
+        // the new sample does not merge with the pools of the flushed values
+        REQUIRE(c.n_elem == 1);
+        REQUIRE(c(0) == Approx(4.0f));
+        REQUIRE(s(0) == Approx(4.0f - gamma * 0.5714286f));
+        REQUIRE(oasis.getNumFinalized() == 5);
+    }
+}
+
+TEST_CASE("OasisDecayPowers", "[oasis]")
+{
+    const float gamma = 0.9f;
+    const isx::DecayPowers powers(gamma);
+
+    SECTION("tables are limited to the number of powers needed")
+    {
+        isx::DecayPowers shortPowers(gamma, 10);
+        REQUIRE(shortPowers.getNumPowers() == 10);
+        REQUIRE(approxEqual(shortPowers(20), std::pow(gamma, 20.0f), 1e-6));
+
+        shortPowers.reset(0.5f, 1000);
+        REQUIRE(shortPowers.getGamma() == 0.5f);
+        REQUIRE(shortPowers.getNumPowers() < 1000);
+        REQUIRE(approxEqual(shortPowers(3), 0.125f, 1e-6));
+        REQUIRE(shortPowers(shortPowers.getNumPowers()) == 0.0f);
+    }
+
+    SECTION("powers are stored until they underflow")
+    {
+        REQUIRE(powers(0) == 1.0f);
+        REQUIRE(approxEqual(powers(10), std::pow(gamma, 10.0f), 1e-6));
+        REQUIRE(powers.getNumPowers() < 2000);
+        REQUIRE(powers(powers.getNumPowers()) == 0.0f);
+    }
+
+    SECTION("scaled exponential is added to a trace")
+    {
+        isx::ColumnFloat_t trace(5000, arma::fill::ones);
+        powers.addScaled(2.0f, trace);
+
+        isx::ColumnFloat_t expected(5000);
+        for (size_t t = 0; t < expected.n_elem; t++)
+        {
+            expected(t) = 1.0f + 2.0f * std::pow(gamma, static_cast<float>(t));
+        }
+        REQUIRE(arma::approx_equal(trace, expected, "absdiff", 1e-5f));
     }
 }
@@ -0,0 +1,146 @@
+#include "catch.hpp"
+#include "isxTaskScheduler.h"
+#include "isxTest.h"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+namespace
+{
+    size_t square(const size_t inValue)
+    {
+        return inValue * inValue;
+    }
+
+    size_t sumOfSquares(isx::TaskScheduler & inScheduler, const size_t inCount)
+    {
+        std::vector<std::future<size_t>> results(inCount);
+        for (size_t i = 0; i < inCount; ++i)
+        {
+            results[i] = inScheduler.enqueue(square, i);
+        }
+
+        size_t sum = 0;
+        for (size_t i = 0; i < inCount; ++i)
+        {
+            sum += inScheduler.wait(results[i]);
+        }
+        return sum;
+    }
+}
+
+TEST_CASE("TaskScheduler", "[utilities]")
+{
+    SECTION("tasks return their results")
+    {
+        isx::TaskScheduler scheduler(3);
+        REQUIRE(scheduler.getNumThreads() == 3);
+
+        const size_t numTasks = 100;
+        std::vector<std::future<size_t>> results(numTasks);
+        for (size_t i = 0; i < numTasks; ++i)
+        {
+            results[i] = scheduler.enqueueWithHint(i + 1, square, i);
+        }
+
+        for (size_t i = 0; i < numTasks; ++i)
+        {
+            REQUIRE(scheduler.wait(results[i]) == i * i);
+        }
+    }
+
+    SECTION("nested tasks complete when every worker waits on its children")
+    {
+        // More outer tasks than workers, each blocking on inner tasks queued behind them
+        isx::TaskScheduler scheduler(2);
+
+        const size_t numOuter = 8;
+        const size_t numInner = 16;
+        std::vector<std::future<size_t>> results(numOuter);
+        for (size_t i = 0; i < numOuter; ++i)
+        {
+            results[i] = scheduler.enqueue(sumOfSquares, std::ref(scheduler), numInner);
+        }
+
+        const size_t expected = (numInner - 1) * numInner * (2 * numInner - 1) / 6;
+        for (size_t i = 0; i < numOuter; ++i)
+        {
+            REQUIRE(scheduler.wait(results[i]) == expected);
+        }
+    }
+
+    SECTION("exceptions are rethrown by wait")
+    {
+        isx::TaskScheduler scheduler(2);
+        std::future<void> result = scheduler.enqueue([]() { throw std::runtime_error("task failed"); });
+        REQUIRE_THROWS_AS(scheduler.wait(result), std::runtime_error);
+    }
+
+    SECTION("waiting on all tasks rethrows only once every task has completed")
+    {
+        isx::TaskScheduler scheduler(2);
+
+        const size_t numTasks = 50;
+        std::vector<int> done(numTasks, 0);
+        std::vector<std::future<void>> results(numTasks);
+        for (size_t i = 0; i < numTasks; ++i)
+        {
+            results[i] = scheduler.enqueue([i, &done]()
+            {
+                if (i == 0)
+                {
+                    throw std::runtime_error("task failed");
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                done[i] = 1;
+            });
+        }
+
+        REQUIRE_THROWS_AS(scheduler.waitAll(results), std::runtime_error);
+        for (size_t i = 1; i < numTasks; ++i)
+        {
+            REQUIRE(done[i] == 1);
+        }
+    }
+
+    SECTION("no more tasks than workers run at once")
+    {
+        isx::TaskScheduler scheduler(2);
+
+        std::atomic<size_t> numRunning(0);
+        std::atomic<size_t> maxRunning(0);
+        const size_t numTasks = 20;
+        std::vector<std::future<void>> results(numTasks);
+        for (size_t i = 0; i < numTasks; ++i)
+        {
+            results[i] = scheduler.enqueue([&numRunning, &maxRunning]()
+            {
+                const size_t running = ++numRunning;
+                size_t previous = maxRunning;
+                while (running > previous && !maxRunning.compare_exchange_weak(previous, running))
+                {
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                --numRunning;
+            });
+        }
+
+        scheduler.waitAll(results);
+        REQUIRE(maxRunning <= 2);
+    }
+
+    SECTION("stages share the scheduler they are given")
+    {
+        isx::TaskScheduler shared(3);
+        std::shared_ptr<isx::TaskScheduler> first = isx::getTaskScheduler(&shared, 2);
+        std::shared_ptr<isx::TaskScheduler> second = isx::getTaskScheduler(&shared, 4);
+        REQUIRE(first.get() == &shared);
+        REQUIRE(second.get() == &shared);
+
+        std::shared_ptr<isx::TaskScheduler> local = isx::getTaskScheduler(nullptr, 2);
+        REQUIRE(local.get() != &shared);
+        REQUIRE(local->getNumThreads() == 2);
+    }
+}